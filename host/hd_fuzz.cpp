@@ -0,0 +1,188 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "mbed.h"
+#include "mbed-trace/mbed_trace.h"
+#include "mbed_hd_codec.h"
+#include "mbed_hd_frame.h"
+#include "mbed_hd_screen.h"
+#include "mbed_hd_xml.h"
+#include <cstdio>
+#include <stdlib.h>
+#include <vector>
+
+/* The bytes of the input after the first, handed out by recv in pieces of
+ * 1 to 256 bytes as the first one says, so that headers and bodies split
+ * everywhere. */
+class HD_FuzzSocket : public TCPSocket {
+public:
+  HD_FuzzSocket(const uint8_t *data, size_t size)
+      : _data(data + 1), _left(size - 1), _piece(data[0] + 1) {}
+
+  nsapi_size_or_error_t send(const void *, nsapi_size_t size) override {
+    return size;
+  }
+
+  nsapi_size_or_error_t recv(void *data, nsapi_size_t size) override {
+    if (_left == 0) {
+      return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    size_t n = size < _piece ? size : _piece;
+    n = n < _left ? n : _left;
+    memcpy(data, _data, n);
+    _data += n;
+    _left -= n;
+    return n;
+  }
+
+private:
+  const uint8_t *_data;
+  size_t _left;
+  size_t _piece;
+};
+
+static void hd_fuzz_sink(void *ctx, const char *data, size_t len) {
+  hd_sax_feed((HDC15_SaxParser *)ctx, data, len);
+}
+
+/* Read messages off the input as a session does, with the xml of every
+ * SDKCmdAnswer going through the SAX parser into a screen model, and run the
+ * body of each through every decoder. Strings and data a decoder hands back
+ * are read to the end, so a bound it got wrong shows up. */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size < 1) {
+    return 0;
+  }
+  mbed_trace_config_set(TRACE_ACTIVE_LEVEL_NONE);
+  HD_FuzzSocket sock(data, size);
+  HDC15_FrameReader rx = {};
+  HDC15_Screen *screen = (HDC15_Screen *)calloc(1, sizeof(HDC15_Screen));
+  HDC15_Screen *saved = (HDC15_Screen *)malloc(sizeof(HDC15_Screen));
+  HDC15_ScreenParse *parse =
+      (HDC15_ScreenParse *)malloc(sizeof(HDC15_ScreenParse));
+  HDC15_SaxParser sax;
+  hd_screen_parse_init(parse, screen);
+  hd_sax_init(&sax, parse->watch, HDC15_SCREEN_WATCH);
+  rx.sink = hd_fuzz_sink;
+  rx.sink_ctx = &sax;
+  volatile uint32_t sum = 0;
+  while (hd_frame_read(&rx, &sock) == 1) {
+    const void *body = rx.payload.data;
+    uint32_t len = rx.payload.len;
+    uint32_t version, n;
+    uint16_t status, type, flen, cmd;
+    uint64_t exist, offset;
+    char md5[HDC15_MD5_LENGHT + 1];
+    const char *name, *bytes;
+    HDC15_UdpHeader ask;
+    HDC15_UdpResponse ans;
+    HDC15_Codec k;
+    hd_codec_udp_ask_decode(body, len, &ask);
+    hd_codec_udp_answer_decode(body, len, &ans);
+    hd_codec_frame_decode(body, len, &flen, &cmd);
+    hd_codec_version_decode(body, len, &version);
+    hd_codec_status_decode(body, len, &status);
+    if (hd_codec_file_start_decode(body, len, md5, &exist, &type, &name) ==
+        0) {
+      sum += strlen(md5) + strlen(name);
+    }
+    hd_codec_file_start_answer_decode(body, len, &status, &exist);
+    if (hd_codec_read_ask_decode(body, len, &offset, &n, &type, &name) == 0) {
+      sum += strlen(name);
+    }
+    if (hd_codec_read_answer_decode(body, len, &status, &exist, md5, &bytes,
+                                    &n) == 0) {
+      sum += strlen(md5);
+      for (uint32_t i = 0; i < n; i++) {
+        sum += (uint8_t)bytes[i];
+      }
+    }
+    hd_codec_init(&k, rx.payload.data, len);
+    hd_screen_decode(&k, saved);
+    hd_sax_init(&sax, parse->watch, HDC15_SCREEN_WATCH);
+  }
+  hd_frame_free(&rx);
+  free(parse);
+  free(saved);
+  free(screen);
+  return 0;
+}
+
+#ifndef HD_FUZZ_LIBFUZZER
+/* Without libFuzzer: run the files given, or with none mutations of a
+ * fragmented SDKCmdAnswer followed by file transfer messages. */
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      FILE *f = fopen(argv[i], "rb");
+      if (f == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+      std::vector<uint8_t> buf;
+      int c;
+      while ((c = fgetc(f)) != EOF) {
+        buf.push_back((uint8_t)c);
+      }
+      fclose(f);
+      LLVMFuzzerTestOneInput(buf.data(), buf.size());
+    }
+    return 0;
+  }
+  static const char xml[] =
+      "<?xml version=\"1.0\"?><sdk guid=\"##GUID\"><out method=\"GetProgram\""
+      " result=\"kSuccess\"><screen><program guid=\"p1\" name=\"a&amp;b\">"
+      "<area guid=\"a1\"><resources><text guid=\"t1\"/></resources></area>"
+      "</program></screen></out></sdk>";
+  uint32_t total = sizeof(xml) - 1;
+  uint32_t half = total / 2;
+  std::vector<uint8_t> seed(1 + 2 * HDC15_TCP_HEADER_LENGTH + total);
+  seed[0] = 7;
+  uint8_t *p = &seed[1];
+  int n = hd_codec_xml_frame(p, HDC15_TCP_HEADER_LENGTH + half, SDKCmdAnswer,
+                             half, total, 0);
+  memcpy(p + HDC15_TCP_HEADER_LENGTH, xml, half);
+  p += n;
+  hd_codec_xml_frame(p, HDC15_TCP_HEADER_LENGTH + total - half, SDKCmdAnswer,
+                     total - half, total, half);
+  memcpy(p + HDC15_TCP_HEADER_LENGTH, xml + half, total - half);
+  /* then one frame of each file transfer message */
+  static const char md5[] = "0123456789abcdef0123456789abcdef";
+  uint8_t frame[256];
+  n = hd_codec_file_start(frame, sizeof(frame), md5, 1000, 1, "a.png");
+  seed.insert(seed.end(), frame, frame + n);
+  n = hd_codec_file_start_answer(frame, sizeof(frame), 0, 500);
+  seed.insert(seed.end(), frame, frame + n);
+  n = hd_codec_read_ask(frame, sizeof(frame), 500, 16, 1, "a.png");
+  seed.insert(seed.end(), frame, frame + n);
+  n = hd_codec_read_answer(frame, sizeof(frame), 0, 1000, md5, 16);
+  memset(frame + n - 16, 'x', 16);
+  seed.insert(seed.end(), frame, frame + n);
+  srand(1);
+  for (int i = 0; i < 200000; i++) {
+    std::vector<uint8_t> in = seed;
+    for (int k = rand() % 8; k >= 0; k--) {
+      in[rand() % in.size()] = (uint8_t)rand();
+    }
+    in.resize(1 + rand() % in.size());
+    LLVMFuzzerTestOneInput(in.data(), in.size());
+  }
+  printf("hd_fuzz: 200000 inputs\n");
+  return 0;
+}
+#endif
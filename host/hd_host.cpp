@@ -0,0 +1,63 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "mbed.h"
+#include "mbed_hd_bench.h"
+#include "mbed_hd_sim.h"
+#include <cstdio>
+#include <stdlib.h>
+
+/* hd_host [iterations] [file_size] [latency_ms] [fragment]: start the
+ * simulated controller, find it like a real one and run hd_bench_run()
+ * against it. */
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100;
+  uint32_t file_size = argc > 2 ? atoi(argv[2]) : 16384;
+  HDC15_SimConfig cfg = {};
+  cfg.latency_ms = argc > 3 ? atoi(argv[3]) : 0;
+  cfg.fragment = argc > 4 ? atoi(argv[4]) : 0;
+  cfg.programs = 2;
+  if (hd_sim_start(&cfg) != 0) {
+    printf("sim start failed\n");
+    return 1;
+  }
+  /* the sim binds its sockets on threads of its own, an ask sent before
+   * that is lost */
+  int found = 0;
+  for (int i = 0; i < 5 && found <= 0; i++) {
+    found = hd_discover(200, 1);
+  }
+  if (found <= 0) {
+    printf("sim not found\n");
+    hd_sim_stop();
+    return 1;
+  }
+  int id = hd_device_find("SIM-0000000000");
+  HDC15_BenchResult res;
+  int ret = hd_bench_run(NULL, id, iterations, file_size, &res);
+  if (ret == 0) {
+    hd_bench_print(&res);
+  }
+  HDC15_SimStats stats;
+  hd_sim_stats(&stats);
+  printf("sim: %u searches, %u sessions, %u commands, %u files\n",
+         (unsigned)stats.searches, (unsigned)stats.sessions,
+         (unsigned)stats.commands, (unsigned)stats.files);
+  hd_sim_stop();
+  return ret == 0 ? 0 : 1;
+}
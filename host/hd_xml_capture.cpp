@@ -0,0 +1,163 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "tinyxml.h"
+#include "hd_xml_cases.h"
+#include <cstdio>
+#include <string>
+
+/* Writes xml/<name>.xml for every case of hd_xml_cases.h the way the client
+ * built its commands before the templates: parse the literal, set the
+ * attributes and text through the DOM, print it, then parse that once more
+ * to set the session guid and print it again. The literals are the ones the
+ * client had then; updatetext_xml follows them for the text-only update. */
+
+static const char cmd_xml[] = {"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                               "<sdk guid=\"##GUID\">"
+                               "<in method=\"##CMD\"></in>"
+                               "</sdk>"};
+
+static const char add_program_xml[]{
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+    "<sdk guid=\"##GUID\">"
+    "<in method=\"AddProgram\">"
+    "<screen>"
+    "<program guid=\"d0014343-5c25-4719-af95-2eccf2e74550\" type=\"normal\">"
+    "<playControl count=\"1\" disabled= \"true\"/>"
+    "<area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">"
+    "<rectangle x=\"0\" y=\"0\" width=\"640\" height=\"64\"/>"
+    "<resources>"
+    "<text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\" singleLine=\"true\">"
+    "<string>欢迎光临</string>"
+    "<effect in=\"0\" out=\"20\" inSpeed=\"4\" outSpeed=\"4\" duration=\"50\"/>"
+    "<font name=\"宋体\"  bold=\"False\" italic=\"False\" underline=\"False\" "
+    "size=\"48\"/>"
+    "</text>"
+    "</resources>"
+    "</area>"
+    "</program>"
+    "</screen>"
+    "</in>"
+    "</sdk>"};
+
+static const char playcontrol_xml[]{"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                                    "<sdk guid=\"##GUID\">"
+                                    "<in method=\"UpdateProgram\">"
+                                    "<screen>"
+                                    "<program guid=\"##guid\">"
+                                    "<playControl disabled= \"##en\"/>"
+                                    "</program>"
+                                    "</screen>"
+                                    "</in>"
+                                    "</sdk>"};
+
+static const char updatetext_xml[]{
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+    "<sdk guid=\"##GUID\">"
+    "<in method=\"UpdateProgram\">"
+    "<screen>"
+    "<program guid=\"##guid\">"
+    "<area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">"
+    "<resources>"
+    "<text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\">"
+    "<string>##str</string>"
+    "</text>"
+    "</resources>"
+    "</area>"
+    "</program>"
+    "</screen>"
+    "</in>"
+    "</sdk>"};
+
+/* What hd_build_textcontrol() and hd_build_playcontrol() did. */
+static void hd_capture_build(const HD_XmlCase *t, TiXmlPrinter *printer) {
+  static const char *const xml[] = {add_program_xml, playcontrol_xml,
+                                    updatetext_xml, cmd_xml};
+  TiXmlDocument doc;
+  doc.Parse(xml[t->doc]);
+  TiXmlHandle docHandle(&doc);
+  if (t->doc == HD_XML_CMD) {
+    TiXmlElement *child_in = docHandle.FirstChild("sdk")
+                                 .FirstChild("in")
+                                 .ToElement();
+    if (child_in) {
+      child_in->SetAttribute("method", t->value);
+    }
+    doc.Accept(printer);
+    return;
+  }
+  char guid[64];
+  snprintf(guid, sizeof(guid), HD_XML_PROGRAM_GUID, t->program, t->program);
+  TiXmlElement *child_program = docHandle.FirstChild("sdk")
+                                    .FirstChild("in")
+                                    .FirstChild("screen")
+                                    .FirstChild("program")
+                                    .ToElement();
+  if (child_program) {
+    child_program->SetAttribute("guid", guid);
+    TiXmlElement *child_playControl =
+        child_program->FirstChildElement("playControl");
+    if (child_playControl) {
+      child_playControl->SetAttribute("disabled", t->en ? "false" : "true");
+    }
+    TiXmlElement *child_area = child_program->FirstChildElement("area");
+    if (child_area && t->value) {
+      TiXmlElement *child_string = child_area->FirstChildElement("resources")
+                                       ->FirstChildElement("text")
+                                       ->FirstChildElement("string");
+      if (child_string) {
+        TiXmlText *childText = child_string->FirstChild()->ToText();
+        childText->SetValue(t->value);
+      }
+    }
+  }
+  doc.Accept(printer);
+}
+
+/* What hd_session_send() did with the result. */
+static std::string hd_capture_send(const char *xml) {
+  TiXmlDocument doc;
+  doc.Parse(xml);
+  TiXmlElement *element = doc.RootElement();
+  if (element) {
+    element->SetAttribute("guid", HD_XML_SESSION_GUID);
+  }
+  TiXmlPrinter printer;
+  doc.Accept(&printer);
+  return printer.CStr();
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "xml";
+  int num = sizeof(hd_xml_cases) / sizeof(hd_xml_cases[0]);
+  for (int i = 0; i < num; i++) {
+    const HD_XmlCase *t = &hd_xml_cases[i];
+    TiXmlPrinter printer;
+    hd_capture_build(t, &printer);
+    std::string out = hd_capture_send(printer.CStr());
+    std::string path = std::string(dir) + "/" + t->name + ".xml";
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL || fwrite(out.data(), 1, out.size(), f) != out.size()) {
+      perror(path.c_str());
+      return 1;
+    }
+    fclose(f);
+  }
+  printf("hd_xml_capture: %d documents\n", num);
+  return 0;
+}
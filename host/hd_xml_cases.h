@@ -0,0 +1,68 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef HD_XML_CASES_H
+#define HD_XML_CASES_H
+
+#include <stddef.h>
+
+/* The documents hd_xml_check renders and hd_xml_capture prints with the
+ * TinyXML path the templates replaced; xml/<name>.xml holds the bytes. */
+enum HD_XmlDoc
+{
+    HD_XML_ADD = 0,          //< hd_textcontrol(): AddProgram
+    HD_XML_PLAY,             //< hd_playcontrol()
+    HD_XML_UPDATE,           //< hd_program_update() with text only
+    HD_XML_CMD,              //< the method attribute of a plain command
+};
+
+typedef struct HD_XmlCase
+{
+    const char *name;
+    int doc;
+    int program;             //< as GetProgram of the simulator numbers them
+    bool en;
+    const char *value;       //< ##str, or ##CMD for HD_XML_CMD
+} HD_XmlCase;
+
+/* guids the simulator hands out to its first session and programs */
+#define HD_XML_SESSION_GUID  "sim00000001"
+#define HD_XML_PROGRAM_GUID  "%08x-0000-4000-8000-%012x"
+
+static const HD_XmlCase hd_xml_cases[] = {
+    {"add_plain", HD_XML_ADD, 0, true, "\xe6\xac\xa2\xe8\xbf\x8e"},
+    {"add_quote", HD_XML_ADD, 1, false, "say \"hi\", it's"},
+    {"add_amp", HD_XML_ADD, 0, true, "a & b <c> d&amp;e"},
+    {"add_control", HD_XML_ADD, 0, true, "a\x01" "b\tc\nd\re"},
+    {"add_spaces", HD_XML_ADD, 0, true, "  a   b    c  "},
+    {"add_refs", HD_XML_ADD, 0, true,
+     "&#x41;&#x20;&#x20;B&#66;&#X43;&#x26;&#x3C;&#xE9;&#x9;"},
+    {"add_blank", HD_XML_ADD, 0, true, "   "},
+    {"add_empty", HD_XML_ADD, 0, true, ""},
+    {"play_on", HD_XML_PLAY, 0, true, NULL},
+    {"play_off", HD_XML_PLAY, 1, false, NULL},
+    {"update_quote", HD_XML_UPDATE, 1, false, "'\"'"},
+    {"update_spaces", HD_XML_UPDATE, 0, false, " x  &#x20; y "},
+    {"update_refs", HD_XML_UPDATE, 1, false, "&#x26;#x41;&#x26;amp;"},
+    {"update_mixed", HD_XML_UPDATE, 0, false, "1<2 &&#x3E; \x1f\"q\"  end "},
+    {"cmd_quote", HD_XML_CMD, 0, false, "Get\"Program'"},
+    {"cmd_spaces", HD_XML_CMD, 0, false, "  a&b\x01  c  "},
+    {"cmd_refs", HD_XML_CMD, 0, false, "&#x22;x&#38;&#x3c;"},
+};
+
+#endif /* HD_XML_CASES_H */
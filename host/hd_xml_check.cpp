@@ -0,0 +1,128 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "mbed.h"
+#include "mbed-trace/mbed_trace.h"
+#include "mbed_hd_client.h"
+#include "mbed_hd_sim.h"
+#include "hd_xml_cases.h"
+#include <cstdio>
+#include <string>
+
+/* Send every case of hd_xml_cases.h to the simulated controller through the
+ * public API and compare the document it receives with xml/<name>.xml, the
+ * output of the TinyXML path (see hd_xml_capture.cpp). */
+
+static std::string hd_check_xml;
+static Semaphore hd_check_done;
+
+static void hd_check_record(void *ctx, const char *xml, size_t len) {
+  (void)ctx;
+  hd_check_xml.assign(xml, len);
+}
+
+static void hd_check_answer(int id, int result, const char *xml, void *ctx) {
+  (void)id;
+  (void)xml;
+  *(int *)ctx = result;
+  hd_check_done.release();
+}
+
+static int hd_check_send(const HD_XmlCase *t) {
+  switch (t->doc) {
+  case HD_XML_ADD:
+    return hd_textcontrol(0, t->program, t->en, t->value);
+  case HD_XML_PLAY:
+    return hd_playcontrol(0, t->program, t->en);
+  case HD_XML_UPDATE:
+    return hd_program_update(0, t->program, -1, t->value);
+  default: {
+    int result = -1;
+    if (hd_cmd_nb(0, t->value, hd_check_answer, &result) != 0) {
+      return -1;
+    }
+    hd_check_done.acquire();
+    return result;
+  }
+  }
+}
+
+static bool hd_check_load(const char *dir, const char *name,
+                          std::string *out) {
+  std::string path = std::string(dir) + "/" + name + ".xml";
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == NULL) {
+    perror(path.c_str());
+    return false;
+  }
+  char buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out->append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "xml";
+  mbed_trace_config_set(TRACE_ACTIVE_LEVEL_NONE);
+  HDC15_SimConfig cfg = {};
+  cfg.programs = 2;
+  cfg.xml_cb = hd_check_record;
+  if (hd_sim_start(&cfg) != 0) {
+    printf("hd_xml_check: sim failed\n");
+    return 1;
+  }
+  int found = 0;
+  for (int i = 0; i < 5 && found <= 0; i++) {
+    found = hd_discover(200, 1);
+  }
+  if (found <= 0) {
+    printf("hd_xml_check: sim not found\n");
+    hd_sim_stop();
+    return 1;
+  }
+  int failed = 0;
+  int num = sizeof(hd_xml_cases) / sizeof(hd_xml_cases[0]);
+  for (int i = 0; i < num; i++) {
+    const HD_XmlCase *t = &hd_xml_cases[i];
+    std::string want;
+    hd_check_xml.clear();
+    int code = hd_check_send(t);
+    if (!hd_check_load(dir, t->name, &want)) {
+      failed++;
+      continue;
+    }
+    if (code != 0 || hd_check_xml != want) {
+      size_t at = 0;
+      while (at < want.size() && at < hd_check_xml.size() &&
+             want[at] == hd_check_xml[at]) {
+        at++;
+      }
+      size_t from = at > 40 ? at - 40 : 0;
+      printf("%s: result %d, differs at %u\n  want: %s\n  got:  %s\n",
+             t->name, code, (unsigned)at, want.substr(from, 80).c_str(),
+             hd_check_xml.substr(from, 80).c_str());
+      failed++;
+    }
+  }
+  hd_sim_stop();
+  printf("hd_xml_check: %d of %d documents match\n", num - failed, num);
+  return failed ? 1 : 0;
+}
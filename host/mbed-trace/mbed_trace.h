@@ -0,0 +1,47 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HOST_TRACE_H
+#define MBED_HOST_TRACE_H
+
+/* Trace to stderr: errors and warnings, info too with HDC15_HOST_TRACE set
+ * in the environment. */
+#define TRACE_LEVEL_ERROR 0
+#define TRACE_LEVEL_WARN  1
+#define TRACE_LEVEL_INFO  2
+#define TRACE_LEVEL_DEBUG 3
+
+#define TRACE_ACTIVE_LEVEL_NONE  0x00
+#define TRACE_ACTIVE_LEVEL_ERROR 0x04
+#define TRACE_ACTIVE_LEVEL_WARN  0x0c
+#define TRACE_ACTIVE_LEVEL_INFO  0x0e
+#define TRACE_ACTIVE_LEVEL_ALL   0x1f
+
+#include <stdint.h>
+
+/* One of TRACE_ACTIVE_LEVEL_*, overrides the environment. */
+void mbed_trace_config_set(uint8_t config);
+void mbed_tracef(int level, const char *grp, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define tr_err(...)   mbed_tracef(TRACE_LEVEL_ERROR, TRACE_GROUP, __VA_ARGS__)
+#define tr_warn(...)  mbed_tracef(TRACE_LEVEL_WARN, TRACE_GROUP, __VA_ARGS__)
+#define tr_info(...)  mbed_tracef(TRACE_LEVEL_INFO, TRACE_GROUP, __VA_ARGS__)
+#define tr_debug(...) mbed_tracef(TRACE_LEVEL_DEBUG, TRACE_GROUP, __VA_ARGS__)
+
+#endif /* MBED_HOST_TRACE_H */
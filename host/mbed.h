@@ -0,0 +1,418 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+/* The part of the mbed OS API the library uses, on POSIX: threads, locks
+ * and event queues on the C++ standard library, TCPSocket/UDPSocket on BSD
+ * sockets. It lets the client, the simulated controller and the benchmark
+ * run on a development host; see host/CMakeLists.txt. */
+
+#ifndef MBED_HOST_H
+#define MBED_HOST_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+#ifndef HAVE_STRLCPY
+extern "C" size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+/* platform */
+
+#define MBED_SUCCESS 0
+
+template <typename F> class Callback;
+template <typename R, typename... Args>
+class Callback<R(Args...)> : public std::function<R(Args...)> {
+public:
+  using std::function<R(Args...)>::function;
+};
+
+template <typename R, typename... Args>
+Callback<R(Args...)> callback(R (*fn)(Args...)) {
+  return Callback<R(Args...)>(fn);
+}
+
+template <typename Lockable> class ScopedLock {
+public:
+  explicit ScopedLock(Lockable &lockable) : _lockable(lockable) {
+    _lockable.lock();
+  }
+  ~ScopedLock() { _lockable.unlock(); }
+
+private:
+  Lockable &_lockable;
+};
+
+/* Serializes against every other CriticalSectionLock of the process,
+ * nothing more. */
+class CriticalSectionLock {
+public:
+  CriticalSectionLock();
+  ~CriticalSectionLock();
+};
+
+typedef struct core_util_atomic_flag {
+  uint8_t _flag;
+} core_util_atomic_flag;
+
+inline bool core_util_atomic_flag_test_and_set(volatile core_util_atomic_flag *f) {
+  return __atomic_test_and_set(&f->_flag, __ATOMIC_SEQ_CST);
+}
+inline void core_util_atomic_flag_clear(volatile core_util_atomic_flag *f) {
+  __atomic_clear(&f->_flag, __ATOMIC_SEQ_CST);
+}
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t *p, uint32_t d) {
+  return __atomic_add_fetch(p, d, __ATOMIC_SEQ_CST);
+}
+inline uint32_t core_util_atomic_fetch_add_u32(volatile uint32_t *p,
+                                               uint32_t d) {
+  return __atomic_fetch_add(p, d, __ATOMIC_SEQ_CST);
+}
+inline uint64_t core_util_atomic_fetch_add_u64(volatile uint64_t *p,
+                                               uint64_t d) {
+  return __atomic_fetch_add(p, d, __ATOMIC_SEQ_CST);
+}
+inline void core_util_atomic_store_bool(volatile bool *p, bool v) {
+  __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+inline bool core_util_atomic_load_bool(const volatile bool *p) {
+  return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+inline bool core_util_atomic_exchange_bool(volatile bool *p, bool v) {
+  return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+/* us_ticker: microseconds since the process started, wrapping at 32 bits */
+uint32_t us_ticker_read(void);
+
+class Timer {
+public:
+  void start();
+  void stop();
+  void reset();
+  std::chrono::microseconds elapsed_time() const;
+
+private:
+  bool _running = false;
+  std::chrono::steady_clock::time_point _since;
+  std::chrono::microseconds _total{0};
+};
+
+/* rtos */
+
+typedef void *osThreadId_t;
+typedef int32_t osStatus;
+#define osOK                0
+#define osError             -1
+#define osFlagsError        0x80000000u
+#define osFlagsErrorTimeout 0xFFFFFFFEu
+#define osWaitForever       0xFFFFFFFFu
+
+typedef enum {
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+} osPriority_t;
+
+namespace Kernel {
+struct Clock {
+  using duration = std::chrono::milliseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<Clock, duration>;
+  static const bool is_steady = true;
+  static time_point now();
+};
+} // namespace Kernel
+
+namespace ThisThread {
+void sleep_for(std::chrono::milliseconds ms);
+osThreadId_t get_id();
+} // namespace ThisThread
+
+/* Recursive, like the RTOS mutex. */
+class Mutex {
+public:
+  void lock();
+  bool trylock();
+  void unlock();
+  osThreadId_t get_owner();
+
+private:
+  std::recursive_mutex _mutex;
+  std::atomic<osThreadId_t> _owner{nullptr};
+  uint32_t _count = 0;
+};
+
+enum class cv_status { no_timeout, timeout };
+
+class ConditionVariable {
+public:
+  explicit ConditionVariable(Mutex &mutex) : _mutex(mutex) {}
+  void wait();
+  cv_status wait_for(std::chrono::milliseconds ms);
+  void notify_one();
+  void notify_all();
+
+private:
+  Mutex &_mutex;
+  std::condition_variable_any _cv;
+};
+
+class Semaphore {
+public:
+  explicit Semaphore(int32_t count = 0) : _count(count) {}
+  void acquire();
+  bool try_acquire();
+  bool try_acquire_for(std::chrono::milliseconds ms);
+  osStatus release();
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  int32_t _count;
+};
+
+class EventFlags {
+public:
+  uint32_t set(uint32_t flags);
+  uint32_t clear(uint32_t flags = 0x7fffffff);
+  uint32_t get() const;
+  uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever,
+                    bool clear = true);
+  uint32_t wait_any_for(uint32_t flags, std::chrono::milliseconds ms,
+                        bool clear = true);
+
+private:
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  uint32_t _flags = 0;
+};
+
+/* Fixed pool of pool_sz blocks of T, none of them constructed. */
+template <typename T, uint32_t pool_sz> class MemoryPool {
+public:
+  MemoryPool() {
+    for (uint32_t i = 0; i < pool_sz; i++) {
+      _free[i] = &_blocks[i];
+    }
+    _num = pool_sz;
+  }
+  T *try_alloc() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _num ? (T *)_free[--_num] : nullptr;
+  }
+  osStatus free(T *block) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Block *b = (Block *)block;
+    if (b < _blocks || b >= _blocks + pool_sz || _num == pool_sz) {
+      return osError;
+    }
+    _free[_num++] = b;
+    return osOK;
+  }
+
+private:
+  struct Block {
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+  std::mutex _mutex;
+  Block _blocks[pool_sz];
+  Block *_free[pool_sz];
+  uint32_t _num;
+};
+
+class Thread {
+public:
+  Thread(osPriority_t priority = osPriorityNormal, uint32_t stack_size = 0,
+         unsigned char *stack_mem = nullptr, const char *name = nullptr);
+  ~Thread();
+  osStatus start(Callback<void()> task);
+  osStatus join();
+
+private:
+  std::thread _thread;
+};
+
+/* events */
+
+#define EVENTS_EVENT_SIZE  64
+#define EVENTS_QUEUE_SIZE  (32 * EVENTS_EVENT_SIZE)
+
+class EventQueue {
+public:
+  EventQueue(unsigned size = EVENTS_QUEUE_SIZE,
+             unsigned char *buffer = nullptr);
+  template <typename F, typename... Args> int call(F f, Args... args) {
+    return post(0ms, 0ms, std::bind(f, args...));
+  }
+  template <typename F, typename... Args>
+  int call_in(std::chrono::milliseconds ms, F f, Args... args) {
+    return post(ms, 0ms, std::bind(f, args...));
+  }
+  template <typename F, typename... Args>
+  int call_every(std::chrono::milliseconds ms, F f, Args... args) {
+    return post(ms, ms, std::bind(f, args...));
+  }
+  bool cancel(int id);
+  void dispatch_forever();
+  void dispatch_for(std::chrono::milliseconds ms);
+  void break_dispatch();
+
+private:
+  struct Event {
+    std::chrono::steady_clock::time_point due;
+    std::chrono::milliseconds period;
+    std::function<void()> fn;
+  };
+  int post(std::chrono::milliseconds delay, std::chrono::milliseconds period,
+           std::function<void()> fn);
+  void dispatch(bool forever, std::chrono::steady_clock::time_point until);
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::map<int, Event> _events;
+  unsigned _max;
+  int _next_id = 1;
+  bool _break = false;
+};
+
+/* The shared queue, dispatched by a thread of its own. */
+EventQueue *mbed_event_queue(void);
+
+/* netsocket */
+
+typedef int32_t nsapi_error_t;
+typedef int32_t nsapi_size_or_error_t;
+typedef uint32_t nsapi_size_t;
+
+enum nsapi_error {
+  NSAPI_ERROR_OK = 0,
+  NSAPI_ERROR_WOULD_BLOCK = -3001,
+  NSAPI_ERROR_UNSUPPORTED = -3002,
+  NSAPI_ERROR_PARAMETER = -3003,
+  NSAPI_ERROR_NO_CONNECTION = -3004,
+  NSAPI_ERROR_NO_SOCKET = -3005,
+  NSAPI_ERROR_NO_ADDRESS = -3006,
+  NSAPI_ERROR_NO_MEMORY = -3007,
+  NSAPI_ERROR_DEVICE_ERROR = -3012,
+  NSAPI_ERROR_IN_PROGRESS = -3013,
+  NSAPI_ERROR_ALREADY = -3014,
+  NSAPI_ERROR_IS_CONNECTED = -3015,
+  NSAPI_ERROR_CONNECTION_LOST = -3016,
+  NSAPI_ERROR_CONNECTION_TIMEOUT = -3017,
+  NSAPI_ERROR_ADDRESS_IN_USE = -3018,
+  NSAPI_ERROR_TIMEOUT = -3019,
+};
+
+#define NSAPI_IPv4_SIZE 16
+#define NSAPI_IPv6_SIZE 40
+#define NSAPI_IP_SIZE   NSAPI_IPv6_SIZE
+
+/* IPv4 only. */
+class SocketAddress {
+public:
+  SocketAddress(const char *addr = nullptr, uint16_t port = 0);
+  bool set_ip_address(const char *addr);
+  const char *get_ip_address() const;
+  void set_port(uint16_t port) { _port = port; }
+  uint16_t get_port() const { return _port; }
+
+  uint32_t _ip = 0;                  //< network order
+  uint16_t _port = 0;
+
+private:
+  mutable char _text[NSAPI_IPv4_SIZE];
+};
+
+/* The host's own network, always up. */
+class NetworkInterface {
+public:
+  static NetworkInterface *get_default_instance();
+};
+
+/* Timeouts and the sigio callback work as on the device: a timeout of 0 (not
+ * blocking) makes calls return NSAPI_ERROR_WOULD_BLOCK instead of waiting,
+ * sigio is called from a thread of the network layer whenever the socket
+ * may have become readable, writable or connected. */
+class Socket {
+public:
+  virtual ~Socket();
+  nsapi_error_t open(NetworkInterface *net);
+  nsapi_error_t close();
+  nsapi_error_t bind(uint16_t port);
+  nsapi_error_t bind(const SocketAddress &addr);
+  void set_timeout(int timeout_ms);
+  void set_blocking(bool blocking);
+  void sigio(Callback<void()> func);
+
+protected:
+  virtual int type() const = 0;
+  /* Wait up to the timeout for events on the socket, false if it ran
+   * out. */
+  bool wait(short events);
+  void rearm(short events);
+
+  int _fd = -1;
+  int _timeout_ms = -1;
+  bool _accepted = false;            //< from accept(), close() deletes it
+
+  friend struct HostSigio;
+};
+
+/* send and recv are virtual as on the device, a test can stand in for the
+ * network by overriding them. */
+class TCPSocket : public Socket {
+public:
+  nsapi_error_t connect(const SocketAddress &addr);
+  virtual nsapi_size_or_error_t send(const void *data, nsapi_size_t size);
+  virtual nsapi_size_or_error_t recv(void *data, nsapi_size_t size);
+  nsapi_error_t listen(int backlog = 1);
+  TCPSocket *accept(nsapi_error_t *error = nullptr);
+
+protected:
+  int type() const override;
+
+private:
+  bool _connecting = false;
+};
+
+class UDPSocket : public Socket {
+public:
+  nsapi_size_or_error_t sendto(const SocketAddress &addr, const void *data,
+                               nsapi_size_t size);
+  nsapi_size_or_error_t recvfrom(SocketAddress *addr, void *data,
+                                 nsapi_size_t size);
+
+protected:
+  int type() const override;
+};
+
+#endif /* MBED_HOST_H */
@@ -0,0 +1,732 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#include "mbed.h"
+#include "mbed-trace/mbed_trace.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+static int host_trace_level = getenv("HDC15_HOST_TRACE") != NULL
+                                  ? TRACE_LEVEL_INFO
+                                  : TRACE_LEVEL_WARN;
+
+void mbed_trace_config_set(uint8_t config) {
+  switch (config) {
+  case TRACE_ACTIVE_LEVEL_NONE:
+    host_trace_level = -1;
+    break;
+  case TRACE_ACTIVE_LEVEL_ERROR:
+    host_trace_level = TRACE_LEVEL_ERROR;
+    break;
+  case TRACE_ACTIVE_LEVEL_WARN:
+    host_trace_level = TRACE_LEVEL_WARN;
+    break;
+  case TRACE_ACTIVE_LEVEL_INFO:
+    host_trace_level = TRACE_LEVEL_INFO;
+    break;
+  default:
+    host_trace_level = TRACE_LEVEL_DEBUG;
+    break;
+  }
+}
+
+void mbed_tracef(int level, const char *grp, const char *fmt, ...) {
+  static const char *const names[] = {"ERR ", "WARN", "INFO", "DBG "};
+  if (level > host_trace_level) {
+    return;
+  }
+  char line[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "[%s][%-4s]: %s\n", names[level], grp, line);
+}
+
+/* platform */
+
+static std::recursive_mutex host_critical;
+
+CriticalSectionLock::CriticalSectionLock() { host_critical.lock(); }
+
+CriticalSectionLock::~CriticalSectionLock() { host_critical.unlock(); }
+
+static const std::chrono::steady_clock::time_point host_boot =
+    std::chrono::steady_clock::now();
+
+uint32_t us_ticker_read(void) {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - host_boot)
+      .count();
+}
+
+void Timer::start() {
+  if (!_running) {
+    _since = std::chrono::steady_clock::now();
+    _running = true;
+  }
+}
+
+void Timer::stop() {
+  if (_running) {
+    _total = elapsed_time();
+    _running = false;
+  }
+}
+
+void Timer::reset() {
+  _total = std::chrono::microseconds(0);
+  _since = std::chrono::steady_clock::now();
+}
+
+std::chrono::microseconds Timer::elapsed_time() const {
+  if (!_running) {
+    return _total;
+  }
+  return _total + std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - _since);
+}
+
+/* rtos */
+
+Kernel::Clock::time_point Kernel::Clock::now() {
+  return time_point(std::chrono::duration_cast<duration>(
+      std::chrono::steady_clock::now() - host_boot));
+}
+
+void ThisThread::sleep_for(std::chrono::milliseconds ms) {
+  std::this_thread::sleep_for(ms);
+}
+
+osThreadId_t ThisThread::get_id() {
+  static thread_local char tag;
+  return &tag;
+}
+
+void Mutex::lock() {
+  _mutex.lock();
+  if (_count++ == 0) {
+    _owner = ThisThread::get_id();
+  }
+}
+
+bool Mutex::trylock() {
+  if (!_mutex.try_lock()) {
+    return false;
+  }
+  if (_count++ == 0) {
+    _owner = ThisThread::get_id();
+  }
+  return true;
+}
+
+void Mutex::unlock() {
+  if (--_count == 0) {
+    _owner = nullptr;
+  }
+  _mutex.unlock();
+}
+
+osThreadId_t Mutex::get_owner() { return _owner; }
+
+void ConditionVariable::wait() { _cv.wait(_mutex); }
+
+cv_status ConditionVariable::wait_for(std::chrono::milliseconds ms) {
+  return _cv.wait_for(_mutex, ms) == std::cv_status::timeout
+             ? cv_status::timeout
+             : cv_status::no_timeout;
+}
+
+void ConditionVariable::notify_one() { _cv.notify_one(); }
+
+void ConditionVariable::notify_all() { _cv.notify_all(); }
+
+void Semaphore::acquire() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _cv.wait(lock, [this] { return _count > 0; });
+  _count--;
+}
+
+bool Semaphore::try_acquire() { return try_acquire_for(0ms); }
+
+bool Semaphore::try_acquire_for(std::chrono::milliseconds ms) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_cv.wait_for(lock, ms, [this] { return _count > 0; })) {
+    return false;
+  }
+  _count--;
+  return true;
+}
+
+osStatus Semaphore::release() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _count++;
+  _cv.notify_one();
+  return osOK;
+}
+
+uint32_t EventFlags::set(uint32_t flags) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _flags |= flags;
+  _cv.notify_all();
+  return _flags;
+}
+
+uint32_t EventFlags::clear(uint32_t flags) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  uint32_t old = _flags;
+  _flags &= ~flags;
+  return old;
+}
+
+uint32_t EventFlags::get() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _flags;
+}
+
+uint32_t EventFlags::wait_any(uint32_t flags, uint32_t millisec, bool clear) {
+  if (millisec == osWaitForever) {
+    return wait_any_for(flags, std::chrono::hours(24 * 365), clear);
+  }
+  return wait_any_for(flags, std::chrono::milliseconds(millisec), clear);
+}
+
+uint32_t EventFlags::wait_any_for(uint32_t flags, std::chrono::milliseconds ms,
+                                  bool clear) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_cv.wait_for(lock, ms, [&] { return (_flags & flags) != 0; })) {
+    return osFlagsErrorTimeout;
+  }
+  uint32_t ret = _flags;
+  if (clear) {
+    _flags &= ~flags;
+  }
+  return ret;
+}
+
+Thread::Thread(osPriority_t, uint32_t, unsigned char *, const char *) {}
+
+Thread::~Thread() {
+  if (_thread.joinable()) {
+    _thread.detach();
+  }
+}
+
+osStatus Thread::start(Callback<void()> task) {
+  if (_thread.joinable()) {
+    return osError;
+  }
+  _thread = std::thread(task);
+  return osOK;
+}
+
+osStatus Thread::join() {
+  if (!_thread.joinable()) {
+    return osError;
+  }
+  _thread.join();
+  return osOK;
+}
+
+/* events */
+
+EventQueue::EventQueue(unsigned size, unsigned char *)
+    : _max(size / EVENTS_EVENT_SIZE) {}
+
+int EventQueue::post(std::chrono::milliseconds delay,
+                     std::chrono::milliseconds period,
+                     std::function<void()> fn) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_events.size() >= _max) {
+    return 0;
+  }
+  int id = _next_id;
+  _next_id = _next_id == INT32_MAX ? 1 : _next_id + 1;
+  _events[id] = {std::chrono::steady_clock::now() + delay, period,
+                 std::move(fn)};
+  _cv.notify_all();
+  return id;
+}
+
+bool EventQueue::cancel(int id) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _events.erase(id) != 0;
+}
+
+void EventQueue::dispatch(bool forever,
+                          std::chrono::steady_clock::time_point until) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    if (_break) {
+      _break = false;
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!forever && now >= until) {
+      return;
+    }
+    auto next = _events.end();
+    for (auto it = _events.begin(); it != _events.end(); ++it) {
+      if (next == _events.end() || it->second.due < next->second.due) {
+        next = it;
+      }
+    }
+    if (next == _events.end() || next->second.due > now) {
+      auto wake = next == _events.end() ? until : next->second.due;
+      if (forever && next == _events.end()) {
+        _cv.wait(lock);
+      } else {
+        _cv.wait_until(lock, forever || wake < until ? wake : until);
+      }
+      continue;
+    }
+    std::function<void()> fn = next->second.fn;
+    if (next->second.period.count() > 0) {
+      next->second.due = now + next->second.period;
+    } else {
+      _events.erase(next);
+    }
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
+
+void EventQueue::dispatch_forever() {
+  dispatch(true, std::chrono::steady_clock::time_point());
+}
+
+void EventQueue::dispatch_for(std::chrono::milliseconds ms) {
+  dispatch(false, std::chrono::steady_clock::now() + ms);
+}
+
+void EventQueue::break_dispatch() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _break = true;
+  _cv.notify_all();
+}
+
+EventQueue *mbed_event_queue(void) {
+  static EventQueue *queue;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    queue = new EventQueue;
+    std::thread([] { queue->dispatch_forever(); }).detach();
+  });
+  return queue;
+}
+
+/* netsocket */
+
+SocketAddress::SocketAddress(const char *addr, uint16_t port) : _port(port) {
+  if (addr) {
+    set_ip_address(addr);
+  }
+}
+
+bool SocketAddress::set_ip_address(const char *addr) {
+  struct in_addr in;
+  if (inet_pton(AF_INET, addr, &in) != 1) {
+    return false;
+  }
+  _ip = in.s_addr;
+  return true;
+}
+
+const char *SocketAddress::get_ip_address() const {
+  struct in_addr in;
+  in.s_addr = _ip;
+  inet_ntop(AF_INET, &in, _text, sizeof(_text));
+  return _text;
+}
+
+NetworkInterface *NetworkInterface::get_default_instance() {
+  static NetworkInterface net;
+  return &net;
+}
+
+static void host_sockaddr(const SocketAddress &addr, struct sockaddr_in *sa) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sin_family = AF_INET;
+  sa->sin_port = htons(addr.get_port());
+  sa->sin_addr.s_addr = addr._ip;
+}
+
+static nsapi_error_t host_error(int err) {
+  switch (err) {
+  case EAGAIN:
+    return NSAPI_ERROR_WOULD_BLOCK;
+  case EADDRINUSE:
+    return NSAPI_ERROR_ADDRESS_IN_USE;
+  case ECONNREFUSED:
+  case ENETUNREACH:
+  case EHOSTUNREACH:
+  case ENOTCONN:
+    return NSAPI_ERROR_NO_CONNECTION;
+  case EPIPE:
+  case ECONNRESET:
+    return NSAPI_ERROR_CONNECTION_LOST;
+  case ETIMEDOUT:
+    return NSAPI_ERROR_CONNECTION_TIMEOUT;
+  default:
+    return NSAPI_ERROR_DEVICE_ERROR;
+  }
+}
+
+/* One thread polls every socket with a sigio callback. A socket is polled for
+ * what it last waited on (readable after any recv, writable after a send or
+ * connect that would block) and dropped from the poll once it fired, so a
+ * callback that does not read does not spin. Callbacks run under dispatch,
+ * which close() and sigio() take too: after either returns the old callback
+ * is not running and will not run. */
+struct HostSigio {
+  struct Entry {
+    int fd;
+    short events;
+    Callback<void()> func;
+  };
+
+  std::mutex state;
+  std::recursive_mutex dispatch;
+  std::map<Socket *, Entry> sockets;
+  int wake[2] = {-1, -1};
+
+  static HostSigio &get() {
+    static HostSigio *sigio;
+    static std::once_flag once;
+    std::call_once(once, [] {
+      sigio = new HostSigio;
+      if (pipe(sigio->wake) == 0) {
+        fcntl(sigio->wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(sigio->wake[1], F_SETFL, O_NONBLOCK);
+      }
+      std::thread([] { sigio->run(); }).detach();
+    });
+    return *sigio;
+  }
+
+  void kick() {
+    char c = 0;
+    (void)!write(wake[1], &c, 1);
+  }
+
+  void set(Socket *sock, Callback<void()> func, short events) {
+    std::lock_guard<std::recursive_mutex> busy(dispatch);
+    std::lock_guard<std::mutex> lock(state);
+    if (func) {
+      sockets[sock] = {sock->_fd, events, func};
+    } else {
+      sockets.erase(sock);
+    }
+    kick();
+  }
+
+  void rearm(Socket *sock, short events) {
+    std::lock_guard<std::mutex> lock(state);
+    auto it = sockets.find(sock);
+    if (it != sockets.end() && (it->second.events & events) != events) {
+      it->second.events |= events;
+      kick();
+    }
+  }
+
+  void run() {
+    std::vector<struct pollfd> fds;
+    std::vector<Socket *> owners;
+    while (true) {
+      fds.assign(1, {wake[0], POLLIN, 0});
+      owners.assign(1, nullptr);
+      {
+        std::lock_guard<std::mutex> lock(state);
+        for (auto &it : sockets) {
+          if (it.second.events) {
+            fds.push_back({it.second.fd, it.second.events, 0});
+            owners.push_back(it.first);
+          }
+        }
+      }
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        continue;
+      }
+      if (fds[0].revents) {
+        char drain[64];
+        while (read(wake[0], drain, sizeof(drain)) > 0) {
+        }
+      }
+      std::lock_guard<std::recursive_mutex> busy(dispatch);
+      for (size_t i = 1; i < fds.size(); i++) {
+        if (!fds[i].revents) {
+          continue;
+        }
+        Callback<void()> func;
+        {
+          std::lock_guard<std::mutex> lock(state);
+          auto it = sockets.find(owners[i]);
+          if (it == sockets.end() || it->second.fd != fds[i].fd) {
+            continue;
+          }
+          it->second.events = 0;
+          func = it->second.func;
+        }
+        func();
+      }
+    }
+  }
+};
+
+Socket::~Socket() {
+  if (_fd >= 0) {
+    _accepted = false;
+    close();
+  }
+}
+
+nsapi_error_t Socket::open(NetworkInterface *) {
+  if (_fd >= 0) {
+    return NSAPI_ERROR_PARAMETER;
+  }
+  _fd = socket(AF_INET, type(), 0);
+  if (_fd < 0) {
+    return NSAPI_ERROR_NO_SOCKET;
+  }
+  int on = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (type() == SOCK_DGRAM) {
+    setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+  } else {
+    /* small frames both ways would otherwise wait out delayed acks */
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+  return NSAPI_ERROR_OK;
+}
+
+nsapi_error_t Socket::close() {
+  if (_fd < 0) {
+    return NSAPI_ERROR_NO_SOCKET;
+  }
+  HostSigio::get().set(this, nullptr, 0);
+  ::close(_fd);
+  _fd = -1;
+  if (_accepted) {
+    delete this;
+  }
+  return NSAPI_ERROR_OK;
+}
+
+nsapi_error_t Socket::bind(uint16_t port) {
+  return bind(SocketAddress("0.0.0.0", port));
+}
+
+nsapi_error_t Socket::bind(const SocketAddress &addr) {
+  struct sockaddr_in sa;
+  host_sockaddr(addr, &sa);
+  if (::bind(_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    return host_error(errno);
+  }
+  return NSAPI_ERROR_OK;
+}
+
+void Socket::set_timeout(int timeout_ms) { _timeout_ms = timeout_ms; }
+
+void Socket::set_blocking(bool blocking) { _timeout_ms = blocking ? -1 : 0; }
+
+void Socket::sigio(Callback<void()> func) {
+  HostSigio::get().set(this, func, POLLIN);
+}
+
+bool Socket::wait(short events) {
+  struct pollfd p = {_fd, events, 0};
+  if (poll(&p, 1, _timeout_ms) > 0) {
+    return true;
+  }
+  rearm(events);
+  return false;
+}
+
+void Socket::rearm(short events) { HostSigio::get().rearm(this, events); }
+
+int TCPSocket::type() const { return SOCK_STREAM; }
+
+nsapi_error_t TCPSocket::connect(const SocketAddress &addr) {
+  if (_fd < 0) {
+    return NSAPI_ERROR_NO_SOCKET;
+  }
+  bool first = !_connecting;
+  if (first) {
+    struct sockaddr_in sa;
+    host_sockaddr(addr, &sa);
+    if (::connect(_fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+      return NSAPI_ERROR_OK;
+    }
+    if (errno == EISCONN) {
+      return NSAPI_ERROR_IS_CONNECTED;
+    }
+    if (errno != EINPROGRESS) {
+      return host_error(errno);
+    }
+    _connecting = true;
+    if (!wait(POLLOUT)) {
+      if (_timeout_ms == 0) {
+        return NSAPI_ERROR_IN_PROGRESS;
+      }
+      _connecting = false;
+      return NSAPI_ERROR_TIMEOUT;
+    }
+  } else if (!wait(POLLOUT)) {
+    return NSAPI_ERROR_ALREADY;
+  }
+  _connecting = false;
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+  if (err != 0) {
+    return host_error(err);
+  }
+  return first ? NSAPI_ERROR_OK : NSAPI_ERROR_IS_CONNECTED;
+}
+
+nsapi_size_or_error_t TCPSocket::send(const void *data, nsapi_size_t size) {
+  nsapi_size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = ::send(_fd, (const char *)data + sent, size - sent,
+                       MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN) {
+      return host_error(errno);
+    }
+    if ((sent && _timeout_ms == 0) || !wait(POLLOUT)) {
+      return sent ? (nsapi_size_or_error_t)sent : NSAPI_ERROR_WOULD_BLOCK;
+    }
+  }
+  return sent;
+}
+
+nsapi_size_or_error_t TCPSocket::recv(void *data, nsapi_size_t size) {
+  rearm(POLLIN);
+  while (true) {
+    ssize_t n = ::recv(_fd, data, size, 0);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno != EAGAIN) {
+      return host_error(errno);
+    }
+    if (!wait(POLLIN)) {
+      return NSAPI_ERROR_WOULD_BLOCK;
+    }
+  }
+}
+
+nsapi_error_t TCPSocket::listen(int backlog) {
+  if (::listen(_fd, backlog) != 0) {
+    return host_error(errno);
+  }
+  return NSAPI_ERROR_OK;
+}
+
+TCPSocket *TCPSocket::accept(nsapi_error_t *error) {
+  while (true) {
+    int fd = ::accept(_fd, NULL, NULL);
+    if (fd >= 0) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      TCPSocket *sock = new TCPSocket;
+      sock->_fd = fd;
+      sock->_accepted = true;
+      if (error) {
+        *error = NSAPI_ERROR_OK;
+      }
+      return sock;
+    }
+    if (errno != EAGAIN || !wait(POLLIN)) {
+      if (error) {
+        *error = errno == EAGAIN ? NSAPI_ERROR_WOULD_BLOCK : host_error(errno);
+      }
+      return nullptr;
+    }
+  }
+}
+
+int UDPSocket::type() const { return SOCK_DGRAM; }
+
+nsapi_size_or_error_t UDPSocket::sendto(const SocketAddress &addr,
+                                        const void *data, nsapi_size_t size) {
+  struct sockaddr_in sa;
+  host_sockaddr(addr, &sa);
+  while (true) {
+    ssize_t n = ::sendto(_fd, data, size, 0, (struct sockaddr *)&sa,
+                         sizeof(sa));
+    if (n >= 0) {
+      return n;
+    }
+    if (errno != EAGAIN) {
+      return host_error(errno);
+    }
+    if (!wait(POLLOUT)) {
+      return NSAPI_ERROR_WOULD_BLOCK;
+    }
+  }
+}
+
+nsapi_size_or_error_t UDPSocket::recvfrom(SocketAddress *addr, void *data,
+                                          nsapi_size_t size) {
+  rearm(POLLIN);
+  while (true) {
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    ssize_t n = ::recvfrom(_fd, data, size, 0, (struct sockaddr *)&sa, &len);
+    if (n >= 0) {
+      if (addr) {
+        addr->_ip = sa.sin_addr.s_addr;
+        addr->set_port(ntohs(sa.sin_port));
+      }
+      return n;
+    }
+    if (errno != EAGAIN) {
+      return host_error(errno);
+    }
+    if (!wait(POLLIN)) {
+      return NSAPI_ERROR_WOULD_BLOCK;
+    }
+  }
+}
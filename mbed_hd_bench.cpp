@@ -0,0 +1,160 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_bench.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+static const char *const hd_bench_names[HDC15_BENCH_NUM] = {
+    "scan", "text", "play", "upload"};
+
+static int hd_bench_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Fill st from the count samples of a stage that took wall_us overall. */
+static void hd_bench_finish(HDC15_BenchStage *st, uint32_t *us, int count,
+                            uint64_t wall_us) {
+  st->count = count;
+  if (count == 0) {
+    return;
+  }
+  qsort(us, count, sizeof(uint32_t), hd_bench_cmp);
+  st->p50_us = us[(count - 1) * 50 / 100];
+  st->p99_us = us[(count - 1) * 99 / 100];
+  st->max_us = us[count - 1];
+  st->per_sec = wall_us ? (uint32_t)(count * 1000000ull / wall_us) : 0;
+}
+
+/* The upload source: a byte pattern that depends on the offset only. */
+static int hd_bench_read(void *ctx, uint32_t offset, void *buf, uint32_t size) {
+  (void)ctx;
+  uint8_t *p = (uint8_t *)buf;
+  for (uint32_t i = 0; i < size; i++) {
+    p[i] = (uint8_t)((offset + i) * 131 + 7);
+  }
+  return size;
+}
+
+static int hd_bench_stage(HDC15_Client *c, int kind, int id, int iterations,
+                          uint32_t file_size, uint32_t *us,
+                          HDC15_BenchStage *st) {
+  int count = 0;
+  Timer wall;
+  wall.start();
+  for (int i = 0; i < iterations; i++) {
+    char text[32];
+    Timer t;
+    t.start();
+    int ret = -1;
+    switch (kind) {
+    case HDC15_BENCH_SCAN:
+      ret = hdc_discover(c, HDC15_SCAN_TIMEOUT_MS, 1) > 0 ? 0 : -1;
+      break;
+    case HDC15_BENCH_TEXT:
+      snprintf(text, sizeof(text), "bench %d", i);
+      ret = hdc_textcontrol(c, id, 0, true, text);
+      break;
+    case HDC15_BENCH_PLAY:
+      ret = hdc_playcontrol(c, id, 0, i & 1);
+      break;
+    case HDC15_BENCH_UPLOAD:
+      ret = hdc_file_upload(c, id, "bench.bin", kImageFile, file_size, NULL,
+                            hd_bench_read, NULL);
+      break;
+    }
+    if (ret == 0) {
+      us[count++] = (uint32_t)t.elapsed_time().count();
+    } else {
+      st->failed++;
+    }
+  }
+  hd_bench_finish(st, us, count, wall.elapsed_time().count());
+  return 0;
+}
+
+int hd_bench_run(HDC15_Client *c, int id, int iterations, uint32_t file_size,
+                 HDC15_BenchResult *res) {
+  if (c == NULL) {
+    c = hdc_default();
+  }
+  memset(res, 0, sizeof(*res));
+  if (iterations <= 0) {
+    return -1;
+  }
+  uint32_t *us = (uint32_t *)malloc(iterations * sizeof(uint32_t));
+  if (us == NULL) {
+    return -1;
+  }
+  for (int kind = 0; kind < HDC15_BENCH_NUM; kind++) {
+    if (kind == HDC15_BENCH_UPLOAD && file_size == 0) {
+      continue;
+    }
+    if (kind == HDC15_BENCH_TEXT && hdc_get_guid(c, id) <= 0) {
+      tr_err("%d: no program to update.", id);
+      free(us);
+      return -1;
+    }
+    hd_bench_stage(c, kind, id, iterations, file_size, us, &res->stage[kind]);
+  }
+  free(us);
+  return 0;
+}
+
+void hd_bench_print(const HDC15_BenchResult *res) {
+  printf("%-8s %8s %8s %10s %10s %10s %8s\n", "stage", "ok", "failed",
+         "p50(us)", "p99(us)", "max(us)", "cmd/s");
+  for (int kind = 0; kind < HDC15_BENCH_NUM; kind++) {
+    const HDC15_BenchStage *st = &res->stage[kind];
+    printf("%-8s %8u %8u %10u %10u %10u %8u\n", hd_bench_names[kind],
+           (unsigned)st->count, (unsigned)st->failed, (unsigned)st->p50_us,
+           (unsigned)st->p99_us, (unsigned)st->max_us, (unsigned)st->per_sec);
+  }
+}
+
+#ifdef MBED_USER_ONEOS
+#include "oneos.h"
+
+#if MBED_CONF_ONEOS_OS_USING_SHELL
+
+static void hd_bench(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Please input: hd_bench <id> <iterations> [file_size]\n");
+    return;
+  }
+  int id = atoi(argv[1]);
+  if (hd_device_get(id, NULL) != 0) {
+    hd_scan();
+  }
+  HDC15_BenchResult res;
+  if (hd_bench_run(NULL, id, atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 16384,
+                   &res) != 0) {
+    printf("bench failed\n");
+    return;
+  }
+  hd_bench_print(&res);
+}
+SH_CMD_EXPORT(hd_bench, hd_bench, "hd_bench <id> <iterations> [file_size]");
+#endif
+
+#endif
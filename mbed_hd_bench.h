@@ -0,0 +1,64 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_BENCH_H
+#define MBED_HD_BENCH_H
+
+#include "mbed_hd_client.h"
+
+enum HDC15_BenchStageKind
+{
+    HDC15_BENCH_SCAN = 0,    //< hd_discover() until the first answer
+    HDC15_BENCH_TEXT,        //< hd_textcontrol()
+    HDC15_BENCH_PLAY,        //< hd_playcontrol()
+    HDC15_BENCH_UPLOAD,      //< hd_file_upload()
+    HDC15_BENCH_NUM,
+};
+
+typedef struct HDC15_BenchStage
+{
+    uint32_t count;          //< successful runs
+    uint32_t failed;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t per_sec;        //< successful runs per second of wall time
+} HDC15_BenchStage;
+
+typedef struct HDC15_BenchResult
+{
+    HDC15_BenchStage stage[HDC15_BENCH_NUM];
+} HDC15_BenchResult;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Time iterations runs of every stage against device id of client c (NULL:
+ * the default client), uploading a generated file of file_size bytes (0
+ * skips the upload stage). Works against real controllers as well as the
+ * simulated one from mbed_hd_sim.h. */
+int hd_bench_run(HDC15_Client *c, int id, int iterations, uint32_t file_size,
+                 HDC15_BenchResult *res);
+void hd_bench_print(const HDC15_BenchResult *res);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_BENCH_H */
@@ -0,0 +1,352 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_cache.h"
+#include "mbed_hd_md5.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstring>
+#include <new>
+#include <strings.h>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+/* A file device dev_id is known to hold. */
+typedef struct HDC15_CacheEntry {
+  uint8_t dev_id[HDC15_MAX_DEVICE_ID_LENGHT];
+  char name[HDC15_CACHE_NAME];
+  char md5[HDC15_MD5_LENGHT + 1];    //< "": unused
+  uint32_t size;
+} HDC15_CacheEntry;
+
+/* mutex guards the index and the stats; rate_mutex the token bucket;
+ * read_mutex serializes the read callbacks of a rollout. */
+struct HDC15_UploadCache {
+  HDC15_Client *client;
+  Mutex mutex;
+  Mutex rate_mutex;
+  Mutex read_mutex;
+  uint32_t rate;           //< bytes per second, 0: no cap
+  int64_t tokens;          //< bytes that may go out now, negative: owed
+  uint32_t refill_ms;
+  int next;                //< entry to replace when the index is full
+  HDC15_CacheStats stats;
+  HDC15_CacheEntry entry[HDC15_CACHE_ENTRIES];
+};
+
+/* One hd_cache_upload() in flight. */
+typedef struct HDC15_CacheUpload {
+  HDC15_UploadCache *u;
+  const HDC15_RolloutFile *f;
+} HDC15_CacheUpload;
+
+/* Work shared by the threads of one hd_cache_rollout(). */
+typedef struct HDC15_Rollout {
+  HDC15_UploadCache *u;
+  const int *ids;
+  int num;
+  const HDC15_RolloutFile *files;
+  int jobs;
+  volatile uint32_t next;  //< next job, file next / num of device next % num
+  volatile uint32_t failed;
+  int *results;
+} HDC15_Rollout;
+
+static uint32_t hd_cache_now_ms(void) {
+  return (uint32_t)Kernel::Clock::now().time_since_epoch().count();
+}
+
+/* Entry of file name on device dev_id, NULL if unknown. u->mutex is held. */
+static HDC15_CacheEntry *hd_cache_find(HDC15_UploadCache *u,
+                                       const uint8_t *dev_id,
+                                       const char *name) {
+  for (int i = 0; i < HDC15_CACHE_ENTRIES; i++) {
+    HDC15_CacheEntry *e = &u->entry[i];
+    if (e->md5[0] && strcmp(e->name, name) == 0 &&
+        memcmp(e->dev_id, dev_id, HDC15_MAX_DEVICE_ID_LENGHT) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static bool hd_cache_has(HDC15_UploadCache *u, const uint8_t *dev_id,
+                         const HDC15_RolloutFile *f, const char *md5) {
+  ScopedLock<Mutex> lock(u->mutex);
+  HDC15_CacheEntry *e = hd_cache_find(u, dev_id, f->name);
+  return e && e->size == f->size &&
+         strncasecmp(e->md5, md5, HDC15_MD5_LENGHT) == 0;
+}
+
+static void hd_cache_record(HDC15_UploadCache *u, const uint8_t *dev_id,
+                            const HDC15_RolloutFile *f, const char *md5) {
+  if (strlen(f->name) >= HDC15_CACHE_NAME) {
+    return;
+  }
+  ScopedLock<Mutex> lock(u->mutex);
+  HDC15_CacheEntry *e = hd_cache_find(u, dev_id, f->name);
+  if (e == NULL) {
+    e = &u->entry[u->next];
+    u->next = (u->next + 1) % HDC15_CACHE_ENTRIES;
+    memcpy(e->dev_id, dev_id, HDC15_MAX_DEVICE_ID_LENGHT);
+    strlcpy(e->name, f->name, sizeof(e->name));
+  }
+  strlcpy(e->md5, md5, sizeof(e->md5));
+  e->size = f->size;
+}
+
+/* Take bytes from the shared bucket, waiting as long as it is in debt. The
+ * bytes are reserved at once, so threads waiting together are served in
+ * turn instead of all sending when the bucket refills. */
+static void hd_cache_throttle(HDC15_UploadCache *u, uint32_t bytes) {
+  u->rate_mutex.lock();
+  uint32_t rate = u->rate;
+  if (rate == 0) {
+    u->rate_mutex.unlock();
+    return;
+  }
+  uint32_t now = hd_cache_now_ms();
+  int64_t burst = (int64_t)rate * HDC15_CACHE_BURST_MS / 1000;
+  u->tokens += (int64_t)rate * (uint32_t)(now - u->refill_ms) / 1000;
+  if (u->tokens > burst) {
+    u->tokens = burst;
+  }
+  u->refill_ms = now;
+  u->tokens -= bytes;
+  int64_t wait = u->tokens < 0 ? -u->tokens * 1000 / rate : 0;
+  u->rate_mutex.unlock();
+  if (wait > 0) {
+    ThisThread::sleep_for(std::chrono::milliseconds((uint32_t)wait));
+  }
+}
+
+/* hd_file_read_callback handed to the client: reads one at a time and pays
+ * for each chunk before it goes out. */
+static int hd_cache_read(void *ctx, uint32_t offset, void *buf,
+                         uint32_t size) {
+  HDC15_CacheUpload *up = (HDC15_CacheUpload *)ctx;
+  up->u->read_mutex.lock();
+  int got = up->f->read(up->f->ctx, offset, buf, size);
+  up->u->read_mutex.unlock();
+  if (got > 0) {
+    hd_cache_throttle(up->u, got);
+  }
+  return got;
+}
+
+static int hd_cache_md5(HDC15_UploadCache *u, const HDC15_RolloutFile *f,
+                        char *md5) {
+  char *buf = new (std::nothrow) char[HDC15_FILE_CHUNK_SIZE];
+  if (buf == NULL) {
+    return -1;
+  }
+  HDC15_Md5 m;
+  hd_md5_init(&m);
+  int ret = 0;
+  ScopedLock<Mutex> lock(u->read_mutex);
+  for (uint32_t offset = 0; offset < f->size;) {
+    uint32_t n = f->size - offset;
+    int got = f->read(f->ctx, offset, buf,
+                      n < HDC15_FILE_CHUNK_SIZE ? n : HDC15_FILE_CHUNK_SIZE);
+    if (got <= 0) {
+      tr_err("%s: read at %u failed.", f->name, (unsigned)offset);
+      ret = -1;
+      break;
+    }
+    hd_md5_update(&m, buf, got);
+    offset += got;
+  }
+  if (ret == 0) {
+    hd_md5_hex(&m, md5);
+  }
+  delete[] buf;
+  return ret;
+}
+
+/* Make sure device id has f, whose md5 is known. */
+static int hd_cache_put(HDC15_UploadCache *u, int id,
+                        const HDC15_RolloutFile *f, const char *md5) {
+  HDC15_Device dev;
+  if (hdc_device_get(u->client, id, &dev) != 0) {
+    tr_err("%d: no such device.", id);
+    return -1;
+  }
+  if (hd_cache_has(u, dev.id, f, md5)) {
+    ScopedLock<Mutex> lock(u->mutex);
+    u->stats.cached++;
+    return kSuccess;
+  }
+  uint32_t remote_size;
+  char remote_md5[HDC15_MD5_LENGHT + 1];
+  /* not found, or a controller without ReadFileAsk, just means sending it */
+  if (hdc_file_stat(u->client, id, f->name, f->type, &remote_size,
+                    remote_md5) == kSuccess &&
+      remote_size == f->size &&
+      strncasecmp(remote_md5, md5, HDC15_MD5_LENGHT) == 0) {
+    hd_cache_record(u, dev.id, f, md5);
+    ScopedLock<Mutex> lock(u->mutex);
+    u->stats.matched++;
+    return kSuccess;
+  }
+  HDC15_CacheUpload up = {u, f};
+  int ret = hdc_file_upload(u->client, id, f->name, f->type, f->size, md5,
+                            hd_cache_read, &up);
+  if (ret == 0) {
+    hd_cache_record(u, dev.id, f, md5);
+  }
+  ScopedLock<Mutex> lock(u->mutex);
+  if (ret == 0) {
+    u->stats.uploaded++;
+    u->stats.bytes += f->size;
+  } else {
+    u->stats.failed++;
+  }
+  return ret;
+}
+
+HDC15_UploadCache *hd_cache_new(HDC15_Client *c) {
+  HDC15_UploadCache *u = new (std::nothrow) HDC15_UploadCache();
+  if (u == NULL) {
+    return NULL;
+  }
+  u->client = c ? c : hdc_default();
+  return u;
+}
+
+/* Must not be called while a rollout of u runs. */
+void hd_cache_free(HDC15_UploadCache *u) {
+  delete u;
+}
+
+void hd_cache_set_rate(HDC15_UploadCache *u, uint32_t bytes_per_sec) {
+  ScopedLock<Mutex> lock(u->rate_mutex);
+  u->rate = bytes_per_sec;
+  u->tokens = 0;
+  u->refill_ms = hd_cache_now_ms();
+}
+
+int hd_cache_upload(HDC15_UploadCache *u, int id, const HDC15_RolloutFile *f) {
+  char sum[HDC15_MD5_LENGHT + 1];
+  const char *md5 = f->md5;
+  if (md5 == NULL) {
+    if (hd_cache_md5(u, f, sum) != 0) {
+      return -1;
+    }
+    md5 = sum;
+  }
+  return hd_cache_put(u, id, f, md5);
+}
+
+static void hd_cache_work(HDC15_Rollout *r) {
+  for (;;) {
+    uint32_t job = core_util_atomic_fetch_add_u32(&r->next, 1);
+    if (job >= (uint32_t)r->jobs) {
+      return;
+    }
+    /* consecutive jobs go to different devices, so the threads do not queue
+     * up on the lock of one device */
+    int i = job % r->num;
+    const HDC15_RolloutFile *f = &r->files[job / r->num];
+    int ret = hd_cache_put(r->u, r->ids[i], f, f->md5);
+    if (ret != kSuccess) {
+      core_util_atomic_incr_u32(&r->failed, 1);
+    }
+    if (r->results) {
+      r->results[job] = ret;
+    }
+  }
+}
+
+int hd_cache_rollout(HDC15_UploadCache *u, const int *ids, int num,
+                     const HDC15_RolloutFile *files, int nfiles,
+                     int *results) {
+  if (num <= 0 || nfiles <= 0) {
+    return 0;
+  }
+  /* the md5 of each file is computed once, not once per device */
+  HDC15_RolloutFile *f = new (std::nothrow) HDC15_RolloutFile[nfiles];
+  char (*sum)[HDC15_MD5_LENGHT + 1] =
+      new (std::nothrow) char[nfiles][HDC15_MD5_LENGHT + 1];
+  if (f == NULL || sum == NULL) {
+    delete[] f;
+    delete[] sum;
+    return num * nfiles;
+  }
+  HDC15_Rollout r = {};
+  r.u = u;
+  r.ids = ids;
+  r.num = num;
+  r.files = f;
+  r.jobs = num * nfiles;
+  r.results = results;
+  for (int k = 0; k < nfiles; k++) {
+    f[k] = files[k];
+    if (f[k].md5 == NULL) {
+      if (hd_cache_md5(u, &f[k], sum[k]) != 0) {
+        delete[] f;
+        delete[] sum;
+        return num * nfiles;
+      }
+      f[k].md5 = sum[k];
+    }
+  }
+
+  Thread *worker[HDC15_CACHE_WORKERS] = {};
+  int workers = num - 1 < HDC15_CACHE_WORKERS ? num - 1 : HDC15_CACHE_WORKERS;
+  for (int k = 0; k < workers; k++) {
+    worker[k] = new (std::nothrow) Thread(osPriorityBelowNormal,
+                                          HDC15_CACHE_STACK_SIZE, NULL,
+                                          "hd_rollout");
+    if (worker[k] == NULL ||
+        worker[k]->start([&r]() { hd_cache_work(&r); }) != osOK) {
+      /* fewer threads only make it slower */
+      tr_err("Rollout thread failed.");
+      delete worker[k];
+      worker[k] = NULL;
+    }
+  }
+  hd_cache_work(&r);
+  for (int k = 0; k < workers; k++) {
+    if (worker[k]) {
+      worker[k]->join();
+      delete worker[k];
+    }
+  }
+  delete[] f;
+  delete[] sum;
+  tr_info("rollout of %d files to %d devices, %u failed", nfiles, num,
+          (unsigned)r.failed);
+  return r.failed;
+}
+
+void hd_cache_forget(HDC15_UploadCache *u, int id) {
+  HDC15_Device dev;
+  if (hdc_device_get(u->client, id, &dev) != 0) {
+    return;
+  }
+  ScopedLock<Mutex> lock(u->mutex);
+  for (int i = 0; i < HDC15_CACHE_ENTRIES; i++) {
+    HDC15_CacheEntry *e = &u->entry[i];
+    if (memcmp(e->dev_id, dev.id, HDC15_MAX_DEVICE_ID_LENGHT) == 0) {
+      e->md5[0] = '\0';
+    }
+  }
+}
+
+void hd_cache_stats(HDC15_UploadCache *u, HDC15_CacheStats *stats) {
+  ScopedLock<Mutex> lock(u->mutex);
+  *stats = u->stats;
+}
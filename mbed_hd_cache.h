@@ -0,0 +1,94 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_CACHE_H
+#define MBED_HD_CACHE_H
+
+#include "mbed_hd_client.h"
+
+/* files remembered per cache, over all devices; the oldest entry makes room
+ * for a new one */
+#ifndef HDC15_CACHE_ENTRIES
+#define HDC15_CACHE_ENTRIES       64
+#endif
+#define HDC15_CACHE_NAME          48
+/* threads a rollout runs besides the calling one */
+#ifndef HDC15_CACHE_WORKERS
+#define HDC15_CACHE_WORKERS       2
+#endif
+#ifndef HDC15_CACHE_STACK_SIZE
+#define HDC15_CACHE_STACK_SIZE    4096
+#endif
+/* how much(ms) unused bandwidth may be saved up for a burst */
+#ifndef HDC15_CACHE_BURST_MS
+#define HDC15_CACHE_BURST_MS      250
+#endif
+
+typedef struct HDC15_UploadCache HDC15_UploadCache;
+
+/* One file of a rollout. read may be called from several threads, one at a
+ * time. md5 NULL is computed from read once for all devices. */
+typedef struct HDC15_RolloutFile
+{
+    const char *name;
+    uint16_t type;                   //< HDC15_FileType
+    uint32_t size;
+    const char *md5;
+    hd_file_read_callback read;
+    void *ctx;
+} HDC15_RolloutFile;
+
+typedef struct HDC15_CacheStats
+{
+    uint32_t cached;         //< skipped, the index knew the device has it
+    uint32_t matched;        //< skipped, the controller reported the same md5
+    uint32_t uploaded;
+    uint32_t failed;
+    uint32_t bytes;          //< bytes uploaded
+} HDC15_CacheStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upload front end for client c (NULL: the default client) that remembers
+ * which device (by HDC15_Device.id) holds which file name with which md5.
+ * A file is only sent if neither the index nor the controller (asked with
+ * hd_file_stat()) shows it is there already. */
+HDC15_UploadCache *hd_cache_new(HDC15_Client *c);
+void hd_cache_free(HDC15_UploadCache *u);
+/* Cap the upload rate of all transfers of u together, 0: no cap. */
+void hd_cache_set_rate(HDC15_UploadCache *u, uint32_t bytes_per_sec);
+/* Make sure device id has file f. Returns kSuccess, an HDC15_ErrorCode or
+ * -1 like hd_file_upload(). */
+int hd_cache_upload(HDC15_UploadCache *u, int id, const HDC15_RolloutFile *f);
+/* Bring num devices up to date with nfiles files, HDC15_CACHE_WORKERS + 1
+ * devices at a time. results, if given, gets the result per device and
+ * file, results[file * num + i]. Returns the number of transfers that
+ * failed. */
+int hd_cache_rollout(HDC15_UploadCache *u, const int *ids, int num,
+                     const HDC15_RolloutFile *files, int nfiles, int *results);
+/* Drop what the index knows about device id, e.g. after it was reset. */
+void hd_cache_forget(HDC15_UploadCache *u, int id);
+void hd_cache_stats(HDC15_UploadCache *u, HDC15_CacheStats *stats);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_CACHE_H */
@@ -16,22 +16,135 @@
 // limitations under the License.
 // ----------------------------------------------------------------------------
 #include "mbed_hd_client.h"
+#include "mbed_hd_codec.h"
+#include "mbed_hd_error.h"
+#include "mbed_hd_frame.h"
+#include "mbed_hd_md5.h"
+#include "mbed_hd_pool.h"
+#include "mbed_hd_screen.h"
+#include "mbed_hd_stats.h"
+#include "mbed_hd_xml.h"
 #include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
-#include "tinyxml.h"
 #include <cstdio>
 #include <cstring>
+#include <new>
 #include <stdlib.h>
-#include <string>
+#if HDC15_STATE_KVSTORE
+#include "kvstore_global_api.h"
+#endif
 
 #define TRACE_GROUP "mbed_hd_client"
 
 #define BUFSZ 2048
 
-static char tcp_data[BUFSZ];
-static char recv_xml[BUFSZ];
-static HDC15_Device_List hd_dev;
-static HDC15_Program_Guid_List hd_program_guid[HDC15_DEVICE_NUM];
-static char guid[HDC15_GUID_SIZE];
+/* One persistent connection per device, with its own frame buffers; guarded
+ * by its own lock so different devices can be driven in parallel. */
+enum {
+  HD_SESSION_CLOSED = 0,
+  HD_SESSION_CONNECT,      //< non-blocking connect in progress
+  HD_SESSION_SERVICE,      //< waiting for SDKServiceAnswer
+  HD_SESSION_IFVERSION,    //< waiting for the GetIFVersion answer
+  HD_SESSION_READY,
+};
+
+struct HDC15_NbRequest;
+struct HDC15_NbFetch;
+
+typedef struct HDC15_Session {
+  Mutex lock;
+  /* whose turn it is on the device, see hd_session_acquire(); the holder
+   * takes lock on top */
+  Mutex sched_lock;
+  ConditionVariable sched_cv{sched_lock};
+  bool sched_busy;
+  uint8_t sched_prio;                //< HDC15_Priority of the holder
+  uint8_t sched_nest;                //< taken by callbacks with lock held
+  uint8_t sched_waiting[HDC15_PRIOS];
+  HDC15_Client *client;
+  int id;
+  TCPSocket *sock;
+  uint16_t conn_seq;                 //< connections opened so far
+  uint8_t state;
+  uint32_t state_us;                 //< when state began, see hd_stats_now()
+  uint32_t state_ms;                 //< the same for the round trip
+  uint32_t version;                  //< SDKServiceAnswer协商的版本
+  uint32_t last_io_ms;
+  bool blocking;                     //< sock waits with a timeout
+  bool heartbeat_out;                //< a keepalive heartbeat is unanswered
+  uint32_t heartbeat_ms;             //< when it went out
+  /* written with s->lock held and in a critical section, so hd_health_get()
+   * can copy it without waiting for the device */
+  HDC15_HealthInfo health;
+  uint32_t offline_ms;               //< last timeout while offline
+  bool health_probe;                 //< a scan saw it, try even if offline
+  core_util_atomic_flag health_posted;
+  int health_event;
+  char ip_addr[NSAPI_IP_SIZE];
+  char guid[HDC15_GUID_SIZE];
+  bool resume;                       //< guid/version从hd_state_load()恢复, 未协商
+  HDC15_Screen *screen;              //< GetProgram的节目结构, 按需分配
+  HDC15_Buffer tx;                   //< frame being sent
+  HDC15_FrameReader rx;
+  /* async SDKCmdAsk requests waiting for their SDKCmdAnswer, oldest first;
+   * the controller answers in order so answers are matched FIFO */
+  struct {
+    hd_cmd_callback cb;
+    void *ctx;
+    int16_t program;                 //< AddProgram of it, -1: none
+  } pending[HDC15_CMD_QUEUE_NUM];
+  uint8_t pending_head;
+  uint8_t pending_num;
+  /* non-blocking requests not sent yet, oldest first; nb_lock only guards
+   * the list so queueing never waits for a blocking call on the device */
+  Mutex nb_lock;
+  struct HDC15_NbRequest *nb_head;
+  struct HDC15_NbRequest *nb_tail;
+  uint8_t nb_num;
+  bool nb_active;                    //< socket non-blocking, driven by events
+  bool nb_fetch_failed;
+  uint8_t nb_stage;                  //< HDC15_Stage being timed
+  uint32_t nb_since_ms;              //< when nb_stage began
+  struct HDC15_NbFetch *nb_fetch;    //< GetProgram in flight
+  core_util_atomic_flag nb_posted;   //< a run is queued already
+  int nb_event;
+  int nb_timer;
+} HDC15_Session;
+
+/* mutex guards the registry: dev, hash and the session table. It is only
+ * held briefly on the command path and never taken while a session lock is
+ * held, except from callbacks. Sessions are allocated one by one so they stay
+ * put while the table grows. */
+struct HDC15_Client {
+  Mutex mutex;
+  HDC15_Device_List dev;
+  /* device ID -> index + 1, open addressing, twice the registry capacity */
+  uint16_t *hash;
+  uint16_t hash_size;
+  HDC15_Session **session;           //< per device, sized like dev
+  hd_device_callback device_cb;
+  void *device_ctx;
+  Thread *registry_thread;
+  EventFlags registry_flags;
+  uint32_t registry_period_ms;
+  Mutex group_mutex;                 //< one group command at a time
+  EventFlags group_flags;
+  HDC15_Buffer group_xml;            //< group command, rendered once
+  struct HDC15_GroupMember *group;
+  int group_cap;
+  core_util_atomic_flag keepalive_started;
+  EventQueue *keepalive_queue;       //< the queue the keepalive runs on
+  int keepalive_event;
+  int keepalive_check;               //< look for heartbeat answers due
+  volatile bool closing;             //< hdc_free() is in progress, post nothing
+  uint8_t window = HDC15_CMD_WINDOW;
+  EventQueue *queue;                 //< drives the non-blocking API
+  uint32_t stage_ms[HDC15_STAGES] = {HDC15_NB_CONNECT_MS, HDC15_NB_SERVICE_MS,
+                                     HDC15_NB_GUID_MS, HDC15_NB_ANSWER_MS};
+  uint32_t deadline_ms[HDC15_PRIOS]; //< see hdc_set_deadline()
+  uint8_t stage_fixed;               //< stages hdc_set_stage_timeout() set
+};
+
+static HDC15_Client hd_client;
 
 static const char get_ifversion_xml[] = {
     "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
@@ -41,405 +154,3827 @@ static const char get_ifversion_xml[] = {
     "</in>\n"
     "</sdk>\n"};
 
-static const char cmd_xml[] = {"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-                               "<sdk guid=\"##GUID\">"
-                               "<in method=\"##CMD\"></in>"
-                               "</sdk>"};
+/* The command templates below are kept in the exact layout TiXmlPrinter
+ * produced for them, so rendering them gives the same bytes the TinyXML
+ * parse/modify/print path used to send. */
+static const char cmd_xml[] = {"<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+                               "<sdk guid=\"##GUID\">\n"
+                               "    <in method=\"##CMD\" />\n"
+                               "</sdk>\n"};
 
 static const char add_program_xml[]{
-    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-    "<sdk guid=\"##GUID\">"
-    "<in method=\"AddProgram\">"
-    "<screen>"
-    "<program guid=\"d0014343-5c25-4719-af95-2eccf2e74550\" type=\"normal\">"
-    "<playControl count=\"1\" disabled= \"true\"/>"
-    "<area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">"
-    "<rectangle x=\"0\" y=\"0\" width=\"640\" height=\"64\"/>"
-    "<resources>"
-    "<text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\" singleLine=\"true\">"
-    "<string>欢迎光临</string>"
-    "<effect in=\"0\" out=\"20\" inSpeed=\"4\" outSpeed=\"4\" duration=\"50\"/>"
-    "<font name=\"宋体\"  bold=\"False\" italic=\"False\" underline=\"False\" "
-    "size=\"48\"/>"
-    "</text>"
-    "</resources>"
-    "</area>"
-    "</program>"
-    "</screen>"
-    "</in>"
-    "</sdk>"};
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<sdk guid=\"##GUID\">\n"
+    "    <in method=\"AddProgram\">\n"
+    "        <screen>\n"
+    "            <program guid=\"##guid\" type=\"normal\">\n"
+    "                <playControl count=\"1\" disabled=\"##en\" />\n"
+    "                <area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">\n"
+    "                    <rectangle x=\"0\" y=\"0\" width=\"640\" height=\"64\" />\n"
+    "                    <resources>\n"
+    "                        <text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\" singleLine=\"true\">\n"
+    "                            <string>##str</string>\n"
+    "                            <effect in=\"0\" out=\"20\" inSpeed=\"4\" outSpeed=\"4\" duration=\"50\" />\n"
+    "                            <font name=\"宋体\" bold=\"False\" italic=\"False\" underline=\"False\" size=\"48\" />\n"
+    "                        </text>\n"
+    "                    </resources>\n"
+    "                </area>\n"
+    "            </program>\n"
+    "        </screen>\n"
+    "    </in>\n"
+    "</sdk>\n"};
 
 static const char textcontrol_xml[]{
-    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-    "<sdk guid=\"##GUID\">"
-    "<in method=\"UpdateProgram\">"
-    "<screen>"
-    "<program guid=\"##guid\">"
-    "<playControl disabled= \"##en\"/>"
-    "<area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">"
-    "<resources>"
-    "<text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\">"
-    "<string>##str</string>"
-    "</text>"
-    "</resources>"
-    "</area>"
-    "</program>"
-    "</screen>"
-    "</in>"
-    "</sdk>"};
-
-static const char playcontrol_xml[]{"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-                                    "<sdk guid=\"##GUID\">"
-                                    "<in method=\"UpdateProgram\">"
-                                    "<screen>"
-                                    "<program guid=\"##guid\">"
-                                    "<playControl disabled= \"##en\"/>"
-                                    "</program>"
-                                    "</screen>"
-                                    "</in>"
-                                    "</sdk>"};
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<sdk guid=\"##GUID\">\n"
+    "    <in method=\"UpdateProgram\">\n"
+    "        <screen>\n"
+    "            <program guid=\"##guid\">\n"
+    "                <playControl disabled=\"##en\" />\n"
+    "                <area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">\n"
+    "                    <resources>\n"
+    "                        <text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\">\n"
+    "                            <string>##str</string>\n"
+    "                        </text>\n"
+    "                    </resources>\n"
+    "                </area>\n"
+    "            </program>\n"
+    "        </screen>\n"
+    "    </in>\n"
+    "</sdk>\n"};
 
-int hd_scan(void) {
-  /* Create a UDP socket. */
+static const char playcontrol_xml[]{"<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+                                    "<sdk guid=\"##GUID\">\n"
+                                    "    <in method=\"UpdateProgram\">\n"
+                                    "        <screen>\n"
+                                    "            <program guid=\"##guid\">\n"
+                                    "                <playControl disabled=\"##en\" />\n"
+                                    "            </program>\n"
+                                    "        </screen>\n"
+                                    "    </in>\n"
+                                    "</sdk>\n"};
+
+static const char updatetext_xml[]{
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<sdk guid=\"##GUID\">\n"
+    "    <in method=\"UpdateProgram\">\n"
+    "        <screen>\n"
+    "            <program guid=\"##guid\">\n"
+    "                <area guid=\"e2fc3d5d-190b-460e-9333-1e51f5b8ff03\">\n"
+    "                    <resources>\n"
+    "                        <text guid=\"54f188b2-43bc-47ef-b131-28f23e880c0e\">\n"
+    "                            <string>##str</string>\n"
+    "                        </text>\n"
+    "                    </resources>\n"
+    "                </area>\n"
+    "            </program>\n"
+    "        </screen>\n"
+    "    </in>\n"
+    "</sdk>\n"};
+
+static const char resource_text_xml[]{
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<sdk guid=\"##GUID\">\n"
+    "    <in method=\"UpdateProgram\">\n"
+    "        <screen>\n"
+    "            <program guid=\"##guid\">\n"
+    "                <area guid=\"##area\">\n"
+    "                    <resources>\n"
+    "                        <text guid=\"##res\">\n"
+    "                            <string>##str</string>\n"
+    "                        </text>\n"
+    "                    </resources>\n"
+    "                </area>\n"
+    "            </program>\n"
+    "        </screen>\n"
+    "    </in>\n"
+    "</sdk>\n"};
+
+/* Pieces of the UpdateProgram document of an HDC15_Batch, in the layout of
+ * the templates above; any number of programs, areas and texts go between
+ * head and tail. */
+static const char batch_head_xml[]{
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<sdk guid=\"##GUID\">\n"
+    "    <in method=\"UpdateProgram\">\n"
+    "        <screen>\n"};
+static const char batch_program_xml[]{
+    "            <program guid=\"##guid\">\n"};
+static const char batch_play_xml[]{
+    "                <playControl disabled=\"##en\" />\n"};
+static const char batch_area_xml[]{
+    "                <area guid=\"##area\">\n"
+    "                    <resources>\n"};
+static const char batch_text_xml[]{
+    "                        <text guid=\"##res\">\n"
+    "                            <string>##str</string>\n"
+    "                        </text>\n"};
+static const char batch_area_end_xml[]{
+    "                    </resources>\n"
+    "                </area>\n"};
+static const char batch_program_end_xml[]{"            </program>\n"};
+static const char batch_tail_xml[]{
+    "        </screen>\n"
+    "    </in>\n"
+    "</sdk>\n"};
+
+/* area and text resource of the program add_program_xml creates */
+static const char hd_text_area_guid[] = "e2fc3d5d-190b-460e-9333-1e51f5b8ff03";
+static const char hd_text_res_guid[] = "54f188b2-43bc-47ef-b131-28f23e880c0e";
+
+static HDC15_XmlTemplate cmd_tpl = HDC15_XML_TEMPLATE(cmd_xml);
+static HDC15_XmlTemplate add_program_tpl = HDC15_XML_TEMPLATE(add_program_xml);
+static HDC15_XmlTemplate playcontrol_tpl = HDC15_XML_TEMPLATE(playcontrol_xml);
+static HDC15_XmlTemplate textcontrol_tpl = HDC15_XML_TEMPLATE(textcontrol_xml);
+static HDC15_XmlTemplate updatetext_tpl = HDC15_XML_TEMPLATE(updatetext_xml);
+static HDC15_XmlTemplate resource_text_tpl =
+    HDC15_XML_TEMPLATE(resource_text_xml);
+static HDC15_XmlTemplate batch_head_tpl = HDC15_XML_TEMPLATE(batch_head_xml);
+static HDC15_XmlTemplate batch_program_tpl =
+    HDC15_XML_TEMPLATE(batch_program_xml);
+static HDC15_XmlTemplate batch_play_tpl = HDC15_XML_TEMPLATE(batch_play_xml);
+static HDC15_XmlTemplate batch_area_tpl = HDC15_XML_TEMPLATE(batch_area_xml);
+static HDC15_XmlTemplate batch_text_tpl = HDC15_XML_TEMPLATE(batch_text_xml);
+static HDC15_XmlTemplate batch_area_end_tpl =
+    HDC15_XML_TEMPLATE(batch_area_end_xml);
+static HDC15_XmlTemplate batch_program_end_tpl =
+    HDC15_XML_TEMPLATE(batch_program_end_xml);
+static HDC15_XmlTemplate batch_tail_tpl = HDC15_XML_TEMPLATE(batch_tail_xml);
+
+/* Compile the shared templates once, before any thread renders them. */
+static void hd_templates_compile(void) {
+  static bool compiled = hd_xml_compile(&cmd_tpl) == 0 &&
+                         hd_xml_compile(&add_program_tpl) == 0 &&
+                         hd_xml_compile(&playcontrol_tpl) == 0 &&
+                         hd_xml_compile(&textcontrol_tpl) == 0 &&
+                         hd_xml_compile(&updatetext_tpl) == 0 &&
+                         hd_xml_compile(&resource_text_tpl) == 0 &&
+                         hd_xml_compile(&batch_head_tpl) == 0 &&
+                         hd_xml_compile(&batch_program_tpl) == 0 &&
+                         hd_xml_compile(&batch_play_tpl) == 0 &&
+                         hd_xml_compile(&batch_area_tpl) == 0 &&
+                         hd_xml_compile(&batch_text_tpl) == 0 &&
+                         hd_xml_compile(&batch_area_end_tpl) == 0 &&
+                         hd_xml_compile(&batch_program_end_tpl) == 0 &&
+                         hd_xml_compile(&batch_tail_tpl) == 0;
+  (void)compiled;
+}
+
+static uint32_t hd_now_ms(void) {
+  return (uint32_t)Kernel::Clock::now().time_since_epoch().count();
+}
+
+static uint32_t hd_dev_hash_of(const uint8_t *id) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < HDC15_MAX_DEVICE_ID_LENGHT; i++) {
+    h = (h ^ id[i]) * 16777619u;
+  }
+  return h;
+}
+
+/* Slot of id in c->hash: either holding it or the empty one to use. */
+static uint16_t *hd_dev_hash_slot(HDC15_Client *c, const uint8_t *id) {
+  uint32_t mask = c->hash_size - 1;
+  uint32_t i = hd_dev_hash_of(id) & mask;
+  while (c->hash[i] &&
+         memcmp(c->dev.dev[c->hash[i] - 1].id, id,
+                HDC15_MAX_DEVICE_ID_LENGHT) != 0) {
+    i = (i + 1) & mask;
+  }
+  return &c->hash[i];
+}
+
+static int hd_dev_hash_resize(HDC15_Client *c, int cap) {
+  uint16_t size = 8;
+  while (size < 2 * cap) {
+    size *= 2;
+  }
+  if (size <= c->hash_size) {
+    return 0;
+  }
+  uint16_t *hash = (uint16_t *)calloc(size, sizeof(uint16_t));
+  if (hash == NULL) {
+    return -1;
+  }
+  free(c->hash);
+  c->hash = hash;
+  c->hash_size = size;
+  for (int id = 0; id < c->dev.num; id++) {
+    *hd_dev_hash_slot(c, c->dev.dev[id].id) = id + 1;
+  }
+  return 0;
+}
+
+static void hd_registry_event(HDC15_Client *c, int id, int event) {
+  if (c->device_cb) {
+    c->device_cb(id, event, &c->dev.dev[id], c->device_ctx);
+  }
+}
+
+/* Grow the device table and the session table to hold at least num
+ * devices. */
+static int hd_registry_reserve(HDC15_Client *c, int num) {
+  if (num <= c->dev.cap) {
+    return 0;
+  }
+  if (num > HDC15_DEVICE_MAX) {
+    tr_err("device num %d > %d.", num, HDC15_DEVICE_MAX);
+    return -1;
+  }
+  int cap = c->dev.cap ? c->dev.cap : HDC15_DEVICE_NUM;
+  while (cap < num) {
+    cap *= 2;
+  }
+  if (cap > HDC15_DEVICE_MAX) {
+    cap = HDC15_DEVICE_MAX;
+  }
+  /* cap only moves once both tables have grown, a failure in between
+   * leaves one larger than cap says */
+  int old = c->dev.cap;
+  HDC15_Device *dev =
+      (HDC15_Device *)realloc(c->dev.dev, cap * sizeof(HDC15_Device));
+  if (dev == NULL) {
+    return -1;
+  }
+  memset(&dev[old], 0, (cap - old) * sizeof(HDC15_Device));
+  c->dev.dev = dev;
+  HDC15_Session **session = (HDC15_Session **)realloc(
+      c->session, cap * sizeof(HDC15_Session *));
+  if (session == NULL) {
+    return -1;
+  }
+  memset(&session[old], 0, (cap - old) * sizeof(HDC15_Session *));
+  c->session = session;
+  if (hd_dev_hash_resize(c, cap) != 0) {
+    return -1;
+  }
+  c->dev.cap = cap;
+  return 0;
+}
+
+/* Record one SearchDeviceAnswer, returns the device id or -1. */
+static int hd_registry_update(HDC15_Client *c, const HDC15_UdpResponse *ans,
+                              const char *ip) {
+  ScopedLock<Mutex> lock(c->mutex);
+  uint32_t now = hd_now_ms();
+  int id = c->hash_size ? *hd_dev_hash_slot(c, ans->devID) - 1 : -1;
+  if (id < 0) {
+    id = c->dev.num;
+    if (hd_registry_reserve(c, id + 1) != 0) {
+      return -1;
+    }
+    HDC15_Session *s = new (std::nothrow) HDC15_Session();
+    if (s == NULL) {
+      return -1;
+    }
+    s->client = c;
+    s->id = id;
+    c->session[id] = s;
+    memcpy(c->dev.dev[id].id, ans->devID, HDC15_MAX_DEVICE_ID_LENGHT);
+    *hd_dev_hash_slot(c, ans->devID) = id + 1;
+    c->dev.num++;
+  }
+  HDC15_Device *dev = &c->dev.dev[id];
+  int event = -1;
+  if (dev->ip_addr[0] == '\0') {
+    event = HDC15_DEVICE_ADDED;
+  } else if (strcmp(dev->ip_addr, ip) != 0) {
+    event = HDC15_DEVICE_MOVED;
+  }
+  /* it answers, so it is worth a try even if its session gave up on it */
+  core_util_atomic_store_bool(&c->session[id]->health_probe, true);
+  dev->chanege = ans->chanege;
+  dev->version = ans->version;
+  strlcpy(dev->ip_addr, ip, sizeof(dev->ip_addr));
+  dev->seen_ms = now;
+  if (event >= 0) {
+    tr_info("%d: %x %.*s %s", id, dev->version, HDC15_MAX_DEVICE_ID_LENGHT,
+            (const char *)dev->id, dev->ip_addr);
+    hd_registry_event(c, id, event);
+  }
+  return id;
+}
+
+/* Session of device id, with the address the registry has for it copied to
+ * ip (empty once the device expired). */
+static HDC15_Session *hd_client_session(HDC15_Client *c, int id, char *ip) {
+  ScopedLock<Mutex> lock(c->mutex);
+  if (id < 0 || id >= c->dev.num) {
+    tr_err("id >= hd_dev.num.");
+    return NULL;
+  }
+  if (ip) {
+    strlcpy(ip, c->dev.dev[id].ip_addr, NSAPI_IP_SIZE);
+  }
+  return c->session[id];
+}
+
+/* wait_ms of hd_session_acquire(): the client's deadline for the class */
+#define HD_SCHED_DEFAULT UINT32_MAX
+/* wait_ms of hd_session_acquire(): only if nobody has or waits for s */
+#define HD_SCHED_TRY     (UINT32_MAX - 1)
+
+static bool hd_sched_ahead(HDC15_Session *s, int prio) {
+  for (int p = 0; p < prio; p++) {
+    if (s->sched_waiting[p]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Wait for the turn of a blocking call of class prio on s, then take
+ * s->lock. Callers are let through most urgent class first, in the order the
+ * RTOS wakes them within a class. A callback that runs with s->lock held
+ * goes ahead at once, as the lock is already its own. Returns -1 without the
+ * lock once wait_ms (0: no limit) ran out. */
+static int hd_session_acquire(HDC15_Session *s, int prio, uint32_t wait_ms) {
+  if (s->lock.get_owner() == ThisThread::get_id()) {
+    s->lock.lock();
+    s->sched_nest++;
+    return 0;
+  }
+  if (wait_ms == HD_SCHED_DEFAULT) {
+    wait_ms = s->client->deadline_ms[prio];
+  }
+  uint32_t start = hd_stats_now();
+  uint32_t since = hd_now_ms();
+  s->sched_lock.lock();
+  hd_stats_depth(prio, ++s->sched_waiting[prio]);
+  while (s->sched_busy || hd_sched_ahead(s, prio)) {
+    if (wait_ms == HD_SCHED_TRY) {
+      s->sched_waiting[prio]--;
+      s->sched_lock.unlock();
+      return -1;
+    }
+    if (wait_ms == 0) {
+      s->sched_cv.wait();
+      continue;
+    }
+    uint32_t waited = hd_now_ms() - since;
+    if (waited >= wait_ms) {
+      s->sched_waiting[prio]--;
+      /* the less urgent ones may be let through now */
+      s->sched_cv.notify_all();
+      s->sched_lock.unlock();
+      hd_stats_dropped(prio);
+      tr_warn("%d: class %d call dropped after %u ms", s->id, prio,
+              (unsigned)waited);
+      return -1;
+    }
+    s->sched_cv.wait_for(std::chrono::milliseconds(wait_ms - waited));
+  }
+  s->sched_waiting[prio]--;
+  s->sched_busy = true;
+  s->sched_prio = prio;
+  s->sched_lock.unlock();
+  if (wait_ms == HD_SCHED_TRY) {
+    /* the event driver takes s->lock without a turn */
+    if (!s->lock.trylock()) {
+      ScopedLock<Mutex> lock(s->sched_lock);
+      s->sched_busy = false;
+      s->sched_cv.notify_all();
+      return -1;
+    }
+  } else {
+    s->lock.lock();
+  }
+  hd_stats_since(HDC15_STAT_WAIT + prio, start);
+  return 0;
+}
+
+static void hd_session_release(HDC15_Session *s) {
+  if (s->sched_nest) {
+    s->sched_nest--;
+    s->lock.unlock();
+    return;
+  }
+  s->lock.unlock();
+  ScopedLock<Mutex> lock(s->sched_lock);
+  s->sched_busy = false;
+  s->sched_cv.notify_all();
+}
+
+/* True if the holder of s should give way: a more urgent call is waiting
+ * and s is not held from a callback, which cannot let go of it. */
+static bool hd_session_contended(HDC15_Session *s) {
+  if (s->sched_nest) {
+    return false;
+  }
+  ScopedLock<Mutex> lock(s->sched_lock);
+  return hd_sched_ahead(s, s->sched_prio);
+}
+
+/* Let the more urgent calls waiting for s through, then take s back. */
+static void hd_session_yield(HDC15_Session *s) {
+  int prio = s->sched_prio;
+  hd_stats_preempted();
+  hd_session_release(s);
+  hd_session_acquire(s, prio, 0);
+}
+
+/* hd_session_acquire() for the scope of a public call. */
+class HDC15_SessionTurn {
+public:
+  HDC15_SessionTurn(HDC15_Session *s, int prio,
+                    uint32_t wait_ms = HD_SCHED_DEFAULT)
+      : _s(s), _held(hd_session_acquire(s, prio, wait_ms) == 0) {}
+  ~HDC15_SessionTurn() {
+    if (_held) {
+      hd_session_release(_s);
+    }
+  }
+  bool held() const { return _held; }
+
+private:
+  HDC15_Session *_s;
+  bool _held;
+};
+
+int hdc_discover(HDC15_Client *c, uint32_t timeout_ms, int expect) {
+  /* Create a UDP socket; it lives on the stack so periodic rescans do not
+   * touch the heap. */
+  UDPSocket sock;
+  NetworkInterface *net = NetworkInterface::get_default_instance();
+  if (sock.open(net) != NSAPI_ERROR_OK) {
+    tr_err("Create socket failed.");
+    return -1;
+  }
+
+  SocketAddress send_addr(HDC15_UDP_SCAN_ADDR, HDC15_UDP_PORT);
+  uint8_t packet[HDC15_UDP_ANSWER_LENGTH + 1];
+  int len = hd_codec_udp_ask(packet, sizeof(packet), SearchDeviceAsk);
+  uint32_t start = hd_now_ms();
+  uint32_t start_us = hd_stats_now();
+  if (sock.sendto(send_addr, (char *)packet, len) != len) {
+    sock.close();
+    tr_err("Sendto failed.\n");
+    return -1;
+  }
+
+  /* Every controller in range answers once, keep reading until the window
+   * closes; sessions stay open across rescans, hd_send_xml reconnects a
+   * session whose device moved to another address. */
+  uint8_t answered[(HDC15_DEVICE_MAX + 7) / 8] = {};
+  int found = 0;
+  while (expect <= 0 || found < expect) {
+    uint32_t elapsed = hd_now_ms() - start;
+    if (elapsed >= timeout_ms) {
+      break;
+    }
+    sock.set_timeout(timeout_ms - elapsed);
+    HDC15_UdpResponse recv_packet;
+    SocketAddress serv_addr;
+    /* one byte more than an answer, so a longer datagram is not taken for
+     * one */
+    int n = sock.recvfrom(&serv_addr, (char *)packet, sizeof(packet));
+    if (n == NSAPI_ERROR_WOULD_BLOCK) {
+      break;
+    }
+    if (n < 0 || hd_codec_udp_answer_decode(packet, n, &recv_packet) != 0 ||
+        recv_packet.cmd != SearchDeviceAnswer) {
+      continue;
+    }
+    hd_stats_rx(n);
+    int id = hd_registry_update(c, &recv_packet, serv_addr.get_ip_address());
+    if (id >= 0 && !(answered[id / 8] & (1 << (id % 8)))) {
+      answered[id / 8] |= 1 << (id % 8);
+      found++;
+    }
+  }
+
+  sock.close();
+  hd_stats_tx(len);
+  hd_stats_since(HDC15_STAT_SCAN, start_us);
+  return found;
+}
+
+int hdc_scan(HDC15_Client *c) {
+  return hdc_discover(c, HDC15_SCAN_TIMEOUT_MS, 0);
+}
+
+/* Follow a successful AddProgram of program in the screen model of s, so
+ * the next command needs no GetProgram. */
+static void hd_screen_added(HDC15_Session *s, int program) {
+  if (s->screen && s->screen->valid &&
+      hd_screen_program_set(s->screen, program, hd_text_area_guid,
+                            hd_text_res_guid, "text") != 0) {
+    /* no room for it, fetch it all next time */
+    s->screen->valid = false;
+  }
+}
+
+/* Pop the oldest in-flight request and report its result. */
+static void hd_session_complete(HDC15_Session *s, int result,
+                                const char *xml) {
+  hd_cmd_callback cb = s->pending[s->pending_head].cb;
+  void *ctx = s->pending[s->pending_head].ctx;
+  int program = s->pending[s->pending_head].program;
+  s->pending_head = (s->pending_head + 1) % HDC15_CMD_QUEUE_NUM;
+  s->pending_num--;
+  if (result == kSuccess && program >= 0) {
+    hd_screen_added(s, program);
+  }
+  if (cb) {
+    cb(s->id, result, xml, ctx);
+  }
+}
+
+static void hd_session_drop(HDC15_Session *s) {
+  if (s->sock) {
+    s->sock->close();
+    hd_pool_socket_delete(s->sock);
+    s->sock = NULL;
+  }
+  s->state = HD_SESSION_CLOSED;
+  s->nb_active = false;
+  s->heartbeat_out = false;
+  if (!s->resume) {
+    /* a restored guid is kept for the next connection */
+    s->version = 0;
+    s->guid[0] = '\0';
+  }
+  s->ip_addr[0] = '\0';
+  hd_frame_reset(&s->rx);
+  while (s->pending_num) {
+    hd_session_complete(s, -1, NULL);
+  }
+}
+
+static void hd_session_sink(void *ctx, const char *data, size_t len) {
+  hd_sax_feed((HDC15_SaxParser *)ctx, data, len);
+}
+
+/* Stream the xml of the next answers into sax, or stop with NULL. */
+static void hd_session_parse(HDC15_Session *s, HDC15_SaxParser *sax) {
+  s->rx.sink = sax ? hd_session_sink : NULL;
+  s->rx.sink_ctx = sax;
+}
+
+static void hd_sax_copy(void *ctx, const char *value) {
+  strlcpy((char *)ctx, value, HDC15_GUID_SIZE);
+}
+
+static void hd_sax_result(void *ctx, const char *value) {
+  strlcpy((char *)ctx, value, HDC15_SAX_MAX_NAME);
+}
+
+/* Status word at the start of a FileXxxAnswer or ErrorAnswer body. */
+static int hd_file_status(HDC15_Session *s) {
+  uint16_t status;
+  if (hd_codec_status_decode(s->rx.payload.data, s->rx.payload.len,
+                             &status) != 0) {
+    return kUnknown;
+  }
+  return status;
+}
+
+/* HDC15_ErrorCode of the answer in s->rx: the status of an ErrorAnswer or
+ * the result attribute of an SDKCmdAnswer, kSuccess if it has none. */
+static int hd_answer_code(HDC15_Session *s) {
+  if (s->rx.cmd == ErrorAnswer) {
+    int code = hd_file_status(s);
+    return code == kSuccess ? kUnknown : code;
+  }
+  char result[HDC15_SAX_MAX_NAME] = "";
+  HDC15_SaxWatch watch = {"sdk/out", "result", hd_sax_result, result};
+  HDC15_SaxParser sax;
+  hd_sax_init(&sax, &watch, 1);
+  hd_sax_feed(&sax, s->rx.payload.data, s->rx.payload.len);
+  if (result[0] == '\0') {
+    return kSuccess;
+  }
+  int code = hd_error_code(result);
+  if (code != kSuccess) {
+    hd_stats_error(code);
+  }
+  return code;
+}
+
+static EventQueue *hd_client_queue(HDC15_Client *c);
+static void hd_nb_post(HDC15_Session *s);
+
+/* Time limit(ms) of stage on s: the one hdc_set_stage_timeout() fixed,
+ * else the RTO of the round trip, or of the answer time for the stages that
+ * wait for a document, doubled for each timeout in a row. */
+static uint32_t hd_session_timeout(HDC15_Session *s, int stage) {
+  const HDC15_Client *c = s->client;
+  const HDC15_HealthInfo *h = &s->health;
+  bool answer = stage == HDC15_STAGE_GUID || stage == HDC15_STAGE_ANSWER;
+  if ((c->stage_fixed & (1u << stage)) ||
+      (answer ? h->answers : h->samples) == 0) {
+    return c->stage_ms[stage];
+  }
+  uint32_t rto = answer ? h->answer_ms + 4 * h->answervar_ms
+                        : h->srtt_ms + 4 * h->rttvar_ms;
+  uint32_t min = answer ? HDC15_ANSWER_MIN_MS : HDC15_RTO_MIN_MS;
+  if (rto < min) {
+    rto = min;
+  }
+  rto <<= h->failures < 4 ? h->failures : 4;
+  return rto < HDC15_RTO_MAX_MS ? rto : HDC15_RTO_MAX_MS;
+}
+
+static void hd_health_notify(HDC15_Session *s) {
+  core_util_atomic_flag_clear(&s->health_posted);
+  HDC15_Client *c = s->client;
+  ScopedLock<Mutex> lock(c->mutex);
+  hd_registry_event(c, s->id, HDC15_DEVICE_HEALTH);
+}
+
+/* Work out the state of s after a sample or a timeout. A change is traced
+ * and handed to the registry callback from the client's queue, as s->lock
+ * is held here. */
+static void hd_health_eval(HDC15_Session *s) {
+  static const char *const names[] = {"unknown", "ok", "degraded", "offline"};
+  HDC15_HealthInfo *h = &s->health;
+  uint8_t state = HDC15_HEALTH_UNKNOWN;
+  if (h->failures >= HDC15_HEALTH_OFFLINE_FAILS) {
+    state = HDC15_HEALTH_OFFLINE;
+  } else if (h->failures ||
+             (h->samples && h->srtt_ms > HDC15_HEALTH_DEGRADED_MS)) {
+    state = HDC15_HEALTH_DEGRADED;
+  } else if (h->samples || h->answers) {
+    state = HDC15_HEALTH_OK;
+  }
+  if (state == HDC15_HEALTH_OFFLINE) {
+    s->offline_ms = hd_now_ms();
+  }
+  if (state == h->state) {
+    return;
+  }
+  if (state > h->state) {
+    tr_warn("%d: %s -> %s, rtt %u ms", s->id, names[h->state], names[state],
+            (unsigned)h->srtt_ms);
+  } else {
+    tr_info("%d: %s -> %s, rtt %u ms", s->id, names[h->state], names[state],
+            (unsigned)h->srtt_ms);
+  }
+  {
+    CriticalSectionLock lock;
+    h->state = state;
+  }
+  if (s->client->device_cb &&
+      !core_util_atomic_load_bool(&s->client->closing) &&
+      !core_util_atomic_flag_test_and_set(&s->health_posted)) {
+    s->health_event = hd_client_queue(s->client)->call(hd_health_notify, s);
+    if (s->health_event == 0) {
+      core_util_atomic_flag_clear(&s->health_posted);
+    }
+  }
+}
+
+/* RFC 6298: the first sample r sets the mean, later ones move it by 1/8
+ * and the deviation by 1/4. */
+static void hd_rtt_update(uint32_t *srtt, uint32_t *var, uint16_t *samples,
+                          uint32_t r) {
+  CriticalSectionLock lock;
+  if (*samples == 0) {
+    *srtt = r;
+    *var = r / 2;
+  } else {
+    uint32_t err = *srtt > r ? *srtt - r : r - *srtt;
+    *var = (3 * *var + err) / 4;
+    *srtt = (7 * *srtt + r) / 8;
+  }
+  if (*samples < UINT16_MAX) {
+    (*samples)++;
+  }
+}
+
+/* A round trip of ms to the device of s: heartbeat, connect, service. */
+static void hd_health_rtt(HDC15_Session *s, uint32_t ms) {
+  HDC15_HealthInfo *h = &s->health;
+  hd_rtt_update(&h->srtt_ms, &h->rttvar_ms, &h->samples, ms);
+  hd_health_eval(s);
+}
+
+/* An SDKCmdAsk answered after ms. */
+static void hd_health_answer(HDC15_Session *s, uint32_t ms) {
+  HDC15_HealthInfo *h = &s->health;
+  hd_rtt_update(&h->answer_ms, &h->answervar_ms, &h->answers, ms);
+  hd_health_eval(s);
+}
+
+/* Something arrived from the device of s. */
+static void hd_session_alive(HDC15_Session *s) {
+  s->last_io_ms = hd_now_ms();
+  if (s->health.failures) {
+    {
+      CriticalSectionLock lock;
+      s->health.failures = 0;
+    }
+    hd_health_eval(s);
+  }
+}
+
+/* The device of s did not answer (or take the connection) in time. */
+static void hd_health_fail(HDC15_Session *s) {
+  hd_stats_timeout();
+  {
+    CriticalSectionLock lock;
+    if (s->health.failures < UINT8_MAX) {
+      s->health.failures++;
+    }
+  }
+  hd_health_eval(s);
+}
+
+/* True while calls for s should fail at once: the device is offline and
+ * has not been seen by a scan nor waited out HDC15_HEALTH_RETRY_MS. */
+static bool hd_health_holdoff(HDC15_Session *s) {
+  if (s->health.state != HDC15_HEALTH_OFFLINE ||
+      core_util_atomic_exchange_bool(&s->health_probe, false)) {
+    return false;
+  }
+  return (uint32_t)(hd_now_ms() - s->offline_ms) < HDC15_HEALTH_RETRY_MS;
+}
 
-  UDPSocket *sock = new UDPSocket;
+/* Blocking read of the next message, skipping late heartbeat answers. */
+static int hd_session_recv(HDC15_Session *s) {
+  if (s->blocking) {
+    s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+  }
+  while (true) {
+    int ret = hd_frame_read(&s->rx, s->sock);
+    if (ret == 0) {
+      hd_health_fail(s);
+      tr_err("Recv timeout.\n");
+      return -1;
+    }
+    if (ret < 0) {
+      tr_err("Recv failed %d.\n", ret);
+      return -1;
+    }
+    hd_session_alive(s);
+    if (s->rx.cmd == ErrorAnswer) {
+      hd_stats_error(hd_file_status(s));
+    }
+    if (s->rx.cmd != TcpHeartbeatAnswer) {
+      return s->rx.cmd;
+    }
+  }
+}
+
+static int hd_sock_send(TCPSocket *sock, const void *data, int len) {
+  int n = sock->send(data, len);
+  if (n == len) {
+    hd_stats_tx(len);
+  }
+  return n;
+}
+
+/* Move s to a handshake state, timing the one it leaves. */
+static void hd_session_enter(HDC15_Session *s, uint8_t state) {
+  static const int8_t stage[] = {-1, HDC15_STAT_CONNECT, HDC15_STAT_SERVICE,
+                                 HDC15_STAT_GUID, -1};
+  static const int8_t wait[] = {-1, HDC15_STAGE_CONNECT, HDC15_STAGE_SERVICE,
+                                HDC15_STAGE_GUID, HDC15_STAGE_ANSWER};
+  if (stage[s->state] >= 0) {
+    hd_stats_since(stage[s->state], s->state_us);
+  }
+  /* connect and SDKServiceAsk take one round trip each, GetIFVersion is
+   * answered like any command */
+  uint32_t now = hd_now_ms();
+  if (s->state == HD_SESSION_CONNECT || s->state == HD_SESSION_SERVICE) {
+    hd_session_alive(s);
+    hd_health_rtt(s, now - s->state_ms);
+  } else if (s->state == HD_SESSION_IFVERSION) {
+    hd_health_answer(s, now - s->state_ms);
+  }
+  s->state = state;
+  s->state_us = hd_stats_now();
+  s->state_ms = now;
+  if (s->blocking && wait[state] >= 0) {
+    s->sock->set_timeout(hd_session_timeout(s, wait[state]));
+  }
+}
+
+/* Send SDKServiceAsk on a connected session. */
+static int hd_session_hello(HDC15_Session *s) {
+  if (s->resume && s->guid[0]) {
+    /* trust the restored guid until the controller refuses it */
+    hd_session_enter(s, HD_SESSION_READY);
+    return 0;
+  }
+  char *tcp_data = s->tx.data;
+  int len = hd_codec_service_ask(tcp_data, s->tx.cap, HDC15_LOCAL_TCP_VERSION);
+  if (len < 0 || hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
+    hd_session_drop(s);
+    tr_err("Sendto failed.\n");
+    return -1;
+  }
+  hd_session_enter(s, HD_SESSION_SERVICE);
+  return 0;
+}
+
+/* Create the socket of s and connect it to ip. Without blocking the connect
+ * (and everything after it) is finished by hd_session_step(). */
+static int hd_session_start(HDC15_Session *s, const char *ip, bool blocking) {
+  if (hd_health_holdoff(s)) {
+    tr_warn("%d: offline, not connecting.", s->id);
+    return -1;
+  }
+  hd_session_drop(s);
+  if (hd_buffer_reserve(&s->tx, BUFSZ) != 0) {
+    return -1;
+  }
 
+  TCPSocket *sock = hd_pool_socket_new();
   if (sock == NULL) {
     tr_err("Create socket failed.");
     return -1;
   }
-  NetworkInterface *net = NetworkInterface::get_default_instance();
-  sock->open(net);
+  NetworkInterface *net = NetworkInterface::get_default_instance();
+  sock->open(net);
+  if (blocking) {
+    sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_CONNECT));
+  } else {
+    sock->set_blocking(false);
+  }
+
+  SocketAddress send_addr;
+  send_addr.set_port(HDC15_TCP_PORT);
+  send_addr.set_ip_address(ip);
+  s->state_us = hd_stats_now();
+  s->state_ms = hd_now_ms();
+  nsapi_error_t ret = sock->connect(send_addr);
+  if (ret != NSAPI_ERROR_OK &&
+      (blocking ||
+       (ret != NSAPI_ERROR_IN_PROGRESS && ret != NSAPI_ERROR_WOULD_BLOCK))) {
+    sock->close();
+    hd_pool_socket_delete(sock);
+    hd_stats_error(KConnectionFailed);
+    hd_health_fail(s);
+    tr_err("Connect %s failed.", ip);
+    return -1;
+  }
+  s->sock = sock;
+  s->blocking = blocking;
+  s->conn_seq++;
+  strlcpy(s->ip_addr, ip, sizeof(s->ip_addr));
+  s->state = HD_SESSION_CONNECT;
+  if (ret == NSAPI_ERROR_OK) {
+    return hd_session_hello(s);
+  }
+  return 0;
+}
+
+/* Advance the handshake of s as far as the socket allows. Returns 1 once the
+ * session is ready, 0 while it waits for the socket, or -1 after dropping
+ * it. */
+static int hd_session_step(HDC15_Session *s) {
+  if (s->state == HD_SESSION_CONNECT) {
+    SocketAddress send_addr(s->ip_addr, HDC15_TCP_PORT);
+    nsapi_error_t ret = s->sock->connect(send_addr);
+    if (ret == NSAPI_ERROR_IN_PROGRESS || ret == NSAPI_ERROR_ALREADY ||
+        ret == NSAPI_ERROR_WOULD_BLOCK) {
+      return 0;
+    }
+    if (ret != NSAPI_ERROR_OK && ret != NSAPI_ERROR_IS_CONNECTED) {
+      hd_stats_error(KConnectionFailed);
+      hd_health_fail(s);
+      tr_err("Connect %s failed.", s->ip_addr);
+      hd_session_drop(s);
+      return -1;
+    }
+    if (hd_session_hello(s) != 0) {
+      return -1;
+    }
+  }
+  while (s->state == HD_SESSION_SERVICE || s->state == HD_SESSION_IFVERSION) {
+    int ret = hd_frame_read(&s->rx, s->sock);
+    if (ret == 0) {
+      return 0;
+    }
+    if (ret < 0) {
+      tr_err("Recv failed %d.\n", ret);
+      hd_session_drop(s);
+      return -1;
+    }
+    if (s->rx.cmd == TcpHeartbeatAnswer) {
+      continue;
+    }
+    if (s->state == HD_SESSION_SERVICE) {
+      if (s->rx.cmd != SDKServiceAnswer ||
+          hd_codec_version_decode(s->rx.payload.data, s->rx.payload.len,
+                                  &s->version) != 0) {
+        hd_session_drop(s);
+        tr_err("Recv failed.\n");
+        return -1;
+      }
+
+      char *tcp_data = s->tx.data;
+      int xml_len = strlen(get_ifversion_xml);
+      int len = hd_codec_xml_frame(tcp_data, s->tx.cap, SDKCmdAsk, xml_len,
+                                   xml_len, 0);
+      if (len > 0) {
+        memcpy(&tcp_data[HDC15_TCP_HEADER_LENGTH], get_ifversion_xml, xml_len);
+      }
+      if (len < 0 || hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
+        hd_session_drop(s);
+        tr_err("Sendto failed.\n");
+        return -1;
+      }
+      hd_session_enter(s, HD_SESSION_IFVERSION);
+      continue;
+    }
+
+    HDC15_SaxWatch watch = {"sdk", "guid", hd_sax_copy, s->guid};
+    HDC15_SaxParser sax;
+    hd_sax_init(&sax, &watch, 1);
+    if (s->rx.cmd == SDKCmdAnswer) {
+      hd_sax_feed(&sax, s->rx.payload.data, s->rx.payload.len);
+    }
+    if (s->guid[0] == '\0') {
+      hd_session_drop(s);
+      tr_err("Guid failed.\n");
+      return -1;
+    }
+    hd_session_enter(s, HD_SESSION_READY);
+  }
+  hd_session_alive(s);
+  tr_info("%d: session %s guid %s", s->id, s->ip_addr, s->guid);
+
+  HDC15_Client *c = s->client;
+  if (!core_util_atomic_flag_test_and_set(&c->keepalive_started)) {
+    c->keepalive_queue = hd_client_queue(c);
+    c->keepalive_event = c->keepalive_queue->call_every(
+        std::chrono::milliseconds(HDC15_TCP_HEARTBEAT_MS), hdc_keepalive, c);
+  }
+  return 1;
+}
+
+static int hd_session_open(HDC15_Session *s, const char *ip) {
+  if (hd_session_start(s, ip, true) != 0) {
+    return -1;
+  }
+  int ret = hd_session_step(s);
+  if (ret == 0) {
+    hd_health_fail(s);
+    tr_err("Recv timeout.\n");
+    hd_session_drop(s);
+  }
+  return ret == 1 ? 0 : -1;
+}
+
+/* Render tpl at offset off of buf, or bind it (see hd_xml_bind()) if keep
+ * is set. buf grows to fit texts of several KB, up to
+ * HDC15_TCP_MAX_REQUEST. Returns the length or -1. */
+static int hd_xml_into(HDC15_Buffer *buf, uint32_t off, HDC15_XmlTemplate *tpl,
+                       const char *const *values, uint32_t keep,
+                       HDC15_XmlTemplate *bound) {
+  /* sized for the values printed as they are, so that a long notice is
+   * rendered once in the usual case */
+  uint32_t need = off + tpl->len + 1;
+  for (int i = 0; i < HDC15_SLOT_NUM; i++) {
+    need += values[i] ? strlen(values[i]) : 0;
+  }
+  if (hd_buffer_reserve(buf, need < BUFSZ ? BUFSZ : need) != 0) {
+    return -1;
+  }
+  while (true) {
+    int len = keep ? hd_xml_bind(tpl, values, keep, bound, buf->data + off,
+                                 buf->cap - off)
+                   : hd_xml_render(tpl, values, buf->data + off,
+                                   buf->cap - off);
+    if (len > HDC15_TCP_MAX_REQUEST) {
+      tr_err("xml too long.");
+      return -1;
+    }
+    if (len >= 0) {
+      return len;
+    }
+    if (len == -2) {
+      tr_err("text is not UTF-8.");
+      hd_stats_error(kInvalidParam);
+      return -1;
+    }
+    if (buf->cap >= off + HDC15_TCP_MAX_REQUEST ||
+        hd_buffer_reserve(buf, buf->cap * 2) != 0) {
+      tr_err("xml too long.");
+      return -1;
+    }
+  }
+}
+
+/* Render tpl with the session guid straight into the frame and send it. */
+static int hd_session_send(HDC15_Session *s, HDC15_XmlTemplate *tpl,
+                           const char *const *values) {
+  hd_templates_compile();
+  const char *v[HDC15_SLOT_NUM];
+  memcpy(v, values, sizeof(v));
+  v[HDC15_SLOT_GUID] = s->guid;
+  uint32_t start = hd_stats_now();
+  int xml_len =
+      hd_xml_into(&s->tx, HDC15_TCP_HEADER_LENGTH, tpl, v, 0, NULL);
+  hd_stats_since(HDC15_STAT_XML, start);
+  if (xml_len < 0) {
+    return -1;
+  }
+  char *tcp_data = s->tx.data;
+  /* A document longer than one frame goes out in fragments; the header of
+   * each is written over the end of the fragment before it, which is sent
+   * by then. */
+  uint32_t index = 0;
+  do {
+    uint32_t n = xml_len - index;
+    if (n > HDC15_XML_FRAGMENT) {
+      n = HDC15_XML_FRAGMENT;
+    }
+    char *frame = &tcp_data[index];
+    int len = hd_codec_xml_frame(frame, HDC15_TCP_HEADER_LENGTH + n, SDKCmdAsk,
+                                 n, xml_len, index);
+    if (len < 0) {
+      return -1;
+    }
+    if (hd_sock_send(s->sock, frame, len) != len) {
+      tr_err("Sendto failed.\n");
+      return -1;
+    }
+    index += n;
+  } while (index < (uint32_t)xml_len);
+  return 0;
+}
+
+/* Complete the oldest in-flight request with the answer in s->rx. */
+static void hd_session_answer(HDC15_Session *s) {
+  hd_session_complete(s, hd_answer_code(s),
+                      s->rx.cmd == SDKCmdAnswer ? s->rx.payload.data : NULL);
+}
+
+/* Wait for the answer to the oldest in-flight async request. */
+static int hd_session_pump(HDC15_Session *s) {
+  int cmd = hd_session_recv(s);
+  if (cmd != SDKCmdAnswer && cmd != ErrorAnswer) {
+    tr_err("Answer %x failed.\n", cmd);
+    hd_session_drop(s);
+    return -1;
+  }
+  hd_session_answer(s);
+  return 0;
+}
+
+static int hd_session_drain(HDC15_Session *s) {
+  while (s->pending_num) {
+    if (hd_session_pump(s) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Make sure s has an open session to ip, the current address of its
+ * device. */
+static int hd_session_ensure(HDC15_Session *s, const char *ip, bool *reused) {
+  if (ip[0] == '\0') {
+    tr_err("%d: device expired.", s->id);
+    *reused = false;
+    return -1;
+  }
+  *reused = s->sock && s->state == HD_SESSION_READY && s->guid[0] &&
+            strcmp(s->ip_addr, ip) == 0;
+  if (*reused) {
+    if (s->nb_active) {
+      /* the event driver had it, it takes the socket back on its next run */
+      s->blocking = true;
+      s->nb_active = false;
+    }
+    return 0;
+  }
+  return hd_session_open(s, ip);
+}
+
+/* Send tpl and wait for the answer, which is fed to sax if given. Returns
+ * the HDC15_ErrorCode of the answer (kSuccess is 0), or -1 if none arrived.
+ * The caller holds s->lock. */
+static int hd_send_xml(HDC15_Session *s, const char *ip, HDC15_XmlTemplate *tpl,
+                       const char *const *values, HDC15_SaxParser *sax) {
+  /* Reuse the open session; a failure on a reused connection usually means
+   * the controller dropped it, so reconnect once and resend. */
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused;
+    if (hd_session_ensure(s, ip, &reused) != 0) {
+      return -1;
+    }
+    if (hd_session_drain(s) == 0) {
+      if (sax) {
+        /* start over if a previous attempt fed part of an answer */
+        hd_sax_init(sax, sax->watch, sax->watch_num);
+      }
+      hd_session_parse(s, sax);
+      int cmd = -1;
+      if (hd_session_send(s, tpl, values) == 0) {
+        uint32_t start = hd_stats_now();
+        uint32_t sent_ms = hd_now_ms();
+        cmd = hd_session_recv(s);
+        if (cmd == SDKCmdAnswer) {
+          hd_stats_since(HDC15_STAT_ANSWER, start);
+          hd_health_answer(s, hd_now_ms() - sent_ms);
+        }
+      }
+      hd_session_parse(s, NULL);
+      if (cmd == SDKCmdAnswer || cmd == ErrorAnswer) {
+        return hd_answer_code(s);
+      }
+    }
+    hd_session_drop(s);
+    if (!reused) {
+      break;
+    }
+  }
+  return -1;
+}
+
+/* Expect the next answer on s for cb, after those already in flight;
+ * program is the one an AddProgram rewrites, -1 for other commands. */
+static void hd_session_expect(HDC15_Session *s, hd_cmd_callback cb,
+                              void *ctx, int program) {
+  int tail = (s->pending_head + s->pending_num) % HDC15_CMD_QUEUE_NUM;
+  s->pending[tail].cb = cb;
+  s->pending[tail].ctx = ctx;
+  s->pending[tail].program = program;
+  s->pending_num++;
+}
+
+/* Queue a command on s without waiting for the answer. Up to the client's
+ * window of requests are written back to back; cb runs once the answer
+ * arrives, from whichever call reads it (a later submit, hd_flush,
+ * hd_send_xml or the keepalive). The caller holds s->lock. */
+static int hd_submit_xml(HDC15_Session *s, const char *ip,
+                         HDC15_XmlTemplate *tpl, const char *const *values,
+                         int program, hd_cmd_callback cb, void *ctx) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused;
+    if (hd_session_ensure(s, ip, &reused) != 0) {
+      return -1;
+    }
+    while (s->sock && s->pending_num >= s->client->window) {
+      hd_session_pump(s);
+    }
+    if (s->sock && hd_session_send(s, tpl, values) == 0) {
+      hd_session_expect(s, cb, ctx, program);
+      return 0;
+    }
+    hd_session_drop(s);
+    if (!reused) {
+      break;
+    }
+  }
+  return -1;
+}
+
+int hdc_flush(HDC15_Client *c, int id) {
+  HDC15_Session *s = hd_client_session(c, id, NULL);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  return hd_session_drain(s);
+}
+
+int hdc_set_window(HDC15_Client *c, int window) {
+  if (window < 1 || window > HDC15_CMD_QUEUE_NUM) {
+    tr_err("window %d out of range.", window);
+    return -1;
+  }
+  c->window = window;
+  return 0;
+}
+
+int hdc_set_deadline(HDC15_Client *c, int prio, uint32_t ms) {
+  if (prio < 0 || prio >= HDC15_PRIOS) {
+    tr_err("priority %d out of range.", prio);
+    return -1;
+  }
+  c->deadline_ms[prio] = ms;
+  return 0;
+}
+
+int hdc_health_get(HDC15_Client *c, int id, HDC15_HealthInfo *info) {
+  HDC15_Session *s = hd_client_session(c, id, NULL);
+  if (s == NULL) {
+    return -1;
+  }
+  CriticalSectionLock lock;
+  *info = s->health;
+  for (int stage = 0; stage < HDC15_STAGES; stage++) {
+    info->timeout_ms[stage] = hd_session_timeout(s, stage);
+  }
+  return 0;
+}
+
+int hdc_sched_depth(HDC15_Client *c, int id, int prio) {
+  HDC15_Session *s = hd_client_session(c, id, NULL);
+  if (s == NULL || prio < 0 || prio > HDC15_PRIOS) {
+    return -1;
+  }
+  ScopedLock<Mutex> lock(s->sched_lock);
+  if (prio < HDC15_PRIOS) {
+    return s->sched_waiting[prio];
+  }
+  int depth = 0;
+  for (int p = 0; p < HDC15_PRIOS; p++) {
+    depth += s->sched_waiting[p];
+  }
+  return depth;
+}
+
+/* Send a heartbeat on s without waiting for the socket or the answer,
+ * which hd_keepalive_session() picks up later. Returns 1 if the socket had
+ * no room for it. */
+static int hd_session_heartbeat(HDC15_Session *s) {
+  char packet[HDC15_FRAME_HEADER];
+  hd_codec_frame(packet, sizeof(packet), TcpHeartbeatAsk, 0);
+  s->sock->set_blocking(false);
+  int n = hd_sock_send(s->sock, packet, sizeof(packet));
+  s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+  if (n == NSAPI_ERROR_WOULD_BLOCK) {
+    return 1;
+  }
+  if (n != sizeof(packet)) {
+    return -1;
+  }
+  s->heartbeat_out = true;
+  s->heartbeat_ms = hd_now_ms();
+  return 0;
+}
+
+/* One keepalive look at s, nothing in it waits for the device. Answers of
+ * async requests are left to the event driver, an idle connection gets a
+ * heartbeat, and one whose heartbeat went unanswered for the service stage
+ * is closed. Returns the time(ms) until the answer is due, 0 for none. The
+ * caller holds s->lock. */
+static uint32_t hd_keepalive_session(HDC15_Session *s) {
+  /* the event driver times its own stages */
+  if (s->nb_active || s->sock == NULL || s->state != HD_SESSION_READY) {
+    return 0;
+  }
+  if (s->pending_num) {
+    hd_nb_post(s);
+    return 0;
+  }
+  if (!s->heartbeat_out) {
+    if ((uint32_t)(hd_now_ms() - s->last_io_ms) < HDC15_TCP_HEARTBEAT_MS) {
+      return 0;
+    }
+    int ret = hd_session_heartbeat(s);
+    if (ret < 0) {
+      tr_warn("%d: heartbeat failed, closing session", s->id);
+      hd_session_drop(s);
+    }
+    return ret == 0 ? hd_session_timeout(s, HDC15_STAGE_SERVICE) : 0;
+  }
+
+  s->sock->set_blocking(false);
+  int ret = hd_frame_read(&s->rx, s->sock);
+  s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+  if (ret == 1 && s->rx.cmd == TcpHeartbeatAnswer) {
+    hd_session_alive(s);
+    hd_health_rtt(s, s->last_io_ms - s->heartbeat_ms);
+  } else if (ret != 0) {
+    tr_warn("%d: heartbeat answer failed %d, closing session", s->id, ret);
+    hd_session_drop(s);
+    return 0;
+  }
+  /* a blocking call may have read the answer (or anything else) first */
+  if ((int32_t)(s->last_io_ms - s->heartbeat_ms) >= 0) {
+    s->heartbeat_out = false;
+    return 0;
+  }
+  uint32_t waited = hd_now_ms() - s->heartbeat_ms;
+  uint32_t limit = hd_session_timeout(s, HDC15_STAGE_SERVICE);
+  if (waited >= limit) {
+    hd_health_fail(s);
+    tr_warn("%d: heartbeat lost, closing session", s->id);
+    hd_session_drop(s);
+    return 0;
+  }
+  return limit - waited;
+}
+
+static EventQueue *hd_keepalive_queue(HDC15_Client *c) {
+  return c->keepalive_queue ? c->keepalive_queue : hd_client_queue(c);
+}
+
+static void hd_keepalive_check(HDC15_Client *c) {
+  c->keepalive_check = 0;
+  hdc_keepalive(c);
+}
+
+/* Runs on the client's queue next to the event driver. A device is only
+ * looked at when nobody has or waits for it, in the least urgent class, so
+ * the keepalive never holds up a call. */
+void hdc_keepalive(HDC15_Client *c) {
+  c->mutex.lock();
+  int num = c->dev.num;
+  c->mutex.unlock();
+  uint32_t due = 0;
+  for (int i = 0; i < num; i++) {
+    HDC15_Session *s = hd_client_session(c, i, NULL);
+    if (s == NULL) {
+      continue;
+    }
+    /* a device busy with a call is not idle anyway */
+    HDC15_SessionTurn turn(s, HDC15_PRIO_BULK, HD_SCHED_TRY);
+    if (!turn.held()) {
+      continue;
+    }
+    uint32_t left = hd_keepalive_session(s);
+    if (left && (due == 0 || left < due)) {
+      due = left;
+    }
+  }
+  if (due && c->keepalive_check == 0 &&
+      !core_util_atomic_load_bool(&c->closing)) {
+    c->keepalive_check = hd_keepalive_queue(c)->call_in(
+        std::chrono::milliseconds(due), hd_keepalive_check, c);
+  }
+}
+
+int hdc_session_close(HDC15_Client *c, int id) {
+  HDC15_Session *s = hd_client_session(c, id, NULL);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  hd_session_drop(s);
+  return 0;
+}
+
+/* Remove devices that have not answered a search for max_age_ms. */
+static void hd_registry_expire(HDC15_Client *c, uint32_t max_age_ms) {
+  uint8_t expired[(HDC15_DEVICE_MAX + 7) / 8] = {};
+  c->mutex.lock();
+  uint32_t now = hd_now_ms();
+  int num = c->dev.num;
+  for (int id = 0; id < num; id++) {
+    HDC15_Device *dev = &c->dev.dev[id];
+    if (dev->ip_addr[0] == '\0' || (uint32_t)(now - dev->seen_ms) < max_age_ms) {
+      continue;
+    }
+    tr_info("%d: %s expired", id, dev->ip_addr);
+    hd_registry_event(c, id, HDC15_DEVICE_REMOVED);
+    dev->ip_addr[0] = '\0';
+    expired[id / 8] |= 1 << (id % 8);
+  }
+  c->mutex.unlock();
+  /* session locks are taken without the registry lock held */
+  for (int id = 0; id < num; id++) {
+    if (expired[id / 8] & (1 << (id % 8))) {
+      hdc_session_close(c, id);
+    }
+  }
+}
+
+#define HD_REGISTRY_REFRESH 0x1
+#define HD_REGISTRY_STOP    0x2
+
+static void hd_registry_run(HDC15_Client *c) {
+  while (true) {
+    hdc_discover(c, HDC15_SCAN_TIMEOUT_MS, 0);
+    hd_registry_expire(c, HDC15_DEVICE_EXPIRE_SCANS * c->registry_period_ms);
+    uint32_t flags = c->registry_flags.wait_any_for(
+        HD_REGISTRY_REFRESH | HD_REGISTRY_STOP,
+        std::chrono::milliseconds(c->registry_period_ms));
+    if (!(flags & osFlagsError) && (flags & HD_REGISTRY_STOP)) {
+      break;
+    }
+  }
+}
+
+int hdc_registry_start(HDC15_Client *c, uint32_t period_ms,
+                       hd_device_callback cb, void *ctx) {
+  if (c->registry_thread) {
+    return -1;
+  }
+  c->mutex.lock();
+  c->device_cb = cb;
+  c->device_ctx = ctx;
+  c->mutex.unlock();
+  c->registry_period_ms = period_ms ? period_ms : HDC15_REGISTRY_PERIOD_MS;
+  c->registry_flags.clear();
+  c->registry_thread =
+      new (std::nothrow) Thread(osPriorityBelowNormal, HDC15_REGISTRY_STACK_SIZE,
+                                NULL, "hd_registry");
+  if (c->registry_thread == NULL ||
+      c->registry_thread->start([c]() { hd_registry_run(c); }) != osOK) {
+    tr_err("Registry thread failed.");
+    delete c->registry_thread;
+    c->registry_thread = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void hdc_registry_stop(HDC15_Client *c) {
+  if (c->registry_thread == NULL) {
+    return;
+  }
+  c->registry_flags.set(HD_REGISTRY_STOP);
+  c->registry_thread->join();
+  delete c->registry_thread;
+  c->registry_thread = NULL;
+}
+
+int hdc_registry_refresh(HDC15_Client *c) {
+  if (c->registry_thread == NULL) {
+    return -1;
+  }
+  c->registry_flags.set(HD_REGISTRY_REFRESH);
+  return 0;
+}
+
+int hdc_device_find(HDC15_Client *c, const char *dev_id) {
+  uint8_t id[HDC15_MAX_DEVICE_ID_LENGHT] = {};
+  memcpy(id, dev_id, strnlen(dev_id, HDC15_MAX_DEVICE_ID_LENGHT));
+  ScopedLock<Mutex> lock(c->mutex);
+  if (c->hash_size == 0) {
+    return -1;
+  }
+  return *hd_dev_hash_slot(c, id) - 1;
+}
+
+int hdc_device_get(HDC15_Client *c, int id, HDC15_Device *dev) {
+  ScopedLock<Mutex> lock(c->mutex);
+  if (id < 0 || id >= c->dev.num || c->dev.dev[id].ip_addr[0] == '\0') {
+    return -1;
+  }
+  if (dev) {
+    *dev = c->dev.dev[id];
+  }
+  return 0;
+}
+
+/* On a session restored by hdc_state_load(), kInvalidGUID or
+ * kInvalidMethod (the controller does not know the guid) or no answer at all
+ * means what was restored is stale: the guid is dropped so the next
+ * connection negotiates again, and if the device could not be reached the
+ * registry looks for its address. Any other answer is the command's own
+ * and shows the guid is good. Returns true if it was stale. */
+static bool hd_session_refused(HDC15_Session *s, int code) {
+  if (!s->resume) {
+    return false;
+  }
+  if (code >= 0 && code != kInvalidGUID && code != kInvalidMethod) {
+    s->resume = false;
+    return false;
+  }
+  tr_warn("%d: restored session %s, renegotiating", s->id,
+          hd_error_name(code));
+  s->resume = false;
+  s->version = 0;
+  s->guid[0] = '\0';
+  if (code < 0) {
+    /* only sets a flag, fine with s->lock held */
+    hdc_registry_refresh(s->client);
+  }
+  return true;
+}
+
+#define HD_RETRY_KEEP 3    //< ##guid, ##area and ##res
+
+/* Copy the values that point into the screen model of s to keep, as the
+ * model may be fetched again while s is let go. */
+static void hd_values_keep(HDC15_Session *s, const char **values,
+                           char (*keep)[HDC15_MAX_PROGRAM_GUID_LENGHT]) {
+  uintptr_t lo = (uintptr_t)s->screen;
+  uintptr_t hi = lo + sizeof(HDC15_Screen);
+  int n = 0;
+  for (int i = 0; i < HDC15_SLOT_NUM && s->screen; i++) {
+    uintptr_t v = (uintptr_t)values[i];
+    if (v >= lo && v < hi && n < HD_RETRY_KEEP) {
+      strlcpy(keep[n], values[i], sizeof(keep[n]));
+      values[i] = keep[n++];
+    }
+  }
+}
+
+/* hd_send_xml, retried as the HDC15_RetryPolicy of the result says: at once
+ * after a transient error, after a growing pause while the controller is
+ * busy, never for anything else. The turn is let go for the pause, unless
+ * s is held from a callback, which gets the busy code back instead. A guid
+ * the controller does not know invalidates the screen model. */
+static int hd_send_retry(HDC15_Session *s, const char *ip,
+                         HDC15_XmlTemplate *tpl, const char *const *values,
+                         HDC15_SaxParser *sax) {
+  const char *v[HDC15_SLOT_NUM];
+  char keep[HD_RETRY_KEEP][HDC15_MAX_PROGRAM_GUID_LENGHT];
+  memcpy(v, values, sizeof(v));
+  uint32_t backoff = HDC15_CMD_BACKOFF_MS;
+  for (int attempt = 1;; attempt++) {
+    int code = hd_send_xml(s, ip, tpl, v, sax);
+    if (code == kInvalidGUID) {
+      tr_warn("%d: invalid guid, screen model dropped", s->id);
+      if (s->screen) {
+        s->screen->valid = false;
+      }
+    }
+    if (hd_session_refused(s, code)) {
+      /* the same attempt again, on a negotiated session */
+      hd_session_drop(s);
+      attempt--;
+      continue;
+    }
+    int policy = hd_error_policy(code);
+    if (code == kSuccess || policy == HDC15_RETRY_NEVER ||
+        attempt >= HDC15_CMD_RETRY ||
+        (code < 0 && s->health.state == HDC15_HEALTH_OFFLINE)) {
+      return code;
+    }
+    if (policy == HDC15_RETRY_BACKOFF && s->sched_nest) {
+      return code;
+    }
+    tr_warn("%d: %s, retry %d", s->id, hd_error_name(code), attempt);
+    if (policy == HDC15_RETRY_BACKOFF) {
+      int prio = s->sched_prio;
+      hd_values_keep(s, v, keep);
+      hd_session_release(s);
+      ThisThread::sleep_for(std::chrono::milliseconds(backoff));
+      hd_session_acquire(s, prio, 0);
+      backoff = backoff * 2 < HDC15_CMD_BACKOFF_MAX_MS ? backoff * 2
+                                                       : HDC15_CMD_BACKOFF_MAX_MS;
+    }
+  }
+}
+
+/* Fetch the screen model of s with GetProgram. s->lock is held. */
+static int hd_screen_fetch(HDC15_Session *s, const char *ip) {
+  /* parsed aside, the cached model stays as it was unless this succeeds */
+  HDC15_Screen *screen = (HDC15_Screen *)calloc(1, sizeof(HDC15_Screen));
+  if (screen == NULL) {
+    tr_err("%d: screen model failed.", s->id);
+    return -1;
+  }
+  HDC15_ScreenParse parse;
+  hd_screen_parse_init(&parse, screen);
+  HDC15_SaxParser sax;
+  hd_sax_init(&sax, parse.watch, HDC15_SCREEN_WATCH);
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_CMD] = "GetProgram";
+  uint32_t start = hd_stats_now();
+  int code = hd_send_retry(s, ip, &cmd_tpl, values, &sax);
+  if (code != kSuccess) {
+    tr_err("%d: GetProgram %s.", s->id, hd_error_name(code));
+    free(screen);
+    return -1;
+  }
+  hd_stats_since(HDC15_STAT_PROGRAM, start);
+  for (int i = 0; i < screen->num[HDC15_SCREEN_PROGRAM]; i++) {
+    tr_info("%d %s", i, screen->program[i].guid);
+  }
+  screen->valid = true;
+  free(s->screen);
+  s->screen = screen;
+  return 0;
+}
+
+/* The cached screen model of s, fetched if there is none. s->lock is
+ * held. */
+static HDC15_Screen *hd_screen_ready(HDC15_Session *s, const char *ip) {
+  if ((s->screen == NULL || !s->screen->valid) &&
+      hd_screen_fetch(s, ip) != 0) {
+    return NULL;
+  }
+  return s->screen;
+}
+
+int hdc_get_guid(HDC15_Client *c, int id) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+  if (!turn.held()) {
+    return -1;
+  }
+  if (hd_screen_fetch(s, ip) != 0) {
+    return -1;
+  }
+  return s->screen->num[HDC15_SCREEN_PROGRAM];
+}
+
+int hdc_screen_get(HDC15_Client *c, int id, HDC15_Screen *screen) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  if (hd_screen_ready(s, ip) == NULL) {
+    return -1;
+  }
+  *screen = *s->screen;
+  return 0;
+}
+
+int hdc_screen_find(HDC15_Client *c, int id, int kind, const char *key) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  HDC15_Screen *screen = hd_screen_ready(s, ip);
+  return screen ? hd_screen_lookup(screen, kind, key) : -1;
+}
+
+void hdc_screen_invalidate(HDC15_Client *c, int id) {
+  HDC15_Session *s = hd_client_session(c, id, NULL);
+  if (s == NULL) {
+    return;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return;
+  }
+  if (s->screen) {
+    s->screen->valid = false;
+  }
+}
+
+int hdc_resource_text(HDC15_Client *c, int id, int res,
+                      const char *text_string) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  HDC15_Screen *screen = hd_screen_ready(s, ip);
+  if (screen == NULL) {
+    return -1;
+  }
+  const HDC15_Screen_Item *text =
+      hd_screen_item(screen, HDC15_SCREEN_RESOURCE, res);
+  if (text == NULL || strcmp(text->type, "text") != 0) {
+    tr_err("%d: resource %d is not text.", id, res);
+    return -1;
+  }
+  const HDC15_Screen_Item *area =
+      hd_screen_item(screen, HDC15_SCREEN_AREA, text->parent);
+  if (area == NULL ||
+      hd_screen_item(screen, HDC15_SCREEN_PROGRAM, area->parent) == NULL) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_PROGRAM] = screen->program[area->parent].guid;
+  values[HDC15_SLOT_AREA] = area->guid;
+  values[HDC15_SLOT_RES] = text->guid;
+  values[HDC15_SLOT_STR] = text_string;
+  return hd_send_retry(s, ip, &resource_text_tpl, values, NULL);
+}
+
+/* Fill the ##guid/##en slots for program guid of s, fetching the screen
+ * model first if it is missing or stale. The values point into s, so s->lock
+ * must be held until they are rendered. */
+static int hd_program_values(HDC15_Session *s, const char *ip, int guid,
+                             bool en, const char **values) {
+  HDC15_Screen *screen = hd_screen_ready(s, ip);
+  if (screen == NULL || guid < 0 ||
+      guid >= screen->num[HDC15_SCREEN_PROGRAM]) {
+    tr_err("guid >= hd_program_guid[id].num.");
+    return -1;
+  }
+  values[HDC15_SLOT_PROGRAM] = screen->program[guid].guid;
+  values[HDC15_SLOT_EN] = en ? "false" : "true";
+  return 0;
+}
+
+int hdc_playcontrol(HDC15_Client *c, int id, int guid, bool en) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  if (hd_program_values(s, ip, guid, en, values) != 0) {
+    return -1;
+  }
+  return hd_send_retry(s, ip, &playcontrol_tpl, values, NULL);
+}
+
+int hdc_textcontrol(HDC15_Client *c, int id, int guid, bool en,
+                    const char *text_string) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  if (hd_program_values(s, ip, guid, en, values) != 0) {
+    return -1;
+  }
+  values[HDC15_SLOT_STR] = text_string;
+  int code = hd_send_retry(s, ip, &add_program_tpl, values, NULL);
+  if (code == kSuccess) {
+    hd_screen_added(s, guid);
+  }
+  return code;
+}
+
+int hdc_program_update(HDC15_Client *c, int id, int guid, int play,
+                       const char *text_string) {
+  if (play < 0 && text_string == NULL) {
+    tr_err("%d: program update without a change.", id);
+    return -1;
+  }
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  if (hd_program_values(s, ip, guid, play > 0, values) != 0) {
+    return -1;
+  }
+  values[HDC15_SLOT_STR] = text_string;
+  HDC15_XmlTemplate *tpl = &textcontrol_tpl;
+  if (text_string == NULL) {
+    tpl = &playcontrol_tpl;
+  } else if (play < 0) {
+    tpl = &updatetext_tpl;
+  }
+  return hd_send_retry(s, ip, tpl, values, NULL);
+}
+
+enum {
+  HD_BATCH_PLAY = 0,       //< playControl of a program
+  HD_BATCH_TEXT,           //< the text add_program_xml creates in a program
+  HD_BATCH_RESOURCE,       //< a text resource of the screen model
+};
+
+typedef struct HDC15_BatchOp {
+  uint8_t kind;
+  bool en;
+  int16_t index;           //< program, or resource for HD_BATCH_RESOURCE
+  uint32_t text;           //< offset of its text in HDC15_Batch.text
+} HDC15_BatchOp;
+
+/* Where an op lands in the document, resolved through the screen model. */
+typedef struct HDC15_BatchTarget {
+  int program;
+  const char *area;
+  const char *res;
+} HDC15_BatchTarget;
+
+struct HDC15_Batch {
+  HDC15_Client *client;
+  int id;
+  uint8_t num;
+  uint8_t prio;            //< HDC15_Priority of the commit
+  uint32_t wait_ms;        //< see hd_batch_priority()
+  HDC15_BatchOp op[HDC15_BATCH_OPS];
+  HDC15_Buffer text;       //< texts of the ops, each NUL terminated
+  HDC15_Buffer xml;        //< document of the last commit
+};
+
+HDC15_Batch *hdc_batch_new(HDC15_Client *c, int id) {
+  HDC15_Batch *b = new (std::nothrow) HDC15_Batch();
+  if (b == NULL) {
+    return NULL;
+  }
+  b->client = c ? c : &hd_client;
+  b->id = id;
+  b->prio = HDC15_PRIO_NORMAL;
+  b->wait_ms = HD_SCHED_DEFAULT;
+  return b;
+}
+
+void hd_batch_free(HDC15_Batch *b) {
+  if (b == NULL) {
+    return;
+  }
+  hd_buffer_free(&b->text);
+  hd_buffer_free(&b->xml);
+  delete b;
+}
+
+void hd_batch_clear(HDC15_Batch *b) {
+  b->num = 0;
+  b->text.len = 0;
+}
+
+int hd_batch_priority(HDC15_Batch *b, int prio, uint32_t deadline_ms) {
+  if (prio < 0 || prio >= HDC15_PRIOS) {
+    tr_err("priority %d out of range.", prio);
+    return -1;
+  }
+  b->prio = prio;
+  b->wait_ms = deadline_ms;
+  return 0;
+}
+
+static int hd_batch_add(HDC15_Batch *b, uint8_t kind, int index, bool en,
+                        const char *text_string) {
+  if (b->num >= HDC15_BATCH_OPS || index < 0 || index > INT16_MAX) {
+    tr_err("%d: batch full.", b->id);
+    return -1;
+  }
+  HDC15_BatchOp *op = &b->op[b->num];
+  op->kind = kind;
+  op->en = en;
+  op->index = index;
+  op->text = b->text.len;
+  if (text_string) {
+    size_t n = strlen(text_string) + 1;
+    if (hd_buffer_reserve(&b->text, b->text.len + n) != 0) {
+      return -1;
+    }
+    memcpy(b->text.data + b->text.len, text_string, n);
+    b->text.len += n;
+  }
+  b->num++;
+  return 0;
+}
+
+int hd_batch_play(HDC15_Batch *b, int guid, bool en) {
+  return hd_batch_add(b, HD_BATCH_PLAY, guid, en, NULL);
+}
+
+int hd_batch_text(HDC15_Batch *b, int guid, const char *text_string) {
+  if (text_string == NULL) {
+    return -1;
+  }
+  return hd_batch_add(b, HD_BATCH_TEXT, guid, false, text_string);
+}
+
+int hd_batch_resource_text(HDC15_Batch *b, int res, const char *text_string) {
+  if (text_string == NULL) {
+    return -1;
+  }
+  return hd_batch_add(b, HD_BATCH_RESOURCE, res, false, text_string);
+}
+
+static int hd_batch_target(const HDC15_Screen *screen, const HDC15_BatchOp *op,
+                           HDC15_BatchTarget *t) {
+  if (op->kind != HD_BATCH_RESOURCE) {
+    t->program = op->index;
+    t->area = hd_text_area_guid;
+    t->res = hd_text_res_guid;
+    return hd_screen_item(screen, HDC15_SCREEN_PROGRAM, op->index) ? 0 : -1;
+  }
+  const HDC15_Screen_Item *text =
+      hd_screen_item(screen, HDC15_SCREEN_RESOURCE, op->index);
+  if (text == NULL || strcmp(text->type, "text") != 0) {
+    return -1;
+  }
+  const HDC15_Screen_Item *area =
+      hd_screen_item(screen, HDC15_SCREEN_AREA, text->parent);
+  if (area == NULL ||
+      hd_screen_item(screen, HDC15_SCREEN_PROGRAM, area->parent) == NULL) {
+    return -1;
+  }
+  t->program = area->parent;
+  t->area = area->guid;
+  t->res = text->guid;
+  return 0;
+}
+
+/* Render t at the end of buf, growing it as needed. */
+static int hd_batch_emit(HDC15_Buffer *buf, HDC15_XmlTemplate *t,
+                         const char *const *values) {
+  while (true) {
+    int n = hd_xml_render(t, values, buf->data + buf->len, buf->cap - buf->len);
+    if (n >= 0) {
+      buf->len += n;
+      return 0;
+    }
+    if (n == -2) {
+      tr_err("batch text is not UTF-8.");
+      hd_stats_error(kInvalidParam);
+      return -1;
+    }
+    if (buf->cap >= HDC15_TCP_MAX_REQUEST ||
+        hd_buffer_reserve(buf, buf->cap * 2) != 0) {
+      tr_err("batch xml too long.");
+      return -1;
+    }
+  }
+}
+
+/* Render the ops of b, grouped by program and area, into b->xml and set up
+ * doc for it with the session guid still to be filled in. */
+static int hd_batch_render(HDC15_Batch *b, const HDC15_Screen *screen,
+                           const HDC15_BatchTarget *t, HDC15_XmlTemplate *doc) {
+  HDC15_Buffer *buf = &b->xml;
+  const char *values[HDC15_SLOT_NUM] = {};
+  buf->len = 0;
+  if (hd_buffer_reserve(buf, BUFSZ) != 0) {
+    return -1;
+  }
+  int len = hd_xml_bind(&batch_head_tpl, values, 1u << HDC15_SLOT_GUID, doc,
+                        buf->data, buf->cap);
+  if (len < 0) {
+    return -1;
+  }
+  buf->len = len;
+  for (int i = 0; i < b->num; i++) {
+    int p = t[i].program;
+    bool seen = false;
+    for (int j = 0; j < i; j++) {
+      seen |= t[j].program == p;
+    }
+    if (seen) {
+      continue;
+    }
+    values[HDC15_SLOT_PROGRAM] = screen->program[p].guid;
+    if (hd_batch_emit(buf, &batch_program_tpl, values) != 0) {
+      return -1;
+    }
+    int play = -1;
+    for (int j = i; j < b->num; j++) {
+      if (b->op[j].kind == HD_BATCH_PLAY && t[j].program == p) {
+        play = j;
+      }
+    }
+    if (play >= 0) {
+      values[HDC15_SLOT_EN] = b->op[play].en ? "false" : "true";
+      if (hd_batch_emit(buf, &batch_play_tpl, values) != 0) {
+        return -1;
+      }
+    }
+    for (int j = i; j < b->num; j++) {
+      if (b->op[j].kind == HD_BATCH_PLAY || t[j].program != p) {
+        continue;
+      }
+      bool area_seen = false;
+      for (int k = i; k < j; k++) {
+        area_seen |= b->op[k].kind != HD_BATCH_PLAY && t[k].program == p &&
+                     strcmp(t[k].area, t[j].area) == 0;
+      }
+      if (area_seen) {
+        continue;
+      }
+      values[HDC15_SLOT_AREA] = t[j].area;
+      if (hd_batch_emit(buf, &batch_area_tpl, values) != 0) {
+        return -1;
+      }
+      for (int k = j; k < b->num; k++) {
+        if (b->op[k].kind == HD_BATCH_PLAY || t[k].program != p ||
+            strcmp(t[k].area, t[j].area) != 0) {
+          continue;
+        }
+        /* the last text for a resource wins */
+        bool replaced = false;
+        for (int m = k + 1; m < b->num; m++) {
+          replaced |= b->op[m].kind != HD_BATCH_PLAY && t[m].program == p &&
+                      strcmp(t[m].res, t[k].res) == 0;
+        }
+        if (replaced) {
+          continue;
+        }
+        values[HDC15_SLOT_RES] = t[k].res;
+        values[HDC15_SLOT_STR] = b->text.data + b->op[k].text;
+        if (hd_batch_emit(buf, &batch_text_tpl, values) != 0) {
+          return -1;
+        }
+      }
+      if (hd_batch_emit(buf, &batch_area_end_tpl, values) != 0) {
+        return -1;
+      }
+    }
+    if (hd_batch_emit(buf, &batch_program_end_tpl, values) != 0) {
+      return -1;
+    }
+  }
+  if (hd_batch_emit(buf, &batch_tail_tpl, values) != 0 ||
+      buf->len > HDC15_TCP_MAX_REQUEST - HDC15_GUID_SIZE) {
+    return -1;
+  }
+  /* the buffer may have moved while it grew */
+  doc->xml = buf->data;
+  doc->len = buf->len;
+  return 0;
+}
+
+int hd_batch_commit(HDC15_Batch *b) {
+  if (b->num == 0) {
+    return kSuccess;
+  }
+  hd_templates_compile();
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(b->client, b->id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, b->prio, b->wait_ms);
+  if (!turn.held()) {
+    return -1;
+  }
+  HDC15_Screen *screen = hd_screen_ready(s, ip);
+  if (screen == NULL) {
+    return -1;
+  }
+  HDC15_BatchTarget t[HDC15_BATCH_OPS];
+  for (int i = 0; i < b->num; i++) {
+    if (hd_batch_target(screen, &b->op[i], &t[i]) != 0) {
+      tr_err("%d: batch target %d failed.", b->id, b->op[i].index);
+      return -1;
+    }
+  }
+  HDC15_XmlTemplate doc = {};
+  if (hd_batch_render(b, screen, t, &doc) != 0 ||
+      hd_buffer_reserve(&s->tx, HDC15_TCP_HEADER_LENGTH + doc.len +
+                                    HDC15_GUID_SIZE + 1) != 0) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  int code = hd_send_retry(s, ip, &doc, values, NULL);
+  if (code == kSuccess) {
+    hd_batch_clear(b);
+  }
+  return code;
+}
+
+int hdc_playcontrol_async(HDC15_Client *c, int id, int guid, bool en,
+                          hd_cmd_callback cb, void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  if (hd_program_values(s, ip, guid, en, values) != 0) {
+    return -1;
+  }
+  return hd_submit_xml(s, ip, &playcontrol_tpl, values, -1, cb, ctx);
+}
+
+int hdc_textcontrol_async(HDC15_Client *c, int id, int guid, bool en,
+                          const char *text_string, hd_cmd_callback cb,
+                          void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  if (hd_program_values(s, ip, guid, en, values) != 0) {
+    return -1;
+  }
+  values[HDC15_SLOT_STR] = text_string;
+  return hd_submit_xml(s, ip, &add_program_tpl, values, guid, cb, ctx);
+}
+
+/* A non-blocking request: the template and copies of its slot values, sent
+ * once the session is ready. */
+typedef struct HDC15_NbRequest {
+  struct HDC15_NbRequest *next;
+  HDC15_Session *s;
+  HDC15_XmlTemplate *tpl;
+  hd_cmd_callback cb;
+  void *ctx;
+  int16_t program;                   //< program for ##guid, -1: none
+  uint8_t tries;                     //< sends that failed
+  uint8_t retries;                   //< answers that asked for a retry
+  uint32_t not_before_ms;            //< backing off until then
+  uint32_t backoff_ms;
+  uint32_t value[HDC15_SLOT_NUM];    //< offset + 1 of the value in data, 0: NULL
+  char data[1];
+} HDC15_NbRequest;
+
+/* GetProgram issued by the driver, parsed straight into the screen model. */
+typedef struct HDC15_NbFetch {
+  HDC15_Screen *screen;              //< swapped in once complete
+  HDC15_ScreenParse parse;
+  HDC15_SaxParser sax;
+} HDC15_NbFetch;
+
+static void hd_nb_run(HDC15_Session *s);
+
+static EventQueue *hd_client_queue(HDC15_Client *c) {
+  return c->queue ? c->queue : mbed_event_queue();
+}
+
+/* Queue a run of the driver for s unless one is queued already. Safe from
+ * the sigio callback. */
+static void hd_nb_post(HDC15_Session *s) {
+  if (core_util_atomic_load_bool(&s->client->closing)) {
+    return;
+  }
+  if (!core_util_atomic_flag_test_and_set(&s->nb_posted)) {
+    s->nb_event = hd_client_queue(s->client)->call(hd_nb_run, s);
+    if (s->nb_event == 0) {
+      core_util_atomic_flag_clear(&s->nb_posted);
+    }
+  }
+}
+
+static void hd_nb_arm(HDC15_Session *s, uint32_t ms) {
+  if (core_util_atomic_load_bool(&s->client->closing)) {
+    return;
+  }
+  s->nb_timer = hd_client_queue(s->client)->call_in(
+      std::chrono::milliseconds(ms), hd_nb_post, s);
+}
+
+static HDC15_NbRequest *hd_nb_peek(HDC15_Session *s) {
+  ScopedLock<Mutex> lock(s->nb_lock);
+  return s->nb_head;
+}
+
+static HDC15_NbRequest *hd_nb_pop(HDC15_Session *s) {
+  ScopedLock<Mutex> lock(s->nb_lock);
+  HDC15_NbRequest *req = s->nb_head;
+  if (req) {
+    s->nb_head = req->next;
+    if (s->nb_head == NULL) {
+      s->nb_tail = NULL;
+    }
+    s->nb_num--;
+  }
+  return req;
+}
+
+/* Put req back at the head of the queue, to be sent after delay_ms. */
+static void hd_nb_requeue(HDC15_Session *s, HDC15_NbRequest *req,
+                          uint32_t delay_ms) {
+  req->not_before_ms = hd_now_ms() + delay_ms;
+  s->nb_lock.lock();
+  req->next = s->nb_head;
+  s->nb_head = req;
+  if (s->nb_tail == NULL) {
+    s->nb_tail = req;
+  }
+  s->nb_num++;
+  s->nb_lock.unlock();
+  hd_nb_post(s);
+}
+
+/* Answer (or failure) of a request. A result the HDC15_RetryPolicy allows
+ * to retry puts it back in the queue; a kInvalidGUID result drops the screen
+ * model. */
+static void hd_nb_done(int id, int result, const char *xml, void *ctx) {
+  HDC15_NbRequest *req = (HDC15_NbRequest *)ctx;
+  HDC15_Session *s = req->s;
+  if (result == kInvalidGUID) {
+    tr_warn("%d: invalid guid, screen model dropped", id);
+    if (s->screen) {
+      s->screen->valid = false;
+    }
+  }
+  /* refused for a stale restored guid: send it again once renegotiated */
+  bool stale = hd_session_refused(s, result) ||
+               (result > kSuccess && s->guid[0] == '\0');
+  int policy = stale ? HDC15_RETRY_NOW : hd_error_policy(result);
+  if (policy != HDC15_RETRY_NEVER && ++req->retries < HDC15_CMD_RETRY) {
+    tr_warn("%d: %s, retry %d", id, hd_error_name(result), req->retries);
+    uint32_t delay = 0;
+    if (policy == HDC15_RETRY_BACKOFF) {
+      delay = req->backoff_ms;
+      req->backoff_ms = delay * 2 < HDC15_CMD_BACKOFF_MAX_MS
+                            ? delay * 2
+                            : HDC15_CMD_BACKOFF_MAX_MS;
+    }
+    hd_nb_requeue(s, req, delay);
+    return;
+  }
+  if (req->cb) {
+    req->cb(id, result, xml, req->ctx);
+  }
+  free(req);
+}
+
+static void hd_nb_fail_queued(HDC15_Session *s) {
+  HDC15_NbRequest *req;
+  while ((req = hd_nb_pop(s)) != NULL) {
+    hd_nb_done(s->id, -1, NULL, req);
+  }
+}
+
+static void hd_nb_fetched(int id, int result, const char *xml, void *ctx) {
+  (void)id;
+  (void)xml;
+  HDC15_Session *s = (HDC15_Session *)ctx;
+  HDC15_Screen *screen = s->nb_fetch->screen;
+  hd_session_parse(s, NULL);
+  free(s->nb_fetch);
+  s->nb_fetch = NULL;
+  if (result == 0) {
+    screen->valid = true;
+    free(s->screen);
+    s->screen = screen;
+  } else {
+    free(screen);
+    s->nb_fetch_failed = true;
+  }
+}
+
+/* Send GetProgram for the screen model, its answer is parsed as it
+ * arrives. */
+static int hd_nb_fetch(HDC15_Session *s) {
+  HDC15_Screen *screen = (HDC15_Screen *)calloc(1, sizeof(HDC15_Screen));
+  HDC15_NbFetch *fetch = (HDC15_NbFetch *)malloc(sizeof(HDC15_NbFetch));
+  if (screen == NULL || fetch == NULL) {
+    tr_err("%d: screen model failed.", s->id);
+    free(screen);
+    free(fetch);
+    return -1;
+  }
+  fetch->screen = screen;
+  hd_screen_parse_init(&fetch->parse, screen);
+  hd_sax_init(&fetch->sax, fetch->parse.watch, HDC15_SCREEN_WATCH);
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_CMD] = "GetProgram";
+  hd_session_parse(s, &fetch->sax);
+  if (hd_session_send(s, &cmd_tpl, values) != 0) {
+    hd_session_parse(s, NULL);
+    free(screen);
+    free(fetch);
+    return -1;
+  }
+  s->nb_fetch = fetch;
+  hd_session_expect(s, hd_nb_fetched, s, -1);
+  return 0;
+}
+
+static int hd_nb_send(HDC15_Session *s, HDC15_NbRequest *req) {
+  const char *values[HDC15_SLOT_NUM] = {};
+  for (int i = 0; i < HDC15_SLOT_NUM; i++) {
+    if (req->value[i]) {
+      values[i] = &req->data[req->value[i] - 1];
+    }
+  }
+  if (req->program >= 0) {
+    values[HDC15_SLOT_PROGRAM] = s->screen->program[req->program].guid;
+  }
+  return hd_session_send(s, req->tpl, values);
+}
+
+/* Let the driver own the socket: non-blocking, waking it up on events. */
+static void hd_nb_take(HDC15_Session *s) {
+  s->sock->set_blocking(false);
+  s->blocking = false;
+  s->sock->sigio([s]() { hd_nb_post(s); });
+  s->nb_active = true;
+}
+
+/* Hand an idle session back to the blocking API. */
+static void hd_nb_release(HDC15_Session *s) {
+  if (s->nb_active && s->sock) {
+    s->sock->sigio(nullptr);
+    s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+    s->blocking = true;
+  }
+  s->nb_active = false;
+}
+
+/* Time left in the stage the connection of s is in, 0 once it ran out. A
+ * stage is timed from the run that first sees it. */
+static uint32_t hd_nb_left(HDC15_Session *s) {
+  uint8_t stage = s->state == HD_SESSION_CONNECT     ? HDC15_STAGE_CONNECT
+                  : s->state == HD_SESSION_SERVICE   ? HDC15_STAGE_SERVICE
+                  : s->state == HD_SESSION_IFVERSION ? HDC15_STAGE_GUID
+                                                     : HDC15_STAGE_ANSWER;
+  uint32_t now = hd_now_ms();
+  if (stage != s->nb_stage) {
+    s->nb_stage = stage;
+    s->nb_since_ms = now;
+  }
+  uint32_t elapsed = now - s->nb_since_ms;
+  uint32_t limit = hd_session_timeout(s, stage);
+  return elapsed < limit ? limit - elapsed : 0;
+}
+
+static const char *const hd_stage_names[HDC15_STAGES] = {
+    "connect", "service", "guid", "answer"};
+
+/* Queue as many requests as the window and the screen model allow. Returns
+ * -1 after dropping the session. */
+static int hd_nb_flush(HDC15_Session *s) {
+  HDC15_NbRequest *req;
+  while (s->nb_fetch == NULL && s->pending_num < s->client->window &&
+         (req = hd_nb_peek(s)) != NULL &&
+         (int32_t)(req->not_before_ms - hd_now_ms()) <= 0) {
+    if (req->program >= 0 && (s->screen == NULL || !s->screen->valid)) {
+      if (s->nb_fetch_failed) {
+        s->nb_fetch_failed = false;
+        hd_nb_done(s->id, -1, NULL, hd_nb_pop(s));
+        continue;
+      }
+      if (s->pending_num) {
+        /* the model is fetched with nothing else in flight */
+        break;
+      }
+      if (hd_nb_fetch(s) == 0) {
+        s->nb_stage = HDC15_STAGE_ANSWER;
+        s->nb_since_ms = hd_now_ms();
+        break;
+      }
+    } else if (req->program >= 0 &&
+               req->program >= s->screen->num[HDC15_SCREEN_PROGRAM]) {
+      tr_err("guid >= hd_program_guid[id].num.");
+      hd_nb_done(s->id, -1, NULL, hd_nb_pop(s));
+      continue;
+    } else if (hd_nb_send(s, req) == 0) {
+      if (s->pending_num == 0) {
+        s->nb_stage = HDC15_STAGE_ANSWER;
+        s->nb_since_ms = hd_now_ms();
+      }
+      hd_session_expect(s, hd_nb_done, hd_nb_pop(s),
+                        req->tpl == &add_program_tpl ? req->program : -1);
+      continue;
+    }
+    /* a send failed: the session is reopened, a request gets two tries */
+    if (++req->tries >= 2) {
+      hd_nb_done(s->id, -1, NULL, hd_nb_pop(s));
+    }
+    hd_session_drop(s);
+    return -1;
+  }
+  return 0;
+}
+
+/* Advance the connection of s as far as its socket allows: connect, service
+ * negotiation, guid, then the queued commands and their answers. Returns the
+ * time left in the current stage, or 0 with nothing left to wait for. The
+ * caller holds s->lock. */
+static uint32_t hd_nb_drive(HDC15_Session *s, const char *ip) {
+  if (!s->nb_active) {
+    /* taking over from the blocking API, start timing afresh */
+    s->nb_stage = HDC15_STAGES;
+  }
+  while (true) {
+    if (s->state != HD_SESSION_READY) {
+      if (s->state == HD_SESSION_CLOSED) {
+        if (hd_nb_peek(s) == NULL) {
+          return 0;
+        }
+        if (ip[0] == '\0' || hd_session_start(s, ip, false) != 0) {
+          tr_err("%d: device expired or unreachable.", s->id);
+          hd_nb_fail_queued(s);
+          return 0;
+        }
+        s->nb_stage = HDC15_STAGES;
+      }
+      hd_nb_take(s);
+      int ret = hd_session_step(s);
+      if (ret < 0) {
+        hd_nb_fail_queued(s);
+        return 0;
+      }
+      if (ret == 0) {
+        uint32_t left = hd_nb_left(s);
+        if (left) {
+          return left;
+        }
+        hd_health_fail(s);
+        tr_err("%d: %s timeout.", s->id, hd_stage_names[s->nb_stage]);
+        hd_session_drop(s);
+        hd_nb_fail_queued(s);
+        return 0;
+      }
+    }
+    hd_nb_take(s);
+
+    /* answers, oldest first */
+    while (s->pending_num) {
+      int ret = hd_frame_read(&s->rx, s->sock);
+      if (ret == 0) {
+        break;
+      }
+      if (ret < 0 ||
+          (s->rx.cmd != SDKCmdAnswer && s->rx.cmd != ErrorAnswer &&
+           s->rx.cmd != TcpHeartbeatAnswer)) {
+        tr_err("%d: answer failed %d.", s->id, ret);
+        hd_session_drop(s);
+        break;
+      }
+      hd_session_alive(s);
+      if (s->rx.cmd == ErrorAnswer) {
+        hd_stats_error(hd_file_status(s));
+      }
+      if (s->rx.cmd != TcpHeartbeatAnswer) {
+        s->nb_since_ms = s->last_io_ms;
+        hd_session_answer(s);
+      }
+    }
+    if (s->state == HD_SESSION_READY && s->guid[0] == '\0') {
+      /* a restored guid was refused: let the answers still due arrive,
+       * then negotiate afresh */
+      if (s->pending_num == 0) {
+        hd_session_drop(s);
+        continue;
+      }
+    } else if (s->state != HD_SESSION_READY || hd_nb_flush(s) != 0) {
+      continue;
+    }
+    if (s->pending_num == 0) {
+      /* nothing in flight: done, or a request backing off */
+      HDC15_NbRequest *req = hd_nb_peek(s);
+      if (req == NULL) {
+        return 0;
+      }
+      int32_t wait = req->not_before_ms - hd_now_ms();
+      return wait > 0 ? wait : HDC15_NB_RETRY_MS;
+    }
+    uint32_t left = hd_nb_left(s);
+    if (left) {
+      return left;
+    }
+    hd_health_fail(s);
+    tr_err("%d: answer timeout.", s->id);
+    hd_session_drop(s);
+  }
+}
+
+static void hd_nb_run(HDC15_Session *s) {
+  HDC15_Client *c = s->client;
+  core_util_atomic_flag_clear(&s->nb_posted);
+  if (s->nb_timer) {
+    hd_client_queue(c)->cancel(s->nb_timer);
+    s->nb_timer = 0;
+  }
+  char ip[NSAPI_IP_SIZE];
+  hd_client_session(c, s->id, ip);
+  if (!s->lock.trylock()) {
+    /* a blocking call has the device, look again shortly */
+    hd_nb_arm(s, HDC15_NB_RETRY_MS);
+    return;
+  }
+  uint32_t left = hd_nb_drive(s, ip);
+  if (left) {
+    hd_nb_arm(s, left);
+  } else if (s->pending_num == 0) {
+    hd_nb_release(s);
+  }
+  s->lock.unlock();
+}
+
+/* Copy tpl and values into a request and queue it on device id. */
+static int hd_nb_submit(HDC15_Client *c, int id, HDC15_XmlTemplate *tpl,
+                        int program, const char *const *values,
+                        hd_cmd_callback cb, void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL || ip[0] == '\0') {
+    return -1;
+  }
+  size_t len = 0;
+  for (int i = 0; i < HDC15_SLOT_NUM; i++) {
+    if (values[i]) {
+      len += strlen(values[i]) + 1;
+    }
+  }
+  if (len >= HDC15_TCP_MAX_REQUEST) {
+    tr_err("%d: request too long.", id);
+    return -1;
+  }
+  HDC15_NbRequest *req = (HDC15_NbRequest *)malloc(
+      offsetof(HDC15_NbRequest, data) + len + 1);
+  if (req == NULL) {
+    tr_err("%d: request failed.", id);
+    return -1;
+  }
+  req->next = NULL;
+  req->s = s;
+  req->tpl = tpl;
+  req->cb = cb;
+  req->ctx = ctx;
+  req->program = program;
+  req->tries = 0;
+  req->retries = 0;
+  req->not_before_ms = hd_now_ms();
+  req->backoff_ms = HDC15_CMD_BACKOFF_MS;
+  len = 0;
+  for (int i = 0; i < HDC15_SLOT_NUM; i++) {
+    req->value[i] = 0;
+    if (values[i]) {
+      size_t n = strlen(values[i]) + 1;
+      memcpy(&req->data[len], values[i], n);
+      req->value[i] = len + 1;
+      len += n;
+    }
+  }
+
+  s->nb_lock.lock();
+  if (s->nb_num >= HDC15_NB_QUEUE_NUM) {
+    s->nb_lock.unlock();
+    tr_err("%d: request queue full.", id);
+    free(req);
+    return -1;
+  }
+  if (s->nb_tail) {
+    s->nb_tail->next = req;
+  } else {
+    s->nb_head = req;
+  }
+  s->nb_tail = req;
+  s->nb_num++;
+  s->nb_lock.unlock();
+  hd_nb_post(s);
+  return 0;
+}
+
+void hdc_set_queue(HDC15_Client *c, EventQueue *queue) {
+  c->queue = queue;
+}
+
+int hdc_set_stage_timeout(HDC15_Client *c, int stage, uint32_t ms) {
+  static const uint32_t defaults[HDC15_STAGES] = {
+      HDC15_NB_CONNECT_MS, HDC15_NB_SERVICE_MS, HDC15_NB_GUID_MS,
+      HDC15_NB_ANSWER_MS};
+  if (stage < 0 || stage >= HDC15_STAGES) {
+    return -1;
+  }
+  c->stage_ms[stage] = ms ? ms : defaults[stage];
+  if (ms) {
+    c->stage_fixed |= 1u << stage;
+  } else {
+    c->stage_fixed &= ~(1u << stage);
+  }
+  return 0;
+}
+
+int hdc_cmd_nb(HDC15_Client *c, int id, const char *cmd, hd_cmd_callback cb,
+               void *ctx) {
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_CMD] = cmd;
+  return hd_nb_submit(c, id, &cmd_tpl, -1, values, cb, ctx);
+}
+
+int hdc_playcontrol_nb(HDC15_Client *c, int id, int guid, bool en,
+                       hd_cmd_callback cb, void *ctx) {
+  return hdc_program_update_nb(c, id, guid, en, NULL, cb, ctx);
+}
+
+int hdc_textcontrol_nb(HDC15_Client *c, int id, int guid, bool en,
+                       const char *text_string, hd_cmd_callback cb,
+                       void *ctx) {
+  if (guid < 0) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_EN] = en ? "false" : "true";
+  values[HDC15_SLOT_STR] = text_string;
+  return hd_nb_submit(c, id, &add_program_tpl, guid, values, cb, ctx);
+}
+
+int hdc_program_update_nb(HDC15_Client *c, int id, int guid, int play,
+                          const char *text_string, hd_cmd_callback cb,
+                          void *ctx) {
+  if (guid < 0 || (play < 0 && text_string == NULL)) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_EN] = play > 0 ? "false" : "true";
+  values[HDC15_SLOT_STR] = text_string;
+  HDC15_XmlTemplate *tpl = &textcontrol_tpl;
+  if (text_string == NULL) {
+    tpl = &playcontrol_tpl;
+  } else if (play < 0) {
+    tpl = &updatetext_tpl;
+  }
+  return hd_nb_submit(c, id, tpl, guid, values, cb, ctx);
+}
+
+enum {
+  HD_GROUP_OPEN = 0,       //< session handshake in progress
+  HD_GROUP_FETCH,          //< GetProgram for a missing screen model
+  HD_GROUP_SENT,           //< command sent, waiting for the answer
+  HD_GROUP_DONE,
+  HD_GROUP_FAILED,
+  HD_GROUP_RETRIED = 0x80, //< a stale session was reopened already
+};
+
+/* One device of a group command; the session stays locked until the group
+ * is done. */
+typedef struct HDC15_GroupMember {
+  HDC15_Session *s;                  //< NULL unless its turn was taken
+  int same;                          //< earlier member of the same id, -1: none
+  uint8_t phase;
+  int8_t code;                       //< HDC15_ErrorCode of the answer
+  char ip[NSAPI_IP_SIZE];
+} HDC15_GroupMember;
+
+/* Fill in the per device slots of bound and send it to s. */
+static int hd_group_send(HDC15_Session *s, HDC15_XmlTemplate *bound, int guid) {
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_PROGRAM] = s->screen->program[guid].guid;
+  s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+  int ret = hd_session_send(s, bound, values);
+  s->sock->set_blocking(false);
+  return ret;
+}
+
+/* Make sure s has a screen model without blocking: GetProgram goes out
+ * once the answers to async requests sent earlier are in and is parsed as it
+ * arrives (see hd_nb_fetch()). Returns 1 once the model is there, 0 while
+ * waiting or -1. */
+static int hd_group_fetch(HDC15_Session *s) {
+  while (true) {
+    if (s->screen && s->screen->valid && s->nb_fetch == NULL) {
+      return 1;
+    }
+    if (s->pending_num == 0) {
+      if (s->nb_fetch_failed) {
+        s->nb_fetch_failed = false;
+        return -1;
+      }
+      s->sock->set_timeout(hd_session_timeout(s, HDC15_STAGE_ANSWER));
+      int ret = hd_nb_fetch(s);
+      s->sock->set_blocking(false);
+      if (ret != 0) {
+        return -1;
+      }
+    }
+    int ret = hd_frame_read(&s->rx, s->sock);
+    if (ret <= 0) {
+      return ret == 0 ? 0 : -1;
+    }
+    hd_session_alive(s);
+    if (s->rx.cmd == TcpHeartbeatAnswer) {
+      continue;
+    }
+    if (s->rx.cmd != SDKCmdAnswer && s->rx.cmd != ErrorAnswer) {
+      return -1;
+    }
+    hd_session_answer(s);
+  }
+}
+
+/* Returns 1 once the answer to the group command is in, 0 while waiting or
+ * -1. Answers to async requests sent earlier come first. */
+static int hd_group_recv(HDC15_Session *s) {
+  while (true) {
+    int ret = hd_frame_read(&s->rx, s->sock);
+    if (ret <= 0) {
+      return ret == 0 ? 0 : -1;
+    }
+    hd_session_alive(s);
+    if (s->rx.cmd == TcpHeartbeatAnswer) {
+      continue;
+    }
+    if (s->rx.cmd != SDKCmdAnswer && s->rx.cmd != ErrorAnswer) {
+      return -1;
+    }
+    if (s->pending_num == 0) {
+      return 1;
+    }
+    hd_session_answer(s);
+  }
+}
+
+/* Start (or restart) the session of group member m without blocking. */
+static int hd_group_open(HDC15_GroupMember *m, bool reuse) {
+  HDC15_Session *s = m->s;
+  HDC15_Client *c = s->client;
+  if (!(reuse && s->sock && s->state == HD_SESSION_READY && s->guid[0] &&
+        strcmp(s->ip_addr, m->ip) == 0) &&
+      hd_session_start(s, m->ip, false) != 0) {
+    return -1;
+  }
+  s->sock->set_blocking(false);
+  s->blocking = false;
+  s->sock->sigio([c]() { c->group_flags.set(1); });
+  return 0;
+}
+
+/* Render tpl once and run it on every device of the group concurrently:
+ * sessions are opened non-blocking, a missing screen model is fetched, each
+ * gets its command as soon as it is ready and the answers are collected as
+ * they arrive. */
+static int hd_group_xml(HDC15_Client *c, const int *ids, int num,
+                        HDC15_XmlTemplate *tpl, const char *const *values,
+                        int guid, int *results) {
+  if (guid < 0) {
+    tr_err("guid < 0.");
+    return -1;
+  }
+  ScopedLock<Mutex> group_lock(c->group_mutex);
+  if (ids == NULL) {
+    c->mutex.lock();
+    num = c->dev.num;
+    c->mutex.unlock();
+  }
+  if (num <= 0) {
+    return 0;
+  }
+  hd_templates_compile();
+  /* the scratch space is kept for the next group command */
+  if (num > c->group_cap) {
+    HDC15_GroupMember *member = (HDC15_GroupMember *)realloc(
+        c->group, num * sizeof(HDC15_GroupMember));
+    if (member == NULL) {
+      tr_err("group members failed.");
+      return -1;
+    }
+    c->group = member;
+    c->group_cap = num;
+  }
+  HDC15_GroupMember *member = c->group;
+  memset(member, 0, num * sizeof(HDC15_GroupMember));
+  HDC15_XmlTemplate bound = HDC15_XML_TEMPLATE(NULL);
+  if (hd_xml_into(&c->group_xml, 0, tpl, values,
+                  (1u << HDC15_SLOT_GUID) | (1u << HDC15_SLOT_PROGRAM),
+                  &bound) < 0) {
+    tr_err("group xml failed.");
+    return -1;
+  }
+
+  /* the group has its own time limit, HDC15_GROUP_TIMEOUT_MS, waiting for
+   * the devices included */
+  uint32_t start = hd_now_ms();
+  c->group_flags.clear();
+  for (int i = 0; i < num; i++) {
+    HDC15_GroupMember *m = &member[i];
+    int id = ids ? ids[i] : i;
+    m->phase = HD_GROUP_FAILED;
+    m->same = -1;
+    for (int j = 0; ids && j < i; j++) {
+      if (ids[j] == id) {
+        /* one command per device, the answer is shared */
+        m->same = j;
+        break;
+      }
+    }
+    if (m->same >= 0) {
+      continue;
+    }
+    HDC15_Session *s = hd_client_session(c, id, m->ip);
+    uint32_t elapsed = hd_now_ms() - start;
+    if (s == NULL || elapsed >= HDC15_GROUP_TIMEOUT_MS ||
+        hd_session_acquire(s, HDC15_PRIO_NORMAL,
+                           HDC15_GROUP_TIMEOUT_MS - elapsed) != 0) {
+      tr_err("%d: not in the group.", id);
+      continue;
+    }
+    m->s = s;
+    HDC15_Screen *screen = s->screen && s->screen->valid ? s->screen : NULL;
+    if (m->ip[0] == '\0' ||
+        (screen && guid >= screen->num[HDC15_SCREEN_PROGRAM])) {
+      tr_err("%d: not in the group.", id);
+      continue;
+    }
+    /* a stale failure of the driver's fetch is not this one's */
+    s->nb_fetch_failed = false;
+    if (hd_group_open(m, true) == 0) {
+      m->phase = HD_GROUP_OPEN;
+    }
+  }
+
+  while (true) {
+    int waiting = 0;
+    for (int i = 0; i < num; i++) {
+      HDC15_GroupMember *m = &member[i];
+      HDC15_Session *s = m->s;
+      uint8_t state = m->phase & ~HD_GROUP_RETRIED;
+      int ret = 0;
+      if (state == HD_GROUP_OPEN) {
+        ret = hd_session_step(s);
+        if (ret == 1) {
+          state = HD_GROUP_FETCH;
+        }
+      }
+      if (state == HD_GROUP_FETCH) {
+        ret = hd_group_fetch(s);
+        if (ret == 1 && guid >= s->screen->num[HDC15_SCREEN_PROGRAM]) {
+          tr_err("%d: not in the group.", s->id);
+          state = HD_GROUP_FAILED;
+          ret = 0;
+        } else if (ret == 1) {
+          ret = hd_group_send(s, &bound, guid);
+          if (ret == 0) {
+            state = HD_GROUP_SENT;
+          }
+        }
+      } else if (state == HD_GROUP_SENT) {
+        ret = hd_group_recv(s);
+        if (ret == 1) {
+          m->code = hd_answer_code(s);
+          if (m->code == kInvalidGUID && s->screen) {
+            s->screen->valid = false;
+          } else if (m->code == kSuccess && tpl == &add_program_tpl) {
+            hd_screen_added(s, guid);
+          }
+          hd_session_refused(s, m->code);
+          state = HD_GROUP_DONE;
+        }
+      }
+      if (ret < 0) {
+        /* a reused session may have gone stale, reconnect once */
+        bool retry = !(m->phase & HD_GROUP_RETRIED);
+        hd_session_drop(s);
+        s->nb_fetch_failed = false;
+        m->phase |= HD_GROUP_RETRIED;
+        state = retry && hd_group_open(m, false) == 0 ? HD_GROUP_OPEN
+                                                      : HD_GROUP_FAILED;
+      }
+      m->phase = (m->phase & HD_GROUP_RETRIED) | state;
+      if (state == HD_GROUP_OPEN || state == HD_GROUP_FETCH ||
+          state == HD_GROUP_SENT) {
+        waiting++;
+      }
+    }
+    uint32_t elapsed = hd_now_ms() - start;
+    if (waiting == 0 || elapsed >= HDC15_GROUP_TIMEOUT_MS) {
+      break;
+    }
+    c->group_flags.wait_any_for(
+        1, std::chrono::milliseconds(HDC15_GROUP_TIMEOUT_MS - elapsed));
+  }
+
+  int done = 0;
+  for (int i = 0; i < num; i++) {
+    HDC15_GroupMember *m = &member[i];
+    int id = ids ? ids[i] : i;
+    if (m->same >= 0) {
+      if (results) {
+        results[i] = results[m->same];
+      }
+      continue;
+    }
+    uint8_t state = m->phase & ~HD_GROUP_RETRIED;
+    if (state == HD_GROUP_OPEN || state == HD_GROUP_FETCH ||
+        state == HD_GROUP_SENT) {
+      tr_err("%d: group answer timeout.", id);
+      hd_health_fail(m->s);
+      hd_session_drop(m->s);
+      state = HD_GROUP_FAILED;
+    } else if (state == HD_GROUP_DONE) {
+      m->s->sock->sigio(nullptr);
+      m->s->sock->set_timeout(hd_session_timeout(m->s, HDC15_STAGE_ANSWER));
+      m->s->blocking = true;
+      if (m->code == kSuccess) {
+        done++;
+      }
+    }
+    if (m->s) {
+      hd_session_release(m->s);
+    }
+    if (results) {
+      results[i] = state == HD_GROUP_DONE ? m->code : -1;
+    }
+  }
+  return done;
+}
+
+int hdc_group_playcontrol(HDC15_Client *c, const int *ids, int num, int guid,
+                          bool en, int *results) {
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_EN] = en ? "false" : "true";
+  return hd_group_xml(c, ids, num, &playcontrol_tpl, values, guid, results);
+}
+
+int hdc_group_textcontrol(HDC15_Client *c, const int *ids, int num, int guid,
+                          bool en, const char *text_string, int *results) {
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_EN] = en ? "false" : "true";
+  values[HDC15_SLOT_STR] = text_string;
+  return hd_group_xml(c, ids, num, &add_program_tpl, values, guid, results);
+}
+
+#if HDC15_FILE_CHUNK_SIZE + 4 > BUFSZ
+#error "HDC15_FILE_CHUNK_SIZE does not fit in tcp_data"
+#endif
+
+static int hd_file_md5(HDC15_Session *s, uint32_t size,
+                       hd_file_read_callback read, void *ctx, char *md5) {
+  char *tcp_data = s->tx.data;
+  HDC15_Md5 m;
+  hd_md5_init(&m);
+  for (uint32_t offset = 0; offset < size;) {
+    uint32_t n = size - offset;
+    int got = read(ctx, offset, tcp_data,
+                   n < HDC15_FILE_CHUNK_SIZE ? n : HDC15_FILE_CHUNK_SIZE);
+    if (got <= 0) {
+      tr_err("file read at %u failed.", (unsigned)offset);
+      return -1;
+    }
+    hd_md5_update(&m, tcp_data, got);
+    offset += got;
+  }
+  hd_md5_hex(&m, md5);
+  return 0;
+}
+
+/* FileStartAsk: md5(33) size(8) type(2) name, NUL terminated. */
+static int hd_file_start(HDC15_Session *s, const char *name, uint16_t type,
+                         uint32_t size, const char *md5) {
+  char *tcp_data = s->tx.data;
+  int len = hd_codec_file_start(tcp_data, BUFSZ, md5, size, type, name);
+  if (len < 0) {
+    tr_err("file name too long.");
+    return -1;
+  }
+  if (hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
+    tr_err("Sendto failed.\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* One go at the transfer on the current session. Returns 0 when done, -1 if
+ * the connection failed (worth resuming) or -2 if the controller or the
+ * source refused. */
+static int hd_file_transfer(HDC15_Session *s, const char *ip, const char *name,
+                            uint16_t type, uint32_t size, const char *md5,
+                            hd_file_read_callback read, void *ctx) {
+  int id = s->id;
+  bool reused;
+  if (hd_session_ensure(s, ip, &reused) != 0 || hd_session_drain(s) != 0 ||
+      hd_file_start(s, name, type, size, md5) != 0) {
+    return -1;
+  }
+  int cmd = hd_session_recv(s);
+  if (cmd != FileStartAnswer) {
+    tr_err("%d: file start %x status %d.", id, cmd, hd_file_status(s));
+    return cmd == ErrorAnswer ? -2 : -1;
+  }
+  uint16_t status = kUnknown;
+  uint64_t exist = 0;
+  hd_codec_file_start_answer_decode(s->rx.payload.data, s->rx.payload.len,
+                                    &status, &exist);
+  if (status != kSuccess || exist > size) {
+    hd_stats_error(status);
+    tr_err("%d: file start status %d size %u.", id, status,
+           (unsigned)exist);
+    return -2;
+  }
+  if (exist) {
+    tr_info("%d: %s resumes at %u/%u", id, name, (unsigned)exist,
+            (unsigned)size);
+  }
+
+  char *tcp_data = s->tx.data;
+  uint32_t offset = (uint32_t)exist;
+  int inflight = 0;
+  while (offset < size || inflight) {
+    /* a more urgent call waiting gets the device once the chunks in flight
+     * are answered; the controller keeps the transfer open meanwhile */
+    bool contended = offset < size && hd_session_contended(s);
+    if (contended && inflight == 0) {
+      uint16_t seq = s->conn_seq;
+      hd_session_yield(s);
+      if (s->sock == NULL || s->conn_seq != seq) {
+        /* it took the connection down, FileStartAsk resumes */
+        return -1;
+      }
+      tcp_data = s->tx.data;
+      continue;
+    }
+    if (offset < size && inflight < HDC15_FILE_WINDOW && !contended) {
+      uint32_t n = size - offset;
+      int got = read(ctx, offset, &tcp_data[HDC15_FRAME_HEADER],
+                     n < HDC15_FILE_CHUNK_SIZE ? n : HDC15_FILE_CHUNK_SIZE);
+      if (got <= 0) {
+        tr_err("file read at %u failed.", (unsigned)offset);
+        return -2;
+      }
+      int len = hd_codec_frame(tcp_data, BUFSZ, FileContentAsk, got);
+      if (len < 0) {
+        return -2;
+      }
+      if (hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
+        tr_err("Sendto failed.\n");
+        return -1;
+      }
+      offset += got;
+      inflight++;
+      continue;
+    }
+    cmd = hd_session_recv(s);
+    if (cmd != FileContentAnswer) {
+      return cmd == ErrorAnswer ? -2 : -1;
+    }
+    if (s->rx.payload.len >= 2 && hd_file_status(s) != kSuccess) {
+      hd_stats_error(hd_file_status(s));
+      tr_err("%d: file content status %d.", id, hd_file_status(s));
+      return -2;
+    }
+    inflight--;
+  }
+
+  int len = hd_codec_frame(tcp_data, BUFSZ, FileEndAsk, 0);
+  if (hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
+    return -1;
+  }
+  cmd = hd_session_recv(s);
+  if (cmd != FileEndAnswer) {
+    return cmd == ErrorAnswer ? -2 : -1;
+  }
+  if (s->rx.payload.len >= 2 && hd_file_status(s) != kSuccess) {
+    hd_stats_error(hd_file_status(s));
+    tr_err("%d: file end status %d.", id, hd_file_status(s));
+    return -2;
+  }
+  return 0;
+}
+
+/* hdc_file_upload() with s->lock held. */
+static int hd_file_upload_run(HDC15_Session *s, const char *ip,
+                              const char *name, uint16_t type, uint32_t size,
+                              const char *md5, hd_file_read_callback read,
+                              void *ctx) {
+  int id = s->id;
+  if (hd_buffer_reserve(&s->tx, BUFSZ) != 0) {
+    return -1;
+  }
+  char sum[HDC15_MD5_LENGHT + 1];
+  if (md5 == NULL) {
+    /* FileStartAsk carries the md5, so it has to be known up front */
+    if (hd_file_md5(s, size, read, ctx, sum) != 0) {
+      return -1;
+    }
+    md5 = sum;
+  }
+  for (int attempt = 0; attempt <= HDC15_FILE_RETRY; attempt++) {
+    int ret = hd_file_transfer(s, ip, name, type, size, md5, read, ctx);
+    if (ret == 0) {
+      tr_info("%d: %s %u bytes uploaded", id, name, (unsigned)size);
+      return 0;
+    }
+    /* the controller keeps what it got, the next FileStartAsk resumes */
+    hd_session_drop(s);
+    if (ret == -2) {
+      break;
+    }
+  }
+  return -1;
+}
+
+int hdc_file_upload(HDC15_Client *c, int id, const char *name, uint16_t type,
+                    uint32_t size, const char *md5, hd_file_read_callback read,
+                    void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+  if (!turn.held()) {
+    return -1;
+  }
+  return hd_file_upload_run(s, ip, name, type, size, md5, read, ctx);
+}
+
+static int hd_file_read_stdio(void *ctx, uint32_t offset, void *buf,
+                              uint32_t size) {
+  FILE *fp = (FILE *)ctx;
+  if (fseek(fp, offset, SEEK_SET) != 0) {
+    return -1;
+  }
+  return fread(buf, 1, size, fp);
+}
+
+int hdc_file_upload_path(HDC15_Client *c, int id, const char *path,
+                         const char *name, uint16_t type) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    tr_err("open %s failed.", path);
+    return -1;
+  }
+  long size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    size = ftell(fp);
+  }
+  if (size < 0) {
+    fclose(fp);
+    return -1;
+  }
+  if (name == NULL) {
+    name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  }
+  int ret =
+      hdc_file_upload(c, id, name, type, size, NULL, hd_file_read_stdio, fp);
+  fclose(fp);
+  return ret;
+}
 
-  // const int optval = 1;
-  /* set to receive broadcast packet */
-  // sock->setsockopt(SOL_SOCKET, SO_BROADCAST, &optval, sizeof(optval));
-  SocketAddress send_addr("255.255.255.255", HDC15_UDP_PORT);
-  HDC15_UdpHeader packet;
-  packet.version = (uint32_t)HDC15_LOCAL_UDP_VERSION;
-  packet.cmd = (uint16_t)SearchDeviceAsk;
-  if (sock->sendto(send_addr, (char *)&packet, 6) != 6) {
-    sock->close();
-    delete sock;
+/* ReadFileAsk: offset(8) size(4) type(2) name, NUL terminated. size 0 only
+ * asks for the size and md5 of the file. */
+static int hd_file_read_ask(HDC15_Session *s, const char *name, uint16_t type,
+                            uint64_t offset, uint32_t size) {
+  char *tcp_data = s->tx.data;
+  int len = hd_codec_read_ask(tcp_data, BUFSZ, offset, size, type, name);
+  if (len < 0) {
+    tr_err("file name too long.");
+    return -1;
+  }
+  if (hd_sock_send(s->sock, (char *)tcp_data, len) != len) {
     tr_err("Sendto failed.\n");
     return -1;
   }
-  sock->set_timeout(3000);
-
-  hd_dev.num = 0;
-  memset(&hd_dev, 0, sizeof(HDC15_Device_List));
+  return 0;
+}
 
-  for (int i = 0; i < HDC15_DEVICE_NUM; i++) {
-    HDC15_UdpResponse recv_packet;
-    /* non-blocking receive the packet back from the server. If n == -1, it
-     * failed. */
-    SocketAddress serv_addr;
-    int n = sock->recvfrom(&serv_addr, (char *)&recv_packet, 25);
-    // printf("recvfrom %s\n",(char *) &recv_packet);
-    if (n == 25) {
-      if (recv_packet.cmd == SearchDeviceAnswer) {
-        hd_dev.dev[hd_dev.num].chanege = recv_packet.chanege;
+/* Progress of a readback, kept across reconnects. */
+typedef struct HDC15_FileRead {
+  const char *name;
+  uint16_t type;
+  bool stat;                         //< size and md5 only
+  bool known;                        //< size and md5 are in
+  uint64_t size;
+  uint64_t offset;                   //< bytes delivered to write
+  char md5[HDC15_MD5_LENGHT + 1];    //< what the controller reports
+  HDC15_Md5 sum;                     //< of the bytes delivered
+  hd_file_write_callback write;
+  void *ctx;
+} HDC15_FileRead;
 
-        memcpy((char *)(hd_dev.dev[hd_dev.num].ip_addr),
-               serv_addr.get_ip_address(), NSAPI_IP_SIZE);
-        memcpy((char *)(hd_dev.dev[hd_dev.num].id), &(recv_packet.devID),
-               HDC15_MAX_DEVICE_ID_LENGHT);
-        hd_dev.dev[hd_dev.num].version = recv_packet.version;
-        tr_info("%d: %x %s %s", hd_dev.num, hd_dev.dev[hd_dev.num].version,
-               hd_dev.dev[hd_dev.num].id, hd_dev.dev[hd_dev.num].ip_addr);
-        // printf("%x .\n",hd_dev.dev[hd_dev.num].chanege);
-        hd_dev.num++;
+/* One go at the readback on the current session: up to HDC15_FILE_WINDOW
+ * chunks are asked for ahead once the size is known. Returns kSuccess when
+ * done, -1 if the connection failed (worth resuming), -2 if write stopped
+ * it, or the HDC15_ErrorCode the controller refused with. */
+static int hd_file_readback(HDC15_Session *s, const char *ip,
+                            HDC15_FileRead *r) {
+  bool reused;
+  if (hd_session_ensure(s, ip, &reused) != 0 || hd_session_drain(s) != 0) {
+    return -1;
+  }
+  uint64_t next = r->offset;
+  int inflight = 0;
+  while (true) {
+    /* give way to a more urgent call between chunks, like an upload */
+    bool contended = r->known && !r->stat && hd_session_contended(s);
+    if (contended && inflight == 0 && next < r->size) {
+      uint16_t seq = s->conn_seq;
+      hd_session_yield(s);
+      if (s->sock == NULL || s->conn_seq != seq) {
+        return -1;
+      }
+      continue;
+    }
+    while (!contended && inflight < (r->known ? HDC15_FILE_WINDOW : 1) &&
+           (!r->known || (!r->stat && next < r->size))) {
+      uint32_t n = HDC15_FILE_CHUNK_SIZE;
+      if (r->stat) {
+        n = 0;
+      } else if (r->known && r->size - next < n) {
+        n = r->size - next;
+      }
+      if (hd_file_read_ask(s, r->name, r->type, next, n) != 0) {
+        return -1;
       }
+      next += n;
+      inflight++;
+    }
+    if (inflight == 0) {
+      return kSuccess;
+    }
+    int cmd = hd_session_recv(s);
+    if (cmd == ErrorAnswer) {
+      return hd_answer_code(s);
+    }
+    uint16_t status;
+    uint64_t size;
+    char md5[HDC15_MD5_LENGHT + 1];
+    const char *data;
+    uint32_t len;
+    if (cmd != ReadFileAnswer ||
+        hd_codec_read_answer_decode(s->rx.payload.data, s->rx.payload.len,
+                                    &status, &size, md5, &data, &len) != 0) {
+      return -1;
+    }
+    inflight--;
+    if (status != kSuccess) {
+      hd_stats_error(status);
+      tr_err("%d: %s read status %d.", s->id, r->name, status);
+      return status;
+    }
+    if (!r->known) {
+      r->size = size;
+      memcpy(r->md5, md5, sizeof(r->md5));
+      r->known = true;
+    } else if (size != r->size || strcmp(r->md5, md5) != 0) {
+      tr_err("%d: %s changed while read.", s->id, r->name);
+      return kFileContentError;
+    }
+    if (r->stat) {
+      continue;
     }
+    /* every chunk but the last is full, anything else would leave the
+     * answers still in flight misaligned */
+    uint64_t left = r->size - r->offset;
+    if (len != (left < HDC15_FILE_CHUNK_SIZE ? left : HDC15_FILE_CHUNK_SIZE)) {
+      tr_err("%d: %s short read at %u.", s->id, r->name, (unsigned)r->offset);
+      return -1;
+    }
+    hd_md5_update(&r->sum, data, len);
+    if (r->write && r->write(r->ctx, r->offset, data, len) != 0) {
+      return -2;
+    }
+    r->offset += len;
   }
+}
 
-__exit:
-  sock->close();
-  delete sock;
-  return hd_dev.num;
+/* Run r to the end, resuming after lost connections. s->lock is held. */
+static int hd_file_read_run(HDC15_Session *s, const char *ip,
+                            HDC15_FileRead *r) {
+  if (hd_buffer_reserve(&s->tx, BUFSZ) != 0) {
+    return -1;
+  }
+  hd_md5_init(&r->sum);
+  for (int attempt = 0; attempt <= HDC15_FILE_RETRY; attempt++) {
+    int ret = hd_file_readback(s, ip, r);
+    if (ret >= kSuccess) {
+      return ret;
+    }
+    hd_session_drop(s);
+    if (ret == -2) {
+      break;
+    }
+  }
+  return -1;
 }
 
-static int hd_send_xml(int id, const char *xml, char *recv_data) {
-  /* Create a UDP socket. */
-  if(id >= hd_dev.num){
-      tr_err("id >= hd_dev.num.");
-        return -1;
+/* hdc_file_stat() with s->lock held. */
+static int hd_file_stat_run(HDC15_Session *s, const char *ip, const char *name,
+                            uint16_t type, uint32_t *size, char *md5) {
+  HDC15_FileRead r = {};
+  r.name = name;
+  r.type = type;
+  r.stat = true;
+  int ret = hd_file_read_run(s, ip, &r);
+  if (ret == kSuccess) {
+    if (size) {
+      *size = r.size;
+    }
+    if (md5) {
+      strlcpy(md5, r.md5, HDC15_MD5_LENGHT + 1);
+    }
   }
-  if (recv_data) {
-    memset(recv_data, 0, BUFSZ);
+  return ret;
+}
+
+int hdc_file_stat(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  uint32_t *size, char *md5) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
   }
-  TCPSocket *sock = new TCPSocket;
-  if (sock == NULL) {
-    tr_err("Create socket failed.");
+  HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+  if (!turn.held()) {
     return -1;
   }
-  NetworkInterface *net = NetworkInterface::get_default_instance();
-  sock->open(net);
+  return hd_file_stat_run(s, ip, name, type, size, md5);
+}
 
-  SocketAddress send_addr;
-  send_addr.set_port(HDC15_TCP_PORT);
-  send_addr.set_ip_address(hd_dev.dev[id].ip_addr);
-  sock->connect(send_addr);
-
-  int len = 8;
-  *(uint16_t *)&tcp_data[0] = len;
-  *(uint16_t *)&tcp_data[2] = SDKServiceAsk;
-  *(uint32_t *)&tcp_data[4] = HDC15_LOCAL_TCP_VERSION;
-  if (sock->send((char *)tcp_data, len) != len) {
-    sock->close();
-    delete sock;
-    tr_err("Sendto failed.\n");
+int hdc_file_read(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  const char *md5, hd_file_write_callback write, void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
     return -1;
   }
-  sock->set_timeout(3000);
-  memset(tcp_data, 0, BUFSZ);
-  int n = sock->recv((char *)tcp_data, BUFSZ - 1);
-  if (n != 8) {
-    sock->close();
-    delete sock;
-    tr_err("Recv failed.\n");
-    return -1;
-  }
-  int xml_len = strlen(get_ifversion_xml);
-  len = xml_len + HDC15_TCP_HEADER_LENGTH;
-  *(uint16_t *)&tcp_data[0] = len;
-  *(uint16_t *)&tcp_data[2] = SDKCmdAsk;
-  *(uint32_t *)&tcp_data[4] = xml_len;
-  *(uint32_t *)&tcp_data[8] = 0;
-  memcpy(&tcp_data[HDC15_TCP_HEADER_LENGTH], get_ifversion_xml, xml_len);
-  // printf("send %s\n",(char *) &tcp_data[HDC15_TCP_HEADER_LENGTH]);
-  if (sock->send((char *)tcp_data, len) != len) {
-    sock->close();
-    delete sock;
-    tr_err("Sendto failed.\n");
+  HDC15_FileRead r = {};
+  r.name = name;
+  r.type = type;
+  r.write = write;
+  r.ctx = ctx;
+  HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+  if (!turn.held()) {
     return -1;
   }
-
-  memset(tcp_data, 0, BUFSZ);
-  n = sock->recv((char *)tcp_data, BUFSZ - 1);
-  if (n > HDC15_TCP_HEADER_LENGTH) {
-    int total = *(uint32_t *)&tcp_data[4];
-    int index = *(uint32_t *)&tcp_data[8];
-    TiXmlDocument doc;
-    // Parse Xml.
-    doc.Parse(&tcp_data[HDC15_TCP_HEADER_LENGTH + index]);
-    const char *attr = doc.RootElement()->Attribute("guid");
-    if (attr) {
-      strlcpy(guid, attr, sizeof(guid));
-    } else {
-      sock->close();
-      delete sock;
-      tr_err("Guid failed.\n");
-      return -1;
-    }
+  int ret = hd_file_read_run(s, ip, &r);
+  if (ret != kSuccess) {
+    return ret;
   }
+  char sum[HDC15_MD5_LENGHT + 1];
+  hd_md5_hex(&r.sum, sum);
+  if (strncasecmp(sum, md5 ? md5 : r.md5, HDC15_MD5_LENGHT) != 0) {
+    tr_err("%d: %s md5 %s, expected %s.", id, name, sum, md5 ? md5 : r.md5);
+    hd_stats_error(kFileContentError);
+    return kFileContentError;
+  }
+  tr_info("%d: %s %u bytes verified", id, name, (unsigned)r.size);
+  return kSuccess;
+}
 
-  TiXmlDocument doc;
-  doc.Parse(xml);
-  TiXmlElement *element = doc.RootElement();
-  if (element)
-    element->SetAttribute("guid", (const char *)guid);
-  TiXmlPrinter printer;
-  doc.Accept(&printer);
-  const char *xml_str = printer.CStr();
-  // printf("%s\n", xml_str);
-  xml_len = strlen(xml_str);
-  len = xml_len + HDC15_TCP_HEADER_LENGTH;
-  *(uint16_t *)&tcp_data[0] = len;
-  *(uint16_t *)&tcp_data[2] = SDKCmdAsk;
-  *(uint32_t *)&tcp_data[4] = xml_len;
-  *(uint32_t *)&tcp_data[8] = 0;
-  memcpy(&tcp_data[HDC15_TCP_HEADER_LENGTH], xml_str, xml_len);
-
-  if (sock->send((char *)tcp_data, len) != len) {
-    sock->close();
-    delete sock;
-    tr_err("Sendto failed.\n");
+int hdc_file_sync(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  uint32_t size, const char *md5, hd_file_read_callback read,
+                  void *ctx) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
     return -1;
   }
-  int tcp_data_index = 0;
-  memset(tcp_data, 0, BUFSZ);
-  n = sock->recv((char *)&tcp_data[tcp_data_index], BUFSZ - 1);
-  if (n > HDC15_TCP_HEADER_LENGTH) {
-    tcp_data_index += n;
-    if (tcp_data_index >= (BUFSZ - 1)) {
-      tr_err("recv len failed %d.\n", tcp_data_index);
-      goto __exit;
-    }
+  HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+  if (!turn.held()) {
+    return -1;
   }
-  sock->set_timeout(100);
-recv:
-  n = sock->recv((char *)&tcp_data[tcp_data_index], BUFSZ - tcp_data_index - 1);
-  if (n > 0) {
-    tcp_data_index += n;
-    if (tcp_data_index >= (BUFSZ - 1)) {
-      tr_err("recv len failed %d.\n", tcp_data_index);
-      goto __exit;
-    }
-  } else {
-    int index = *(uint32_t *)&tcp_data[8];
-    if (recv_data) {
-      strlcpy(recv_data,
-              (const char *)&tcp_data[HDC15_TCP_HEADER_LENGTH + index], BUFSZ);
+  char sum[HDC15_MD5_LENGHT + 1];
+  if (md5 == NULL) {
+    if (hd_buffer_reserve(&s->tx, BUFSZ) != 0 ||
+        hd_file_md5(s, size, read, ctx, sum) != 0) {
+      return -1;
     }
-    // printf("%s\n",recv_data);
-    goto __exit;
+    md5 = sum;
   }
-  goto recv;
-__exit:
-  sock->close();
-  delete sock;
-  return 0;
+  uint32_t remote_size;
+  char remote_md5[HDC15_MD5_LENGHT + 1];
+  if (hd_file_stat_run(s, ip, name, type, &remote_size, remote_md5) ==
+          kSuccess &&
+      remote_size == size &&
+      strncasecmp(remote_md5, md5, HDC15_MD5_LENGHT) == 0) {
+    tr_info("%d: %s is up to date", id, name);
+    return 0;
+  }
+  return hd_file_upload_run(s, ip, name, type, size, md5, read, ctx);
 }
 
-static int hd_send_cmd(int id, const char *cmd, char *recv_data) {
- if(id >= hd_dev.num){
-      tr_err("id >= hd_dev.num.");
-        return -1;
+HDC15_Client *hdc_new(void) {
+  return new (std::nothrow) HDC15_Client();
+}
+
+static void hd_queue_mark(Semaphore *done) {
+  done->release();
+}
+
+/* Wait until every event queued on q so far has run. */
+static void hd_queue_drain(EventQueue *q) {
+  Semaphore done;
+  if (q->call(hd_queue_mark, &done)) {
+    done.acquire();
+  }
+}
+
+/* Events are posted from the sigio callback and re-armed by the events
+ * themselves, and cancel() does not wait for one that is running. So nothing
+ * is posted once closing is set, and the queues are drained around the
+ * cancels before the sockets are closed under each device's lock. */
+void hdc_free(HDC15_Client *c) {
+  if (c == NULL || c == &hd_client) {
+    return;
   }
-  TiXmlDocument doc;
-  doc.Parse(cmd_xml);
-  TiXmlElement *child = doc.RootElement();
-  if (child) {
-    TiXmlElement *child_next = child->FirstChildElement("in");
-    if (child_next) {
-      child_next->SetAttribute("method", cmd);
+  hdc_registry_stop(c);
+  core_util_atomic_store_bool(&c->closing, true);
+  for (int pass = 0; pass < 2; pass++) {
+    hd_keepalive_queue(c)->cancel(c->keepalive_event);
+    hd_keepalive_queue(c)->cancel(c->keepalive_check);
+    for (int id = 0; id < c->dev.num; id++) {
+      HDC15_Session *s = c->session[id];
+      hd_client_queue(c)->cancel(s->nb_event);
+      hd_client_queue(c)->cancel(s->nb_timer);
+      hd_client_queue(c)->cancel(s->health_event);
     }
+    hd_queue_drain(hd_client_queue(c));
+    hd_queue_drain(hd_keepalive_queue(c));
   }
-  TiXmlPrinter printer;
-  doc.Accept(&printer);
-  hd_send_xml(id, (const char *)(printer.CStr()), recv_data);
-  if (recv_data) {
-    return strlen((const char *)recv_data);
-  } else {
-    return 0;
+  for (int id = 0; id < c->dev.num; id++) {
+    HDC15_Session *s = c->session[id];
+    s->lock.lock();
+    hd_session_drop(s);
+    hd_nb_fail_queued(s);
+    s->lock.unlock();
+    hd_frame_free(&s->rx);
+    hd_buffer_free(&s->tx);
+    free(s->screen);
+    delete s;
   }
+  hd_buffer_free(&c->group_xml);
+  free(c->group);
+  free(c->session);
+  free(c->dev.dev);
+  free(c->hash);
+  delete c;
 }
 
-int hd_get_guid(int id) {
-     if(id >= hd_dev.num){
-      tr_err("id >= hd_dev.num.");
-        return -1;
+HDC15_Client *hdc_default(void) {
+  return &hd_client;
+}
+
+/* Saved state: magic(4) format(2) screen codec(2) devices(2), then per
+ * device id(15) ip(NUL terminated) version(4) chanege(4) session version(4)
+ * guid(33) screen length(2) and the screen model as hd_screen_encode()
+ * writes it (length 0: none). A model of another HDC15_SCREEN_CODEC is
+ * skipped. */
+#define HD_STATE_MAGIC   0x53434448    //< "HDCS"
+#define HD_STATE_FORMAT  2
+#define HD_STATE_HEADER  10
+
+/* The state is put together on the heap, not in pool buffers: a record
+ * holds a whole screen model, more than HDC15_POOL_BLOCK_SIZE. Freed with
+ * free(). */
+static int hd_state_reserve(HDC15_Buffer *buf, uint32_t cap) {
+  if (cap <= buf->cap) {
+    return 0;
   }
-  int n = hd_send_cmd(id, "GetProgram", recv_xml);
-  if (n) {
-    //printf("%s\n",recv_xml);
-    TiXmlDocument doc;
-    doc.Parse(recv_xml);
-    TiXmlHandle docHandle(&doc);
-    hd_program_guid[id].num = 0;
-    int i = 0;
-    while (true) {
-      TiXmlElement *child = docHandle.FirstChild("sdk")
-                                .FirstChild("out")
-                                .FirstChild("screen")
-                                .Child("program", i)
-                                .ToElement();
-      if (!child) {
-        break;
-      }
-      // do something
-      const char *attr = child->Attribute("guid");
-      if (attr) {
-        strlcpy(hd_program_guid[id].program[i].guid, attr, HDC15_MAX_PROGRAM_GUID_LENGHT);
-        tr_info("%d %s", hd_program_guid[id].num, hd_program_guid[id].program[i].guid);
-        hd_program_guid[id].num++;
-        if (hd_program_guid[id].num >= HDC15_PROGRAM_GUID_NUM) {
-          break;
-        }
-      }
-      i++;
-    }
+  char *data = (char *)realloc(buf->data, cap);
+  if (data == NULL) {
+    tr_err("state buffer %u failed.", (unsigned)cap);
+    return -1;
   }
-  return hd_program_guid[id].num;
+  buf->data = data;
+  buf->cap = cap;
+  return 0;
 }
 
-int hd_playcontrol(int id, int guid, bool en) {
-    if(id >= hd_dev.num){
-      tr_err("id >= hd_dev.num.");
-        return -1;
+#if HDC15_STATE_KVSTORE
+static int hd_state_write(const char *key, const void *data, uint32_t len) {
+  return kv_set(key, data, len, 0) == MBED_SUCCESS ? 0 : -1;
+}
+
+static int hd_state_read(const char *key, HDC15_Buffer *buf) {
+  kv_info_t info;
+  size_t got = 0;
+  if (kv_get_info(key, &info) != MBED_SUCCESS ||
+      hd_state_reserve(buf, info.size) != 0 ||
+      kv_get(key, buf->data, info.size, &got) != MBED_SUCCESS) {
+    return -1;
   }
-  if(guid >= hd_program_guid[id].num){
-      tr_err("guid >= hd_program_guid[id].num.");
-        return -1;
+  buf->len = got;
+  return 0;
+}
+#else
+/* Written to a temporary file first, so a reset while saving leaves the
+ * previous state intact. */
+static int hd_state_write(const char *key, const void *data, uint32_t len) {
+  char tmp[128];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", key) >= (int)sizeof(tmp)) {
+    return -1;
+  }
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    return -1;
   }
-  TiXmlDocument doc;
-  doc.Parse(playcontrol_xml);
-  TiXmlHandle docHandle(&doc);
-  // TiXmlElement* child = doc.RootElement();
+  bool ok = fwrite(data, 1, len, fp) == len;
+  if (fclose(fp) != 0 || !ok) {
+    remove(tmp);
+    return -1;
+  }
+  remove(key);
+  return rename(tmp, key) == 0 ? 0 : -1;
+}
 
-  TiXmlElement *child_program = docHandle.FirstChild("sdk")
-                                    .FirstChild("in")
-                                    .FirstChild("screen")
-                                    .FirstChild("program")
-                                    .ToElement();
-  if (child_program) {
-    child_program->SetAttribute("guid", hd_program_guid[id].program[guid].guid);
+static int hd_state_read(const char *key, HDC15_Buffer *buf) {
+  FILE *fp = fopen(key, "rb");
+  if (fp == NULL) {
+    return -1;
   }
-  TiXmlElement *child_playControl =
-      child_program->FirstChildElement("playControl");
-  if (child_playControl) {
-    if (en) {
-      child_playControl->SetAttribute("disabled", "false");
-    } else {
-      child_playControl->SetAttribute("disabled", "true");
+  buf->len = 0;
+  while (true) {
+    if (hd_state_reserve(buf, buf->len + 512) != 0) {
+      fclose(fp);
+      return -1;
+    }
+    size_t n = fread(buf->data + buf->len, 1, buf->cap - buf->len, fp);
+    buf->len += n;
+    if (n == 0) {
+      break;
     }
   }
-
-  TiXmlPrinter printer;
-  doc.Accept(&printer);
-  // printf("%s\n",printer.CStr());
-  hd_send_xml(id, (const char *)(printer.CStr()), NULL);
+  fclose(fp);
   return 0;
 }
+#endif
 
-int hd_textcontrol(int id, int guid, bool en, const char *text_string) {
-     if(id >= hd_dev.num){
-      tr_err("id >= hd_dev.num.");
-        return -1;
+int hdc_state_save(HDC15_Client *c, const char *key) {
+  HDC15_Buffer buf = {};
+  HDC15_Codec k;
+  int num = 0;
+  c->mutex.lock();
+  int total = c->dev.num;
+  c->mutex.unlock();
+  /* the size of a record is bounded, the buffer grows device by device */
+  uint32_t record = HDC15_MAX_DEVICE_ID_LENGHT + NSAPI_IP_SIZE + 12 +
+                    HDC15_GUID_SIZE + 2 + HDC15_SCREEN_KINDS +
+                    sizeof(HDC15_Screen);
+  for (int id = 0; id <= total; id++) {
+    if (hd_state_reserve(&buf, HD_STATE_HEADER + (id + 1) * record) != 0) {
+      free(buf.data);
+      return -1;
+    }
+    hd_codec_init(&k, buf.data, buf.cap);
+    k.pos = buf.len;
+    if (id == 0) {
+      hd_codec_put<uint32_t>(&k, HD_STATE_MAGIC);
+      hd_codec_put<uint16_t>(&k, HD_STATE_FORMAT);
+      hd_codec_put<uint16_t>(&k, HDC15_SCREEN_CODEC);
+      hd_codec_put<uint16_t>(&k, 0);
+    }
+    if (id == total) {
+      buf.len = k.pos;
+      break;
+    }
+    HDC15_Device dev;
+    HDC15_Session *s = hd_client_session(c, id, NULL);
+    if (hdc_device_get(c, id, &dev) != 0 || s == NULL) {
+      buf.len = k.pos;
+      continue;
+    }
+    HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+    if (!turn.held()) {
+      buf.len = k.pos;
+      continue;
+    }
+    hd_codec_put_bytes(&k, dev.id, HDC15_MAX_DEVICE_ID_LENGHT);
+    hd_codec_put_bytes(&k, dev.ip_addr, strlen(dev.ip_addr) + 1);
+    hd_codec_put<uint32_t>(&k, dev.version);
+    hd_codec_put<uint32_t>(&k, dev.chanege);
+    hd_codec_put<uint32_t>(&k, s->version);
+    hd_codec_put_bytes(&k, s->guid, HDC15_GUID_SIZE);
+    uint32_t at = k.pos;
+    hd_codec_put<uint16_t>(&k, 0);
+    if (s->screen && s->screen->valid) {
+      hd_screen_encode(&k, s->screen);
+      if (!k.error && k.pos - at - 2 <= UINT16_MAX) {
+        hd_le_put<uint16_t>(k.data + at, k.pos - at - 2);
+      } else {
+        /* saved without it, GetProgram fetches it again */
+        tr_warn("%d: screen model not saved.", id);
+        k.error = false;
+        k.pos = at + 2;
+      }
+    }
+    buf.len = k.pos;
+    num++;
   }
-  if(guid >= hd_program_guid[id].num){
-      tr_err("guid >= hd_program_guid[id].num.");
-        return -1;
+  hd_le_put<uint16_t>(buf.data + HD_STATE_HEADER - 2, num);
+  int ret = hd_state_write(key ? key : HDC15_STATE_KEY, buf.data, buf.len);
+  if (ret != 0) {
+    tr_err("state save failed.");
+  } else {
+    tr_info("state of %d devices saved, %u bytes", num, (unsigned)buf.len);
+  }
+  free(buf.data);
+  return ret;
+}
+
+int hdc_state_load(HDC15_Client *c, const char *key) {
+  HDC15_Buffer buf = {};
+  if (hd_state_read(key ? key : HDC15_STATE_KEY, &buf) != 0) {
+    free(buf.data);
+    return -1;
+  }
+  HDC15_Codec k;
+  hd_codec_init(&k, buf.data, buf.len);
+  uint32_t magic = hd_codec_get<uint32_t>(&k);
+  uint16_t format = hd_codec_get<uint16_t>(&k);
+  uint16_t screen_codec = hd_codec_get<uint16_t>(&k);
+  int num = hd_codec_get<uint16_t>(&k);
+  if (k.error || magic != HD_STATE_MAGIC || format != HD_STATE_FORMAT) {
+    tr_err("state %s failed.", key ? key : HDC15_STATE_KEY);
+    free(buf.data);
+    return -1;
   }
-  TiXmlDocument doc;
-  doc.Parse(add_program_xml);
-  TiXmlHandle docHandle(&doc);
-  // TiXmlElement* child = doc.RootElement();
-
-  TiXmlElement *child_program = docHandle.FirstChild("sdk")
-                                    .FirstChild("in")
-                                    .FirstChild("screen")
-                                    .FirstChild("program")
-                                    .ToElement();
-  if (child_program) {
-    child_program->SetAttribute("guid", hd_program_guid[id].program[guid].guid);
-    TiXmlElement *child_playControl =
-        child_program->FirstChildElement("playControl");
-    if (child_playControl) {
-      if (en) {
-        child_playControl->SetAttribute("disabled", "false");
+  int loaded = 0;
+  for (int i = 0; i < num; i++) {
+    HDC15_UdpResponse ans = {};
+    ans.cmd = SearchDeviceAnswer;
+    hd_codec_get_bytes(&k, ans.devID, HDC15_MAX_DEVICE_ID_LENGHT);
+    const char *ip = (const char *)k.data + k.pos;
+    uint32_t ip_len = strnlen(ip, k.cap - k.pos) + 1;
+    hd_codec_take(&k, ip_len > NSAPI_IP_SIZE ? k.cap + 1 : ip_len);
+    ans.version = hd_codec_get<uint32_t>(&k);
+    ans.chanege = hd_codec_get<uint32_t>(&k);
+    uint32_t version = hd_codec_get<uint32_t>(&k);
+    const char *guid = (const char *)hd_codec_take(&k, HDC15_GUID_SIZE);
+    uint16_t screen_len = hd_codec_get<uint16_t>(&k);
+    uint8_t *screen = hd_codec_take(&k, screen_len);
+    if (k.error) {
+      tr_err("state truncated at device %d.", i);
+      break;
+    }
+    int id = ip[0] ? hd_registry_update(c, &ans, ip) : -1;
+    HDC15_Session *s = id >= 0 ? hd_client_session(c, id, NULL) : NULL;
+    if (s == NULL) {
+      continue;
+    }
+    HDC15_SessionTurn turn(s, HDC15_PRIO_BULK);
+    if (!turn.held() || s->state != HD_SESSION_CLOSED) {
+      /* already talking to it, what it negotiated is newer */
+      continue;
+    }
+    if (guid[0] && memchr(guid, '\0', HDC15_GUID_SIZE)) {
+      s->version = version;
+      strlcpy(s->guid, guid, sizeof(s->guid));
+      s->resume = true;
+    }
+    /* a model of another layout or one that does not fit is left to
+     * GetProgram */
+    if (screen_len && screen_codec == HDC15_SCREEN_CODEC) {
+      HDC15_Screen *model = (HDC15_Screen *)malloc(sizeof(HDC15_Screen));
+      HDC15_Codec m;
+      hd_codec_init(&m, screen, screen_len);
+      if (model && hd_screen_decode(&m, model) == 0 && m.pos == screen_len) {
+        model->valid = true;
+        free(s->screen);
+        s->screen = model;
       } else {
-        child_playControl->SetAttribute("disabled", "true");
+        tr_warn("%d: saved screen model dropped.", id);
+        free(model);
       }
     }
-    TiXmlElement *child_string = child_program->FirstChildElement("area")
-                                     ->FirstChildElement("resources")
-                                     ->FirstChildElement("text")
-                                     ->FirstChildElement("string");
-    if (child_string) {
-      TiXmlNode *child_node = child_string->FirstChild();
-      TiXmlText *childText = child_node->ToText();
-      childText->SetValue(text_string);
-      // printf("child_string %s\n",childText->Value());
-    }
+    loaded++;
   }
+  free(buf.data);
+  tr_info("state of %d devices restored", loaded);
+  return loaded;
+}
 
-  TiXmlPrinter printer;
-  doc.Accept(&printer);
-  // printf("%s\n",printer.CStr());
-  hd_send_xml(id, (const char *)(printer.CStr()), NULL);
-  return 0;
+/* The hd_* API runs on the default client. */
+
+int hd_scan(void) {
+  return hdc_scan(&hd_client);
+}
+
+int hd_discover(uint32_t timeout_ms, int expect) {
+  return hdc_discover(&hd_client, timeout_ms, expect);
+}
+
+int hd_registry_start(uint32_t period_ms, hd_device_callback cb, void *ctx) {
+  return hdc_registry_start(&hd_client, period_ms, cb, ctx);
+}
+
+void hd_registry_stop(void) {
+  hdc_registry_stop(&hd_client);
+}
+
+int hd_registry_refresh(void) {
+  return hdc_registry_refresh(&hd_client);
+}
+
+int hd_device_find(const char *dev_id) {
+  return hdc_device_find(&hd_client, dev_id);
+}
+
+int hd_device_get(int id, HDC15_Device *dev) {
+  return hdc_device_get(&hd_client, id, dev);
+}
+
+int hd_get_guid(int id) {
+  return hdc_get_guid(&hd_client, id);
+}
+
+int hd_screen_get(int id, HDC15_Screen *screen) {
+  return hdc_screen_get(&hd_client, id, screen);
+}
+
+int hd_screen_find(int id, int kind, const char *key) {
+  return hdc_screen_find(&hd_client, id, kind, key);
+}
+
+void hd_screen_invalidate(int id) {
+  hdc_screen_invalidate(&hd_client, id);
+}
+
+int hd_resource_text(int id, int res, const char *text_string) {
+  return hdc_resource_text(&hd_client, id, res, text_string);
+}
+
+int hd_textcontrol(int id, int guid, bool en, const char *text_string) {
+  return hdc_textcontrol(&hd_client, id, guid, en, text_string);
+}
+
+int hd_playcontrol(int id, int guid, bool en) {
+  return hdc_playcontrol(&hd_client, id, guid, en);
+}
+
+int hd_program_update(int id, int guid, int play, const char *text_string) {
+  return hdc_program_update(&hd_client, id, guid, play, text_string);
+}
+
+HDC15_Batch *hd_batch_new(int id) {
+  return hdc_batch_new(&hd_client, id);
+}
+
+int hd_session_close(int id) {
+  return hdc_session_close(&hd_client, id);
+}
+
+void hd_keepalive(void) {
+  hdc_keepalive(&hd_client);
+}
+
+int hd_set_window(int window) {
+  return hdc_set_window(&hd_client, window);
+}
+
+int hd_textcontrol_async(int id, int guid, bool en, const char *text_string,
+                         hd_cmd_callback cb, void *ctx) {
+  return hdc_textcontrol_async(&hd_client, id, guid, en, text_string, cb, ctx);
+}
+
+int hd_playcontrol_async(int id, int guid, bool en, hd_cmd_callback cb,
+                         void *ctx) {
+  return hdc_playcontrol_async(&hd_client, id, guid, en, cb, ctx);
+}
+
+int hd_flush(int id) {
+  return hdc_flush(&hd_client, id);
+}
+
+void hd_set_text_decoder(hd_text_decode_callback dec) {
+  hd_xml_set_decoder(dec);
+}
+
+int hd_set_deadline(int prio, uint32_t ms) {
+  return hdc_set_deadline(&hd_client, prio, ms);
+}
+
+int hd_health_get(int id, HDC15_HealthInfo *info) {
+  return hdc_health_get(&hd_client, id, info);
+}
+
+int hd_sched_depth(int id, int prio) {
+  return hdc_sched_depth(&hd_client, id, prio);
+}
+
+int hd_cmd_nb(int id, const char *cmd, hd_cmd_callback cb, void *ctx) {
+  return hdc_cmd_nb(&hd_client, id, cmd, cb, ctx);
+}
+
+int hd_playcontrol_nb(int id, int guid, bool en, hd_cmd_callback cb,
+                      void *ctx) {
+  return hdc_playcontrol_nb(&hd_client, id, guid, en, cb, ctx);
+}
+
+int hd_textcontrol_nb(int id, int guid, bool en, const char *text_string,
+                      hd_cmd_callback cb, void *ctx) {
+  return hdc_textcontrol_nb(&hd_client, id, guid, en, text_string, cb, ctx);
+}
+
+int hd_program_update_nb(int id, int guid, int play, const char *text_string,
+                         hd_cmd_callback cb, void *ctx) {
+  return hdc_program_update_nb(&hd_client, id, guid, play, text_string, cb,
+                               ctx);
+}
+
+int hd_set_stage_timeout(int stage, uint32_t ms) {
+  return hdc_set_stage_timeout(&hd_client, stage, ms);
+}
+
+int hd_group_textcontrol(const int *ids, int num, int guid, bool en,
+                         const char *text_string, int *results) {
+  return hdc_group_textcontrol(&hd_client, ids, num, guid, en, text_string,
+                               results);
+}
+
+int hd_group_playcontrol(const int *ids, int num, int guid, bool en,
+                         int *results) {
+  return hdc_group_playcontrol(&hd_client, ids, num, guid, en, results);
+}
+
+int hd_file_upload(int id, const char *name, uint16_t type, uint32_t size,
+                   const char *md5, hd_file_read_callback read, void *ctx) {
+  return hdc_file_upload(&hd_client, id, name, type, size, md5, read, ctx);
+}
+
+int hd_file_upload_path(int id, const char *path, const char *name,
+                        uint16_t type) {
+  return hdc_file_upload_path(&hd_client, id, path, name, type);
+}
+
+int hd_file_stat(int id, const char *name, uint16_t type, uint32_t *size,
+                 char *md5) {
+  return hdc_file_stat(&hd_client, id, name, type, size, md5);
+}
+
+int hd_file_read(int id, const char *name, uint16_t type, const char *md5,
+                 hd_file_write_callback write, void *ctx) {
+  return hdc_file_read(&hd_client, id, name, type, md5, write, ctx);
+}
+
+int hd_file_sync(int id, const char *name, uint16_t type, uint32_t size,
+                 const char *md5, hd_file_read_callback read, void *ctx) {
+  return hdc_file_sync(&hd_client, id, name, type, size, md5, read, ctx);
+}
+
+int hd_state_save(const char *key) {
+  return hdc_state_save(&hd_client, key);
+}
+
+int hd_state_load(const char *key) {
+  return hdc_state_load(&hd_client, key);
 }
 
 #ifdef MBED_USER_ONEOS
@@ -454,22 +3989,57 @@ static void hd_test(int argc, char **argv) {
   }
   int id = atoi(argv[1]);
   int num = atoi(argv[2]);
-  int dev_num = hd_scan();
-  if (dev_num && ((id < dev_num) && (id >= 0))) {
-    hd_send_xml(id, add_program_xml, NULL);
+  if (hd_device_get(id, NULL) != 0) {
+    hd_scan();
+  }
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_device_get(id, NULL) == 0
+                         ? hd_client_session(&hd_client, id, ip)
+                         : NULL;
+  if (s) {
+    const char *values[HDC15_SLOT_NUM] = {};
+    values[HDC15_SLOT_PROGRAM] = "d0014343-5c25-4719-af95-2eccf2e74550";
+    values[HDC15_SLOT_EN] = "true";
+    values[HDC15_SLOT_STR] = "欢迎光临";
+    {
+      HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+      if (turn.held()) {
+        hd_send_xml(s, ip, &add_program_tpl, values, NULL);
+      }
+    }
     int n = hd_get_guid(id);
-    if (n == 2) {
-      hd_playcontrol(id, 0, false);
+    HDC15_Batch *b = n >= 2 ? hd_batch_new(id) : NULL;
+    if (b) {
+      /* each switch goes out as one UpdateProgram */
       char text_string[64];
       sprintf(text_string, "恭喜%d号机中奖啦！", num);
-      hd_textcontrol(id, 1, true,
-                     text_string);
+      hd_batch_play(b, 0, false);
+      hd_batch_text(b, 1, text_string);
+      hd_batch_play(b, 1, true);
+      hd_batch_commit(b);
       ThisThread::sleep_for(5s);
-      hd_playcontrol(id, 1, false);
-      hd_playcontrol(id, 0, true);
+      hd_batch_clear(b);
+      hd_batch_play(b, 1, false);
+      hd_batch_play(b, 0, true);
+      hd_batch_commit(b);
+      hd_batch_free(b);
     }
   }
 }
+static int hd_send_cmd(HDC15_Client *c, int id, const char *cmd) {
+  char ip[NSAPI_IP_SIZE];
+  HDC15_Session *s = hd_client_session(c, id, ip);
+  if (s == NULL) {
+    return -1;
+  }
+  const char *values[HDC15_SLOT_NUM] = {};
+  values[HDC15_SLOT_CMD] = cmd;
+  HDC15_SessionTurn turn(s, HDC15_PRIO_NORMAL);
+  if (!turn.held()) {
+    return -1;
+  }
+  return hd_send_xml(s, ip, &cmd_tpl, values, NULL);
+}
 static void hd_cmd(int argc, char **argv) {
   if (argc < 3) {
     printf("Please input: hd_cmd <id> <cmd>\n");
@@ -477,14 +4047,78 @@ static void hd_cmd(int argc, char **argv) {
   }
 
   int id = atoi(argv[1]);
-  int dev_num = hd_scan();
-  if (dev_num && ((id < dev_num) && (id >= 0))) {
-    hd_send_cmd(id, argv[2], NULL);
+  if (hd_device_get(id, NULL) != 0) {
+    hd_scan();
+  }
+  if (hd_device_get(id, NULL) == 0) {
+    int code = hd_send_cmd(&hd_client, id, argv[2]);
+    printf("%s\n", code < 0 ? "no answer" : hd_error_name(code));
   }
 }
 SH_CMD_EXPORT(hd_test, hd_test, "hd_test <id> <num>");
 SH_CMD_EXPORT(hd_scan, hd_scan, "get device list");
+static void hd_upload(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Please input: hd_upload <id> <path> [type]\n");
+    return;
+  }
+  int id = atoi(argv[1]);
+  if (hd_device_get(id, NULL) != 0) {
+    hd_scan();
+  }
+  int ret = hd_file_upload_path(id, argv[2], NULL,
+                                argc > 3 ? atoi(argv[3]) : kImageFile);
+  printf("upload %s\n", ret == 0 ? "ok" : "failed");
+}
+
+static void hd_readback(int argc, char **argv) {
+  if (argc < 3) {
+    printf("Please input: hd_readback <id> <name> [type] [md5]\n");
+    return;
+  }
+  int id = atoi(argv[1]);
+  if (hd_device_get(id, NULL) != 0) {
+    hd_scan();
+  }
+  int ret = hd_file_read(id, argv[2], argc > 3 ? atoi(argv[3]) : kImageFile,
+                         argc > 4 ? argv[4] : NULL, NULL, NULL);
+  printf("readback %s\n", ret < 0 ? "failed" : hd_error_name(ret));
+}
 SH_CMD_EXPORT(hd_cmd, hd_cmd, "hd_cmd <id> <cmd>");
+SH_CMD_EXPORT(hd_upload, hd_upload, "hd_upload <id> <path> [type]");
+SH_CMD_EXPORT(hd_readback, hd_readback, "hd_readback <id> <name> [type] [md5]");
+
+static void hd_state(int argc, char **argv) {
+  if (argc < 2 || (strcmp(argv[1], "save") != 0 && strcmp(argv[1], "load"))) {
+    printf("Please input: hd_state <save|load> [key]\n");
+    return;
+  }
+  const char *key = argc > 2 ? argv[2] : NULL;
+  int ret = strcmp(argv[1], "save") == 0 ? hd_state_save(key)
+                                          : hd_state_load(key);
+  printf("state %s %s\n", argv[1], ret < 0 ? "failed" : "ok");
+}
+SH_CMD_EXPORT(hd_state, hd_state, "hd_state <save|load> [key]");
+
+static void hd_health(int argc, char **argv) {
+  static const char *const names[] = {"unknown", "ok", "degraded", "offline"};
+  printf("%-3s %-8s %5s %8s %8s %8s %8s\n", "id", "state", "fails",
+         "rtt_ms", "var_ms", "ans_ms", "tmo_ms");
+  hd_client.mutex.lock();
+  int num = hd_client.dev.num;
+  hd_client.mutex.unlock();
+  for (int id = 0; id < num; id++) {
+    HDC15_HealthInfo h;
+    if ((argc > 1 && id != atoi(argv[1])) || hd_health_get(id, &h) != 0) {
+      continue;
+    }
+    printf("%-3d %-8s %5u %8u %8u %8u %8u\n", id, names[h.state],
+           (unsigned)h.failures, (unsigned)h.srtt_ms, (unsigned)h.rttvar_ms,
+           (unsigned)h.answer_ms,
+           (unsigned)h.timeout_ms[HDC15_STAGE_ANSWER]);
+  }
+}
+SH_CMD_EXPORT(hd_health, hd_health, "hd_health [id]");
 #endif
 
 #endif
\ No newline at end of file
@@ -40,13 +40,158 @@
 /* NTP receive timeout(S) */
 #define HDC15_UDP_GET_TIMEOUT                5
 
+/* initial size of the device registry, it grows up to HDC15_DEVICE_MAX */
 #define HDC15_DEVICE_NUM  1
-#define HDC15_PROGRAM_GUID_NUM  2
+#ifndef HDC15_DEVICE_MAX
+#define HDC15_DEVICE_MAX  256
+#endif
+/* capacity of the cached screen model of a device */
+#ifndef HDC15_SCREEN_PROGRAMS
+#define HDC15_SCREEN_PROGRAMS   8
+#endif
+#ifndef HDC15_SCREEN_AREAS
+#define HDC15_SCREEN_AREAS      16
+#endif
+#ifndef HDC15_SCREEN_RESOURCES
+#define HDC15_SCREEN_RESOURCES  32
+#endif
+#define HDC15_SCREEN_NAME       24
+/* changes one hd_batch_* transaction can collect */
+#ifndef HDC15_BATCH_OPS
+#define HDC15_BATCH_OPS         16
+#endif
 
 #define HDC15_GUID_SIZE  33
 
 #define HDC15_TCP_HEADER_LENGTH   12
 
+/* SearchDeviceAsk destination and how long hd_scan() collects answers(ms) */
+#ifndef HDC15_UDP_SCAN_ADDR
+#define HDC15_UDP_SCAN_ADDR       "255.255.255.255"
+#endif
+#ifndef HDC15_SCAN_TIMEOUT_MS
+#define HDC15_SCAN_TIMEOUT_MS     3000
+#endif
+
+/* registry thread: default rescan period(ms), rescans a device may miss
+ * before it is removed, and thread stack size */
+#ifndef HDC15_REGISTRY_PERIOD_MS
+#define HDC15_REGISTRY_PERIOD_MS  30000
+#endif
+#ifndef HDC15_DEVICE_EXPIRE_SCANS
+#define HDC15_DEVICE_EXPIRE_SCANS 3
+#endif
+#ifndef HDC15_REGISTRY_STACK_SIZE
+#define HDC15_REGISTRY_STACK_SIZE 4096
+#endif
+
+/* TCP send/receive timeout(ms) */
+#ifndef HDC15_TCP_TIMEOUT_MS
+#define HDC15_TCP_TIMEOUT_MS      3000
+#endif
+/* FileContentAsk payload size and how many may be in flight */
+#ifndef HDC15_FILE_CHUNK_SIZE
+#define HDC15_FILE_CHUNK_SIZE     1024
+#endif
+#ifndef HDC15_FILE_WINDOW
+#define HDC15_FILE_WINDOW         4
+#endif
+/* reconnects an upload may make, resuming where the controller left off */
+#ifndef HDC15_FILE_RETRY
+#define HDC15_FILE_RETRY          3
+#endif
+
+/* how long(ms) a group command waits for all of its devices */
+#ifndef HDC15_GROUP_TIMEOUT_MS
+#define HDC15_GROUP_TIMEOUT_MS    (2 * HDC15_TCP_TIMEOUT_MS)
+#endif
+/* idle time(ms) after which an open session sends TcpHeartbeatAsk */
+#ifndef HDC15_TCP_HEARTBEAT_MS
+#define HDC15_TCP_HEARTBEAT_MS    10000
+#endif
+/* health monitor: bounds(ms) of the time limits derived from the round trip
+ * measured to a device, the least an answer is waited for, and the smoothed
+ * round trip above which a device counts as degraded */
+#ifndef HDC15_RTO_MIN_MS
+#define HDC15_RTO_MIN_MS          200
+#endif
+#ifndef HDC15_RTO_MAX_MS
+#define HDC15_RTO_MAX_MS          (2 * HDC15_TCP_TIMEOUT_MS)
+#endif
+#ifndef HDC15_ANSWER_MIN_MS
+#define HDC15_ANSWER_MIN_MS       1000
+#endif
+#ifndef HDC15_HEALTH_DEGRADED_MS
+#define HDC15_HEALTH_DEGRADED_MS  500
+#endif
+/* timeouts in a row after which a device is offline, and how long(ms) calls
+ * for it then fail at once before one may try to reach it again */
+#ifndef HDC15_HEALTH_OFFLINE_FAILS
+#define HDC15_HEALTH_OFFLINE_FAILS 3
+#endif
+#ifndef HDC15_HEALTH_RETRY_MS
+#define HDC15_HEALTH_RETRY_MS     (2 * HDC15_TCP_HEARTBEAT_MS)
+#endif
+/* async SDKCmdAsk requests a device can have in flight */
+#ifndef HDC15_CMD_QUEUE_NUM
+#define HDC15_CMD_QUEUE_NUM       8
+#endif
+/* attempts a command gets when the controller answers with an error its
+ * HDC15_RetryPolicy allows to retry, and the pause(ms) before the first
+ * retry on a busy controller, doubled up to HDC15_CMD_BACKOFF_MAX_MS */
+#ifndef HDC15_CMD_RETRY
+#define HDC15_CMD_RETRY           3
+#endif
+#ifndef HDC15_CMD_BACKOFF_MS
+#define HDC15_CMD_BACKOFF_MS      200
+#endif
+#ifndef HDC15_CMD_BACKOFF_MAX_MS
+#define HDC15_CMD_BACKOFF_MAX_MS  2000
+#endif
+/* default in-flight window, see hd_set_window() */
+#ifndef HDC15_CMD_WINDOW
+#define HDC15_CMD_WINDOW          4
+#endif
+
+/* non-blocking requests (hd_*_nb) a device can have queued, how long(ms)
+ * each stage of a connection may take, and how soon(ms) the driver looks
+ * again at a device a blocking call is using */
+#ifndef HDC15_NB_QUEUE_NUM
+#define HDC15_NB_QUEUE_NUM        16
+#endif
+#ifndef HDC15_NB_CONNECT_MS
+#define HDC15_NB_CONNECT_MS       HDC15_TCP_TIMEOUT_MS
+#endif
+#ifndef HDC15_NB_SERVICE_MS
+#define HDC15_NB_SERVICE_MS       HDC15_TCP_TIMEOUT_MS
+#endif
+#ifndef HDC15_NB_GUID_MS
+#define HDC15_NB_GUID_MS          HDC15_TCP_TIMEOUT_MS
+#endif
+#ifndef HDC15_NB_ANSWER_MS
+#define HDC15_NB_ANSWER_MS        HDC15_TCP_TIMEOUT_MS
+#endif
+#ifndef HDC15_NB_RETRY_MS
+#define HDC15_NB_RETRY_MS         20
+#endif
+
+/* where hd_state_save() keeps the registry: a KVStore key (kv_set) when
+ * HDC15_STATE_KVSTORE is set, a file path otherwise */
+#ifndef HDC15_STATE_KVSTORE
+#ifdef MBED_CONF_STORAGE_STORAGE_TYPE
+#define HDC15_STATE_KVSTORE       1
+#else
+#define HDC15_STATE_KVSTORE       0
+#endif
+#endif
+#ifndef HDC15_STATE_KEY
+#if HDC15_STATE_KVSTORE
+#define HDC15_STATE_KEY           "/kv/hdc15_state"
+#else
+#define HDC15_STATE_KEY           "hdc15_state.bin"
+#endif
+#endif
+
 enum HDC15_CmdType
 {
     Unknown = -1,
@@ -70,6 +215,14 @@ enum HDC15_CmdType
 
 };
 
+enum HDC15_FileType
+{
+    kImageFile = 0,         //< 图片
+    kVideoFile = 1,         //< 视频
+    kFontFile = 2,          //< 字体
+    kFirmwareFile = 3,      //< 固件
+};
+
 enum HDC15_ErrorCode
 {
     kUnknown = -1,
@@ -148,34 +301,354 @@ typedef struct HDC15_Device
     uint32_t version;                        //< 版本号
     uint32_t  chanege;                         //< 扩展数据起始地址
     uint8_t   id[HDC15_MAX_DEVICE_ID_LENGHT];    //< 设备ID
+    uint32_t  seen_ms;                         //< 最近一次应答搜索的时间
 } HDC15_Device;
 
-typedef struct HDC15_Program_Guid
+enum HDC15_ScreenKind
 {
-    char guid[HDC15_MAX_PROGRAM_GUID_LENGHT];
-} HDC15_Program_Guid;
+    HDC15_SCREEN_PROGRAM = 0,    //< 节目
+    HDC15_SCREEN_AREA,           //< 区域
+    HDC15_SCREEN_RESOURCE,       //< 资源(文本、图片、视频...)
+    HDC15_SCREEN_KINDS,
+};
 
+typedef struct HDC15_Screen_Item
+{
+    char guid[HDC15_MAX_PROGRAM_GUID_LENGHT];
+    char name[HDC15_SCREEN_NAME];        //< name属性, 可能为空
+    char type[12];                       //< 资源的元素名, 例如text
+    uint8_t parent;                      //< 所属节目(区域)或区域(资源)的序号
+    uint32_t hash;                       //< guid的哈希, 用于查找
+} HDC15_Screen_Item;
+
+/* What GetProgram reported, kept until a command fails with kInvalidGUID.
+ * The AddProgram commands of hd_textcontrol() and friends are applied to it
+ * as they succeed, a refetch replaces it only once complete. Items are
+ * numbered per kind in document order; program i is what the guid argument
+ * of hd_textcontrol() and friends refers to. */
+typedef struct HDC15_Screen
+{
+    bool valid;
+    uint8_t num[HDC15_SCREEN_KINDS];
+    HDC15_Screen_Item program[HDC15_SCREEN_PROGRAMS];
+    HDC15_Screen_Item area[HDC15_SCREEN_AREAS];
+    HDC15_Screen_Item resource[HDC15_SCREEN_RESOURCES];
+} HDC15_Screen;
+
+/* Devices keep their index for good: a rescan only updates their address and
+ * an expired device keeps its slot (with an empty ip_addr) until it returns. */
 typedef struct HDC15_Device_List
 {
-    uint8_t  num;
-    HDC15_Device dev[HDC15_DEVICE_NUM];
+    uint16_t  num;
+    uint16_t  cap;
+    HDC15_Device *dev;
 } HDC15_Device_List;
 
-typedef struct HDC15_Program_Guid_List
+
+enum HDC15_DeviceEvent
 {
-    uint8_t  num;
-    HDC15_Program_Guid program[HDC15_PROGRAM_GUID_NUM];
-} HDC15_Program_Guid_List;
+    HDC15_DEVICE_ADDED = 0,      //< 发现新设备或设备重新上线
+    HDC15_DEVICE_REMOVED,        //< 设备超时未应答
+    HDC15_DEVICE_MOVED,          //< 设备IP地址改变
+    HDC15_DEVICE_HEALTH,         //< 连接状态改变, 见hd_health_get()
+};
 
+/* Stages of a connection driven by the non-blocking API */
+enum HDC15_Stage
+{
+    HDC15_STAGE_CONNECT = 0,     //< TCP connect
+    HDC15_STAGE_SERVICE,         //< SDKServiceAsk版本协商
+    HDC15_STAGE_GUID,            //< GetIFVersion取guid
+    HDC15_STAGE_ANSWER,          //< SDKCmdAsk等待应答
+    HDC15_STAGES,
+};
+
+enum HDC15_Health
+{
+    HDC15_HEALTH_UNKNOWN = 0,    //< 尚未测量
+    HDC15_HEALTH_OK,
+    HDC15_HEALTH_DEGRADED,       //< 有超时或往返时间过长
+    HDC15_HEALTH_OFFLINE,        //< 连续超时, 调用直接失败
+};
+
+/* Round trips are measured with TcpHeartbeatAsk, the TCP connect and
+ * SDKServiceAsk, answer times with SDKCmdAsk; both are smoothed like TCP
+ * does (RFC 6298). */
+typedef struct HDC15_HealthInfo
+{
+    uint8_t state;                       //< HDC15_Health
+    uint8_t failures;                    //< 连续超时次数
+    uint16_t samples;                    //< 往返时间采样数
+    uint32_t srtt_ms;                    //< 平滑往返时间
+    uint32_t rttvar_ms;                  //< 往返时间偏差
+    uint16_t answers;                    //< 应答时间采样数
+    uint32_t answer_ms;                  //< 平滑应答时间
+    uint32_t answervar_ms;               //< 应答时间偏差
+    uint32_t timeout_ms[HDC15_STAGES];   //< 各阶段当前的超时
+} HDC15_HealthInfo;
+
+/* Classes of the per-device scheduler, most urgent first. A blocking call
+ * waits for its turn on the device while a more urgent one is waiting, and
+ * a file transfer gives way to it between two chunks. */
+enum HDC15_Priority
+{
+    HDC15_PRIO_URGENT = 0,       //< 紧急插播, 如中奖公告
+    HDC15_PRIO_NORMAL,           //< 控制命令, 节目更新
+    HDC15_PRIO_BULK,             //< 文件上传/回读, GetProgram
+    HDC15_PRIOS,
+};
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* result is the HDC15_ErrorCode of the answer (kSuccess, i.e. 0, or what an
+ * ErrorAnswer or the result attribute reported) and xml the SDKCmdAnswer
+ * document if there was one, or -1 and NULL when the session was lost before
+ * the answer arrived */
+typedef void (*hd_cmd_callback)(int id, int result, const char *xml, void *ctx);
+
 int hd_scan(void);
+/* Broadcast SearchDeviceAsk and collect answers for timeout_ms, or until
+ * expect (> 0) devices have answered. Returns the number that answered. */
+int hd_discover(uint32_t timeout_ms, int expect);
+
+/* Called with the registry locked; the hd_* API may be used from it. */
+typedef void (*hd_device_callback)(int id, int event, const HDC15_Device *dev,
+                                   void *ctx);
+/* Keep the device list current from a background thread, rescanning every
+ * period_ms (0: HDC15_REGISTRY_PERIOD_MS). cb may be NULL. */
+int hd_registry_start(uint32_t period_ms, hd_device_callback cb, void *ctx);
+void hd_registry_stop(void);
+/* Ask the registry thread to rescan now. */
+int hd_registry_refresh(void);
+/* Index of the device with this ID, or -1. */
+int hd_device_find(const char *dev_id);
+/* Copy the cached entry of a present device to dev (may be NULL). Returns -1
+ * for an unknown or expired id. */
+int hd_device_get(int id, HDC15_Device *dev);
+/* Fetch the screen model of device id with GetProgram, returns the number of
+ * programs or -1. */
 int hd_get_guid(int id);
+/* Copy the screen model, fetching it first if there is none (or it was
+ * invalidated). */
+int hd_screen_get(int id, HDC15_Screen *screen);
+/* Index of the item of kind HDC15_ScreenKind whose guid or name is key, or
+ * -1. Fetches the model first like hd_screen_get(). */
+int hd_screen_find(int id, int kind, const char *key);
+void hd_screen_invalidate(int id);
+/* Set the text of text resource res (an index from hd_screen_find()) with
+ * an UpdateProgram addressed through the cached model. */
+int hd_resource_text(int id, int res, const char *text_string);
+/* Decodes the character of a legacy charset such as GBK at src (len bytes
+ * left) into its code point ucs, returns the bytes it took or 0 if there is
+ * no valid character there. */
+typedef size_t (*hd_text_decode_callback)(const char *src, size_t len,
+                                          uint32_t *ucs);
+/* Text is sent as UTF-8. A text that is not valid UTF-8 is refused with -1,
+ * or, once a decoder is set, taken to be in its charset and converted on the
+ * way into the frame. Applies to every client. */
+void hd_set_text_decoder(hd_text_decode_callback dec);
+/* The commands below return kSuccess (0) once the controller accepted them,
+ * the HDC15_ErrorCode it answered with, or -1 if no answer arrived. Errors
+ * are retried as hd_error_policy() says, up to HDC15_CMD_RETRY times. */
 int hd_textcontrol(int id, int guid, bool en, const char *text_string);
 int hd_playcontrol(int id, int guid, bool en);
+/* One UpdateProgram for program guid: play < 0 leaves playControl as it is,
+ * text_string NULL the text; asking for neither change returns -1. */
+int hd_program_update(int id, int guid, int play, const char *text_string);
+
+/* Changes for one device collected and sent as a single UpdateProgram, so
+ * the screen switches programs in one round trip and without showing the
+ * states in between. Program (guid) and resource numbers are those of the
+ * screen model; a later change of the same target replaces an earlier
+ * one. */
+typedef struct HDC15_Batch HDC15_Batch;
+HDC15_Batch *hd_batch_new(int id);
+void hd_batch_free(HDC15_Batch *b);
+void hd_batch_clear(HDC15_Batch *b);
+int hd_batch_play(HDC15_Batch *b, int guid, bool en);
+/* The text hd_textcontrol() sets in program guid; NULL text returns -1. */
+int hd_batch_text(HDC15_Batch *b, int guid, const char *text_string);
+int hd_batch_resource_text(HDC15_Batch *b, int res, const char *text_string);
+/* Class HDC15_Priority the commit waits in (HDC15_PRIO_NORMAL by default)
+ * and how long(ms) it may wait for its turn before it is dropped, 0 for no
+ * limit. */
+int hd_batch_priority(HDC15_Batch *b, int prio, uint32_t deadline_ms);
+/* Send what was collected, like hd_program_update(). The batch is emptied
+ * once the controller accepted it. */
+int hd_batch_commit(HDC15_Batch *b);
+int hd_session_close(int id);
+void hd_keepalive(void);
+
+int hd_set_window(int window);
+int hd_textcontrol_async(int id, int guid, bool en, const char *text_string,
+                         hd_cmd_callback cb, void *ctx);
+int hd_playcontrol_async(int id, int guid, bool en, hd_cmd_callback cb,
+                         void *ctx);
+int hd_flush(int id);
+
+/* How long(ms) blocking calls of class HDC15_Priority may wait for their
+ * turn on a device before they give up with -1 without sending anything, 0
+ * (the default) for no limit. */
+int hd_set_deadline(int prio, uint32_t ms);
+/* Calls waiting for device id in class prio, HDC15_PRIOS for all classes. */
+int hd_sched_depth(int id, int prio);
+
+/* Non-blocking API: the request is queued and the call returns at once. The
+ * connection is driven by events on the client's queue (see
+ * hdc_set_queue()) as its socket becomes readable, so one thread serves any
+ * number of devices. cb runs exactly once from that queue, or from a blocking
+ * call that reads the answer first; it gets -1 when a stage timed out or the
+ * controller rejected the program guid. Returns -1 if the request could not
+ * be queued, cb is then not called. */
+int hd_cmd_nb(int id, const char *cmd, hd_cmd_callback cb, void *ctx);
+int hd_playcontrol_nb(int id, int guid, bool en, hd_cmd_callback cb,
+                      void *ctx);
+int hd_textcontrol_nb(int id, int guid, bool en, const char *text_string,
+                      hd_cmd_callback cb, void *ctx);
+int hd_program_update_nb(int id, int guid, int play, const char *text_string,
+                         hd_cmd_callback cb, void *ctx);
+/* Fix the time limit of stage HDC15_Stage for every device. 0 goes back to
+ * limits that follow what was measured to each device, starting out from
+ * the default. */
+int hd_set_stage_timeout(int stage, uint32_t ms);
+/* Health of device id and the time limits it gets now. */
+int hd_health_get(int id, HDC15_HealthInfo *info);
+
+/* Send the same update to num devices at once (ids NULL: every device in the
+ * registry), all within HDC15_GROUP_TIMEOUT_MS, waiting for busy devices and
+ * fetching missing screen models included. results, if given, gets the
+ * HDC15_ErrorCode or -1 per device in the order of ids, or by id when ids is
+ * NULL; a device listed twice gets the command once and the same result
+ * twice. Returns the number of devices that accepted it. */
+int hd_group_textcontrol(const int *ids, int num, int guid, bool en,
+                         const char *text_string, int *results);
+int hd_group_playcontrol(const int *ids, int num, int guid, bool en,
+                         int *results);
+
+/* Reads up to size bytes of the file at offset into buf, returns the number
+ * read (0 at the end) or -1. */
+typedef int (*hd_file_read_callback)(void *ctx, uint32_t offset, void *buf,
+                                     uint32_t size);
+/* Upload size bytes from read as file name of type HDC15_FileType. md5 (32
+ * hex digits) may be NULL, it is then computed from the source first. The
+ * source is read a chunk at a time, more than once if the transfer has to be
+ * resumed. Returns 0 once the controller has the whole file. */
+int hd_file_upload(int id, const char *name, uint16_t type, uint32_t size,
+                   const char *md5, hd_file_read_callback read, void *ctx);
+/* hd_file_upload() of a local file, name NULL uses its base name. */
+int hd_file_upload_path(int id, const char *path, const char *name,
+                        uint16_t type);
+
+/* Takes size bytes of the file read back at offset, returns 0 to go on. */
+typedef int (*hd_file_write_callback)(void *ctx, uint32_t offset,
+                                      const void *buf, uint32_t size);
+/* Size and md5 (32 hex digits + NUL, may be NULL) the controller reports
+ * for file name of type, without reading it. */
+int hd_file_stat(int id, const char *name, uint16_t type, uint32_t *size,
+                 char *md5);
+/* Read file name back a chunk at a time with ReadFileAsk, handing each chunk
+ * to write (may be NULL) and computing its md5 on the way. Returns kSuccess
+ * if it matches md5, or the md5 the controller reports when md5 is NULL;
+ * kFileContentError if not, another HDC15_ErrorCode if the controller
+ * refused, or -1. */
+int hd_file_read(int id, const char *name, uint16_t type, const char *md5,
+                 hd_file_write_callback write, void *ctx);
+/* hd_file_upload() unless the controller already has a file of that name,
+ * size and md5. md5 NULL computes it from the source. */
+int hd_file_sync(int id, const char *name, uint16_t type, uint32_t size,
+                 const char *md5, hd_file_read_callback read, void *ctx);
+
+/* Save the device table, the guid and version each session negotiated and
+ * the screen models to key (NULL: HDC15_STATE_KEY). */
+int hd_state_save(const char *key);
+/* Restore what hd_state_save() wrote, e.g. right after boot. Devices come
+ * back at their last address, and their sessions use the stored guid without
+ * SDKServiceAsk/GetIFVersion, so the first command needs no hd_scan() or
+ * GetProgram. A device that refuses the stored guid is negotiated again, one
+ * that cannot be reached triggers hd_registry_refresh(). */
+int hd_state_load(const char *key);
+
+/* A client owns its device registry, sessions and frame buffers. Each device
+ * has its own lock, so different devices of one client can be driven from
+ * different threads in parallel. The hd_* functions above work on a built-in
+ * default client, the hdc_* ones below on the given one. Callbacks run with
+ * the lock of their device held. */
+typedef struct HDC15_Client HDC15_Client;
+
+HDC15_Client *hdc_new(void);
+/* Waits for events already running on the client's queues, so it must not be
+ * called from one of them, and those queues must still be dispatched. No
+ * blocking hdc_* call may be in progress on c; queued non-blocking requests
+ * are failed. */
+void hdc_free(HDC15_Client *c);
+HDC15_Client *hdc_default(void);
+
+int hdc_scan(HDC15_Client *c);
+int hdc_discover(HDC15_Client *c, uint32_t timeout_ms, int expect);
+int hdc_registry_start(HDC15_Client *c, uint32_t period_ms,
+                       hd_device_callback cb, void *ctx);
+void hdc_registry_stop(HDC15_Client *c);
+int hdc_registry_refresh(HDC15_Client *c);
+int hdc_device_find(HDC15_Client *c, const char *dev_id);
+int hdc_device_get(HDC15_Client *c, int id, HDC15_Device *dev);
+int hdc_get_guid(HDC15_Client *c, int id);
+int hdc_screen_get(HDC15_Client *c, int id, HDC15_Screen *screen);
+int hdc_screen_find(HDC15_Client *c, int id, int kind, const char *key);
+void hdc_screen_invalidate(HDC15_Client *c, int id);
+int hdc_resource_text(HDC15_Client *c, int id, int res,
+                      const char *text_string);
+int hdc_textcontrol(HDC15_Client *c, int id, int guid, bool en,
+                    const char *text_string);
+int hdc_playcontrol(HDC15_Client *c, int id, int guid, bool en);
+int hdc_program_update(HDC15_Client *c, int id, int guid, int play,
+                       const char *text_string);
+HDC15_Batch *hdc_batch_new(HDC15_Client *c, int id);
+int hdc_session_close(HDC15_Client *c, int id);
+void hdc_keepalive(HDC15_Client *c);
+int hdc_set_window(HDC15_Client *c, int window);
+int hdc_textcontrol_async(HDC15_Client *c, int id, int guid, bool en,
+                          const char *text_string, hd_cmd_callback cb,
+                          void *ctx);
+int hdc_playcontrol_async(HDC15_Client *c, int id, int guid, bool en,
+                          hd_cmd_callback cb, void *ctx);
+int hdc_flush(HDC15_Client *c, int id);
+int hdc_set_deadline(HDC15_Client *c, int prio, uint32_t ms);
+int hdc_sched_depth(HDC15_Client *c, int id, int prio);
+/* Queue that drives the non-blocking API, NULL: mbed_event_queue(). Set it
+ * before the first hdc_*_nb call. */
+void hdc_set_queue(HDC15_Client *c, EventQueue *queue);
+int hdc_cmd_nb(HDC15_Client *c, int id, const char *cmd, hd_cmd_callback cb,
+               void *ctx);
+int hdc_playcontrol_nb(HDC15_Client *c, int id, int guid, bool en,
+                       hd_cmd_callback cb, void *ctx);
+int hdc_textcontrol_nb(HDC15_Client *c, int id, int guid, bool en,
+                       const char *text_string, hd_cmd_callback cb,
+                       void *ctx);
+int hdc_program_update_nb(HDC15_Client *c, int id, int guid, int play,
+                          const char *text_string, hd_cmd_callback cb,
+                          void *ctx);
+int hdc_set_stage_timeout(HDC15_Client *c, int stage, uint32_t ms);
+int hdc_health_get(HDC15_Client *c, int id, HDC15_HealthInfo *info);
+int hdc_group_textcontrol(HDC15_Client *c, const int *ids, int num, int guid,
+                          bool en, const char *text_string, int *results);
+int hdc_group_playcontrol(HDC15_Client *c, const int *ids, int num, int guid,
+                          bool en, int *results);
+int hdc_file_upload(HDC15_Client *c, int id, const char *name, uint16_t type,
+                    uint32_t size, const char *md5, hd_file_read_callback read,
+                    void *ctx);
+int hdc_file_upload_path(HDC15_Client *c, int id, const char *path,
+                         const char *name, uint16_t type);
+int hdc_file_stat(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  uint32_t *size, char *md5);
+int hdc_file_read(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  const char *md5, hd_file_write_callback write, void *ctx);
+int hdc_file_sync(HDC15_Client *c, int id, const char *name, uint16_t type,
+                  uint32_t size, const char *md5, hd_file_read_callback read,
+                  void *ctx);
+int hdc_state_save(HDC15_Client *c, const char *key);
+int hdc_state_load(HDC15_Client *c, const char *key);
 
 #ifdef __cplusplus
 } // closing brace for extern "C"
@@ -0,0 +1,278 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_codec.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+
+#define TRACE_GROUP "mbed_hd_client"
+
+static bool hd_frame_has_xml(uint16_t cmd) {
+  return cmd == SDKCmdAsk || cmd == SDKCmdAnswer;
+}
+
+/* Length of the frame k holds, once the len field is filled in. */
+static int hd_codec_finish(HDC15_Codec *k) {
+  if (k->error || k->pos > HDC15_FRAME_MAX) {
+    tr_err("frame of %u bytes failed.", (unsigned)k->pos);
+    return -1;
+  }
+  hd_le_put<uint16_t>(k->data, (uint16_t)k->pos);
+  return k->pos;
+}
+
+/* Open a frame in k, len is written by hd_codec_finish(). */
+static void hd_codec_begin(HDC15_Codec *k, void *buf, uint32_t cap,
+                           uint16_t cmd) {
+  hd_codec_init(k, buf, cap);
+  hd_codec_put<uint16_t>(k, 0);
+  hd_codec_put<uint16_t>(k, cmd);
+}
+
+/* Skip n bytes the caller fills in. */
+static void hd_codec_reserve(HDC15_Codec *k, uint32_t n) {
+  hd_codec_take(k, n);
+}
+
+/* NUL terminated string at the end of a body, NULL if unterminated. */
+static const char *hd_codec_get_str(HDC15_Codec *k) {
+  uint32_t left = k->cap - k->pos;
+  const char *p = (const char *)k->data + k->pos;
+  if (k->error || memchr(p, '\0', left) == NULL) {
+    k->error = true;
+    return NULL;
+  }
+  k->pos += strlen(p) + 1;
+  return p;
+}
+
+static void hd_codec_put_str(HDC15_Codec *k, const char *s) {
+  hd_codec_put_bytes(k, s, strlen(s) + 1);
+}
+
+/* md5 field: 32 hex digits and a NUL. */
+static void hd_codec_put_md5(HDC15_Codec *k, const char *md5) {
+  uint8_t *p = hd_codec_take(k, HDC15_MD5_LENGHT + 1);
+  if (p) {
+    memset(p, 0, HDC15_MD5_LENGHT + 1);
+    if (md5) {
+      memcpy(p, md5, strnlen(md5, HDC15_MD5_LENGHT));
+    }
+  }
+}
+
+static void hd_codec_get_md5(HDC15_Codec *k, char *md5) {
+  hd_codec_get_bytes(k, md5, HDC15_MD5_LENGHT + 1);
+  md5[HDC15_MD5_LENGHT] = '\0';
+}
+
+static int hd_codec_done(const HDC15_Codec *k) {
+  return k->error ? -1 : 0;
+}
+
+int hd_codec_udp_ask(void *buf, uint32_t cap, uint16_t cmd) {
+  HDC15_Codec k;
+  hd_codec_init(&k, buf, cap);
+  hd_codec_put<uint32_t>(&k, HDC15_LOCAL_UDP_VERSION);
+  hd_codec_put<uint16_t>(&k, cmd);
+  return k.error ? -1 : (int)k.pos;
+}
+
+int hd_codec_udp_ask_decode(const void *buf, uint32_t len,
+                            HDC15_UdpHeader *ask) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)buf, len);
+  ask->version = hd_codec_get<uint32_t>(&k);
+  ask->cmd = hd_codec_get<uint16_t>(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_udp_answer(void *buf, uint32_t cap, const HDC15_UdpResponse *ans) {
+  HDC15_Codec k;
+  hd_codec_init(&k, buf, cap);
+  hd_codec_put<uint32_t>(&k, ans->version);
+  hd_codec_put<uint16_t>(&k, ans->cmd);
+  hd_codec_put_bytes(&k, ans->devID, HDC15_MAX_DEVICE_ID_LENGHT);
+  hd_codec_put<uint32_t>(&k, ans->chanege);
+  return k.error ? -1 : (int)k.pos;
+}
+
+int hd_codec_udp_answer_decode(const void *buf, uint32_t len,
+                               HDC15_UdpResponse *ans) {
+  if (len != HDC15_UDP_ANSWER_LENGTH) {
+    return -1;
+  }
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)buf, len);
+  ans->version = hd_codec_get<uint32_t>(&k);
+  ans->cmd = hd_codec_get<uint16_t>(&k);
+  hd_codec_get_bytes(&k, ans->devID, HDC15_MAX_DEVICE_ID_LENGHT);
+  ans->chanege = hd_codec_get<uint32_t>(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_frame(void *buf, uint32_t cap, uint16_t cmd, uint32_t body_len) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, cmd);
+  hd_codec_reserve(&k, body_len);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_frame_body(void *buf, uint32_t cap, uint16_t cmd,
+                        const void *body, uint32_t body_len) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, cmd);
+  hd_codec_put_bytes(&k, body, body_len);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_xml_frame(void *buf, uint32_t cap, uint16_t cmd, uint32_t n,
+                       uint32_t total, uint32_t index) {
+  if (index > total || n > total - index) {
+    return -1;
+  }
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, cmd);
+  hd_codec_put<uint32_t>(&k, total);
+  hd_codec_put<uint32_t>(&k, index);
+  hd_codec_reserve(&k, n);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_frame_decode(const void *buf, uint32_t got, uint16_t *len,
+                          uint16_t *cmd) {
+  if (got < HDC15_FRAME_HEADER) {
+    return -1;
+  }
+  *len = hd_le_get<uint16_t>(buf);
+  *cmd = hd_le_get<uint16_t>((const uint8_t *)buf + 2);
+  uint16_t min = hd_frame_has_xml(*cmd) ? HDC15_TCP_HEADER_LENGTH
+                                        : HDC15_FRAME_HEADER;
+  return *len < min ? -1 : 0;
+}
+
+int hd_codec_service_ask(void *buf, uint32_t cap, uint32_t version) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, SDKServiceAsk);
+  hd_codec_put<uint32_t>(&k, version);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_version_decode(const void *body, uint32_t len, uint32_t *version) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  *version = hd_codec_get<uint32_t>(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_status_decode(const void *body, uint32_t len, uint16_t *status) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  *status = hd_codec_get<uint16_t>(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_file_start(void *buf, uint32_t cap, const char *md5,
+                        uint64_t size, uint16_t type, const char *name) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, FileStartAsk);
+  hd_codec_put_md5(&k, md5);
+  hd_codec_put<uint64_t>(&k, size);
+  hd_codec_put<uint16_t>(&k, type);
+  hd_codec_put_str(&k, name);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_file_start_decode(const void *body, uint32_t len, char *md5,
+                               uint64_t *size, uint16_t *type,
+                               const char **name) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  hd_codec_get_md5(&k, md5);
+  *size = hd_codec_get<uint64_t>(&k);
+  *type = hd_codec_get<uint16_t>(&k);
+  *name = hd_codec_get_str(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_file_start_answer(void *buf, uint32_t cap, uint16_t status,
+                               uint64_t exist) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, FileStartAnswer);
+  hd_codec_put<uint16_t>(&k, status);
+  hd_codec_put<uint64_t>(&k, exist);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_file_start_answer_decode(const void *body, uint32_t len,
+                                      uint16_t *status, uint64_t *exist) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  *status = hd_codec_get<uint16_t>(&k);
+  /* a refusal may come without the size */
+  *exist = k.cap - k.pos >= 8 ? hd_codec_get<uint64_t>(&k) : 0;
+  return hd_codec_done(&k);
+}
+
+int hd_codec_read_ask(void *buf, uint32_t cap, uint64_t offset, uint32_t size,
+                      uint16_t type, const char *name) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, ReadFileAsk);
+  hd_codec_put<uint64_t>(&k, offset);
+  hd_codec_put<uint32_t>(&k, size);
+  hd_codec_put<uint16_t>(&k, type);
+  hd_codec_put_str(&k, name);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_read_ask_decode(const void *body, uint32_t len, uint64_t *offset,
+                             uint32_t *size, uint16_t *type,
+                             const char **name) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  *offset = hd_codec_get<uint64_t>(&k);
+  *size = hd_codec_get<uint32_t>(&k);
+  *type = hd_codec_get<uint16_t>(&k);
+  *name = hd_codec_get_str(&k);
+  return hd_codec_done(&k);
+}
+
+int hd_codec_read_answer(void *buf, uint32_t cap, uint16_t status,
+                         uint64_t size, const char *md5, uint32_t n) {
+  HDC15_Codec k;
+  hd_codec_begin(&k, buf, cap, ReadFileAnswer);
+  hd_codec_put<uint16_t>(&k, status);
+  hd_codec_put<uint64_t>(&k, size);
+  hd_codec_put_md5(&k, md5);
+  hd_codec_reserve(&k, n);
+  return hd_codec_finish(&k);
+}
+
+int hd_codec_read_answer_decode(const void *body, uint32_t len,
+                                uint16_t *status, uint64_t *size, char *md5,
+                                const char **data, uint32_t *n) {
+  HDC15_Codec k;
+  hd_codec_init(&k, (void *)body, len);
+  *status = hd_codec_get<uint16_t>(&k);
+  *size = hd_codec_get<uint64_t>(&k);
+  hd_codec_get_md5(&k, md5);
+  if (k.error) {
+    return -1;
+  }
+  *data = (const char *)k.data + k.pos;
+  *n = k.cap - k.pos;
+  return 0;
+}
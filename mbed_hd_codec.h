@@ -0,0 +1,171 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_CODEC_H
+#define MBED_HD_CODEC_H
+
+#include "mbed_hd_client.h"
+#include <cstring>
+
+/* Wire layout of the frames. All integers are little endian and packed,
+ * whatever the host does; nothing is read or written through a struct or an
+ * unaligned pointer. */
+#define HDC15_UDP_ASK_LENGTH      6     //< version(4) cmd(2)
+#define HDC15_UDP_ANSWER_LENGTH   (6 + HDC15_MAX_DEVICE_ID_LENGHT + 4)
+#define HDC15_FRAME_HEADER        4     //< len(2) cmd(2)
+/* the len field of a TCP frame is 16 bits, it counts the header too */
+#define HDC15_FRAME_MAX           0xffff
+/* xml bytes in one SDKCmdAsk/SDKCmdAnswer frame, longer documents are sent
+ * as several fragments */
+#define HDC15_XML_FRAGMENT        (HDC15_FRAME_MAX - HDC15_TCP_HEADER_LENGTH)
+/* ReadFileAnswer: status(2) size(8) md5(33), then the data */
+#define HDC15_READ_ANSWER_HEADER  (2 + 8 + HDC15_MD5_LENGHT + 1)
+
+template <typename T> inline T hd_le_get(const void *p) {
+  const uint8_t *b = (const uint8_t *)p;
+  T v = 0;
+  for (unsigned i = 0; i < sizeof(T); i++) {
+    v |= (T)b[i] << (8 * i);
+  }
+  return v;
+}
+
+template <typename T> inline void hd_le_put(void *p, T v) {
+  uint8_t *b = (uint8_t *)p;
+  for (unsigned i = 0; i < sizeof(T); i++) {
+    b[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+/* Bounds-checked cursor over a caller buffer. A put or get that does not
+ * fit sets error and is dropped, as are all after it, so a frame is checked
+ * once when it is finished. */
+typedef struct HDC15_Codec
+{
+    uint8_t *data;
+    uint32_t cap;
+    uint32_t pos;
+    bool error;
+} HDC15_Codec;
+
+inline void hd_codec_init(HDC15_Codec *k, void *buf, uint32_t cap) {
+  k->data = (uint8_t *)buf;
+  k->cap = cap;
+  k->pos = 0;
+  k->error = false;
+}
+
+/* Start of the next n bytes, NULL if they are not there. */
+inline uint8_t *hd_codec_take(HDC15_Codec *k, uint32_t n) {
+  if (k->error || n > k->cap - k->pos) {
+    k->error = true;
+    return NULL;
+  }
+  uint8_t *p = k->data + k->pos;
+  k->pos += n;
+  return p;
+}
+
+template <typename T> inline void hd_codec_put(HDC15_Codec *k, T v) {
+  uint8_t *p = hd_codec_take(k, sizeof(T));
+  if (p) {
+    hd_le_put<T>(p, v);
+  }
+}
+
+template <typename T> inline T hd_codec_get(HDC15_Codec *k) {
+  const uint8_t *p = hd_codec_take(k, sizeof(T));
+  return p ? hd_le_get<T>(p) : 0;
+}
+
+inline void hd_codec_put_bytes(HDC15_Codec *k, const void *src, uint32_t n) {
+  uint8_t *p = hd_codec_take(k, n);
+  if (p) {
+    memcpy(p, src, n);
+  }
+}
+
+inline void hd_codec_get_bytes(HDC15_Codec *k, void *dst, uint32_t n) {
+  const uint8_t *p = hd_codec_take(k, n);
+  if (p) {
+    memcpy(dst, p, n);
+  }
+}
+
+/* Encoders write one whole frame into buf and return its length, or -1 if
+ * it does not fit into cap or the 16 bit len field. Decoders take the body
+ * of a frame (what follows len and cmd) and return 0, or -1 if it is short
+ * or malformed; outputs are only valid on 0. */
+
+int hd_codec_udp_ask(void *buf, uint32_t cap, uint16_t cmd);
+int hd_codec_udp_ask_decode(const void *buf, uint32_t len,
+                            HDC15_UdpHeader *ask);
+int hd_codec_udp_answer(void *buf, uint32_t cap, const HDC15_UdpResponse *ans);
+int hd_codec_udp_answer_decode(const void *buf, uint32_t len,
+                               HDC15_UdpResponse *ans);
+
+/* Header of a frame with body_len bytes of body, the body itself is placed
+ * at buf + HDC15_FRAME_HEADER by the caller (before or after). */
+int hd_codec_frame(void *buf, uint32_t cap, uint16_t cmd, uint32_t body_len);
+/* hd_codec_frame() with body copied in. */
+int hd_codec_frame_body(void *buf, uint32_t cap, uint16_t cmd,
+                        const void *body, uint32_t body_len);
+/* Header of an SDKCmdAsk/SDKCmdAnswer fragment of n bytes at index of a
+ * total bytes xml document, the fragment goes to buf +
+ * HDC15_TCP_HEADER_LENGTH. */
+int hd_codec_xml_frame(void *buf, uint32_t cap, uint16_t cmd, uint32_t n,
+                       uint32_t total, uint32_t index);
+/* Frame header as far as got bytes of it are in, returns 0 once len and
+ * cmd are known, -1 while they are not or len is impossible. */
+int hd_codec_frame_decode(const void *buf, uint32_t got, uint16_t *len,
+                          uint16_t *cmd);
+
+int hd_codec_service_ask(void *buf, uint32_t cap, uint32_t version);
+int hd_codec_version_decode(const void *body, uint32_t len, uint32_t *version);
+/* Status word of a FileXxxAnswer or ErrorAnswer body. */
+int hd_codec_status_decode(const void *body, uint32_t len, uint16_t *status);
+
+/* FileStartAsk: md5(33) size(8) type(2) name, NUL terminated. */
+int hd_codec_file_start(void *buf, uint32_t cap, const char *md5,
+                        uint64_t size, uint16_t type, const char *name);
+/* md5 gets 33 bytes; name points into body. */
+int hd_codec_file_start_decode(const void *body, uint32_t len, char *md5,
+                               uint64_t *size, uint16_t *type,
+                               const char **name);
+/* FileStartAnswer: status(2) size(8) the controller already has. */
+int hd_codec_file_start_answer(void *buf, uint32_t cap, uint16_t status,
+                               uint64_t exist);
+int hd_codec_file_start_answer_decode(const void *body, uint32_t len,
+                                      uint16_t *status, uint64_t *exist);
+
+/* ReadFileAsk: offset(8) size(4) type(2) name, NUL terminated. */
+int hd_codec_read_ask(void *buf, uint32_t cap, uint64_t offset, uint32_t size,
+                      uint16_t type, const char *name);
+int hd_codec_read_ask_decode(const void *body, uint32_t len, uint64_t *offset,
+                             uint32_t *size, uint16_t *type,
+                             const char **name);
+/* ReadFileAnswer header for n bytes of data, which the caller places at buf
+ * + HDC15_FRAME_HEADER + HDC15_READ_ANSWER_HEADER. md5 NULL sends zeros. */
+int hd_codec_read_answer(void *buf, uint32_t cap, uint16_t status,
+                         uint64_t size, const char *md5, uint32_t n);
+/* md5 gets 33 bytes; data points into body. */
+int hd_codec_read_answer_decode(const void *body, uint32_t len,
+                                uint16_t *status, uint64_t *size, char *md5,
+                                const char **data, uint32_t *n);
+
+#endif /* MBED_HD_CODEC_H */
@@ -0,0 +1,110 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_error.h"
+#include <cstring>
+
+/* indexed by HDC15_ErrorCode */
+static const char *const hd_error_names[kCount] = {
+    "kSuccess",
+    "kWriteFinish",
+    "kProcessError",
+    "kVersionTooLow",
+    "kDeviceOccupa",
+    "kFileOccupa",
+    "kReadFileExcessive",
+    "kInvalidPacketLen",
+    "kInvalidParam",
+    "kNotSpaceToSave",
+    "kCreateFileFailed",
+    "kWriteFileFailed",
+    "kReadFileFailed",
+    "kInvalidFileData",
+    "kFileContentError",
+    "kOpenFileFailed",
+    "kSeekFileFailed",
+    "kRenameFailed",
+    "kFileNotFound",
+    "kFileNotFinish",
+    "kXmlCmdTooLong",
+    "kInvalidXmlIndex",
+    "kParseXmlFailed",
+    "kInvalidMethod",
+    "kMemoryFailed",
+    "kSystemError",
+    "kUnsupportVideo",
+    "kNotMediaFile",
+    "kParseVideoFailed",
+    "kUnsupportFrameRate",
+    "kUnsupportResolution",
+    "kUnsupportFormat",
+    "kUnsupportDuration",
+    "kDownloadFileFailed",
+    "kScreenNodeIsNull",
+    "kNodeExist",
+    "kNodeNotExist",
+    "kPluginNotExist",
+    "kCheckLicenseFailed",
+    "kNotFoundWifiModule",
+    "kTestWifiUnsuccessful",
+    "kRunningError",
+    "kUnsupportMethod",
+    "kInvalidGUID",
+    "kDelayRespond",
+    "kShortlyReturn",
+    "KConnectionFailed",
+};
+
+const char *hd_error_name(int code) {
+  if (code < 0 || code >= kCount) {
+    return "kUnknown";
+  }
+  return hd_error_names[code];
+}
+
+int hd_error_code(const char *name) {
+  for (int code = 0; code < kCount; code++) {
+    if (strcmp(name, hd_error_names[code]) == 0) {
+      return code;
+    }
+  }
+  return kUnknown;
+}
+
+int hd_error_policy(int code) {
+  switch (code) {
+  /* the frame or document was damaged on the way, send it again */
+  case kProcessError:
+  case kInvalidPacketLen:
+  case kInvalidXmlIndex:
+  case kParseXmlFailed:
+  case kFileContentError:
+    return HDC15_RETRY_NOW;
+  /* the controller is busy with something else */
+  case kDeviceOccupa:
+  case kFileOccupa:
+  case kReadFileExcessive:
+  case kMemoryFailed:
+  case kSystemError:
+  case kRunningError:
+  case kDelayRespond:
+  case KConnectionFailed:
+    return HDC15_RETRY_BACKOFF;
+  default:
+    return HDC15_RETRY_NEVER;
+  }
+}
@@ -0,0 +1,47 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_ERROR_H
+#define MBED_HD_ERROR_H
+
+#include "mbed_hd_client.h"
+
+/* What to do about a command that failed with an HDC15_ErrorCode */
+enum HDC15_RetryPolicy
+{
+    HDC15_RETRY_NEVER = 0,   //< 参数或状态错误, 重试无用
+    HDC15_RETRY_NOW,         //< 传输中的偶发错误, 立即重发
+    HDC15_RETRY_BACKOFF,     //< 设备忙, 等待后重发
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The name the controller uses for code, e.g. "kDeviceOccupa". */
+const char *hd_error_name(int code);
+/* The code of a result attribute, kUnknown if the name is not known. */
+int hd_error_code(const char *name);
+/* HDC15_RetryPolicy of code; kSuccess and kUnknown are never retried. */
+int hd_error_policy(int code);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_ERROR_H */
@@ -0,0 +1,195 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_frame.h"
+#include "mbed_hd_codec.h"
+#include "mbed_hd_pool.h"
+#include "mbed_hd_stats.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstring>
+#include <stdlib.h>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+int hd_buffer_reserve(HDC15_Buffer *buf, uint32_t cap) {
+  if (cap <= buf->cap) {
+    return 0;
+  }
+  char *data = (char *)hd_pool_buffer_alloc(buf->data, &cap);
+  if (data == NULL) {
+    tr_err("buffer %u failed.", (unsigned)cap);
+    return -1;
+  }
+  buf->data = data;
+  buf->cap = cap;
+  return 0;
+}
+
+void hd_buffer_free(HDC15_Buffer *buf) {
+  hd_pool_buffer_free(buf->data);
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+}
+
+static bool hd_frame_has_xml(uint16_t cmd) {
+  return cmd == SDKCmdAsk || cmd == SDKCmdAnswer;
+}
+
+/* Pass on whatever follows the part of the document already fed. */
+static void hd_frame_feed(HDC15_FrameReader *r, uint32_t end) {
+  if (r->sink && end > r->fed) {
+    r->sink(r->sink_ctx, r->payload.data + r->fed, end - r->fed);
+    r->fed = end;
+  }
+}
+
+void hd_frame_reset(HDC15_FrameReader *r) {
+  r->header_got = 0;
+  r->done = false;
+  r->cmd = 0;
+  r->cmd_got = 0;
+  r->frame_len = 0;
+  r->frame_got = 0;
+  r->index = 0;
+  r->total = 0;
+  r->received = 0;
+  r->fed = 0;
+  r->payload.len = 0;
+}
+
+void hd_frame_free(HDC15_FrameReader *r) {
+  hd_frame_reset(r);
+  hd_buffer_free(&r->payload);
+}
+
+/* Called once the header of a frame is complete. */
+static int hd_frame_begin(HDC15_FrameReader *r) {
+  uint16_t cmd = r->cmd_got;
+  if (hd_frame_has_xml(cmd)) {
+    uint32_t total = hd_le_get<uint32_t>(&r->header[4]);
+    uint32_t index = hd_le_get<uint32_t>(&r->header[8]);
+    uint32_t frag = r->frame_len - HDC15_TCP_HEADER_LENGTH;
+    if (r->received == 0) {
+      if (total > HDC15_TCP_MAX_REPLY ||
+          hd_buffer_reserve(&r->payload, total + 1) != 0) {
+        tr_err("reply total %u failed.", (unsigned)total);
+        return -1;
+      }
+      r->cmd = cmd;
+      r->total = total;
+    } else if (cmd != r->cmd || total != r->total) {
+      tr_err("fragment %x/%u does not match %x/%u.", cmd, (unsigned)total,
+             r->cmd, (unsigned)r->total);
+      return -1;
+    }
+    if (index > total || frag > total - index) {
+      tr_err("fragment %u+%u beyond %u.", (unsigned)index, (unsigned)frag,
+             (unsigned)total);
+      return -1;
+    }
+    r->index = index;
+  } else {
+    if (r->received != 0) {
+      tr_err("frame %x inside a fragmented reply.", cmd);
+      return -1;
+    }
+    if (hd_buffer_reserve(&r->payload,
+                          r->frame_len - HDC15_FRAME_HEADER + 1) != 0) {
+      return -1;
+    }
+    r->cmd = cmd;
+    r->index = 0;
+  }
+  r->frame_got = 0;
+  return 0;
+}
+
+int hd_frame_read(HDC15_FrameReader *r, TCPSocket *sock) {
+  if (r->done) {
+    hd_frame_reset(r);
+  }
+  while (true) {
+    uint8_t header_len = HDC15_FRAME_HEADER;
+    if (r->header_got >= HDC15_FRAME_HEADER &&
+        hd_frame_has_xml(r->cmd_got)) {
+      header_len = HDC15_TCP_HEADER_LENGTH;
+    }
+    int n;
+    if (r->header_got < header_len) {
+      n = sock->recv(&r->header[r->header_got], header_len - r->header_got);
+      if (n == NSAPI_ERROR_WOULD_BLOCK) {
+        return 0;
+      }
+      if (n <= 0) {
+        return n == 0 ? NSAPI_ERROR_CONNECTION_LOST : n;
+      }
+      r->header_got += n;
+      if (r->header_got == HDC15_FRAME_HEADER) {
+        uint16_t len;
+        if (hd_codec_frame_decode(r->header, r->header_got, &len,
+                                  &r->cmd_got) != 0) {
+          tr_err("frame len %u failed.", (unsigned)len);
+          return NSAPI_ERROR_DEVICE_ERROR;
+        }
+        r->frame_len = len;
+        if (hd_frame_has_xml(r->cmd_got)) {
+          continue;
+        }
+      } else if (r->header_got < header_len) {
+        continue;
+      }
+      if (hd_frame_begin(r) != 0) {
+        return NSAPI_ERROR_DEVICE_ERROR;
+      }
+    }
+
+    uint32_t body_len = r->frame_len - header_len;
+    if (r->frame_got < body_len) {
+      char *dst = r->payload.data + r->index + r->frame_got;
+      n = sock->recv(dst, body_len - r->frame_got);
+      if (n == NSAPI_ERROR_WOULD_BLOCK) {
+        return 0;
+      }
+      if (n <= 0) {
+        return n == 0 ? NSAPI_ERROR_CONNECTION_LOST : n;
+      }
+      if (hd_frame_has_xml(r->cmd) && r->index + r->frame_got == r->fed) {
+        hd_frame_feed(r, r->fed + n);
+      }
+      r->frame_got += n;
+      continue;
+    }
+
+    /* frame complete */
+    r->header_got = 0;
+    hd_stats_rx(r->frame_len);
+    if (hd_frame_has_xml(r->cmd)) {
+      r->received += body_len;
+      if (r->received < r->total) {
+        continue;
+      }
+      r->payload.len = r->total;
+      hd_frame_feed(r, r->total);
+    } else {
+      r->payload.len = body_len;
+    }
+    r->payload.data[r->payload.len] = '\0';
+    r->done = true;
+    return 1;
+  }
+}
@@ -0,0 +1,78 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_FRAME_H
+#define MBED_HD_FRAME_H
+
+#include "mbed_hd_client.h"
+
+/* upper bound for one reassembled reply, protects against a corrupt total */
+#ifndef HDC15_TCP_MAX_REPLY
+#define HDC15_TCP_MAX_REPLY       (256 * 1024)
+#endif
+/* upper bound for the xml of one request */
+#ifndef HDC15_TCP_MAX_REQUEST
+#define HDC15_TCP_MAX_REQUEST     (256 * 1024)
+#endif
+
+/* Receives the xml of SDKCmdAnswer replies in document order while it is
+ * still arriving. */
+typedef void (*hd_frame_sink)(void *ctx, const char *data, size_t len);
+
+typedef struct HDC15_Buffer
+{
+    char *data;
+    uint32_t len;
+    uint32_t cap;
+} HDC15_Buffer;
+
+/* Incremental reader for TCP frames.
+ *
+ * Every frame starts with len(2) cmd(2). SDKCmdAsk/SDKCmdAnswer frames carry
+ * total(4) index(4) as well and a fragment of the xml document, which is put
+ * back together in payload at offset index until total bytes have arrived.
+ * Other frames deliver their body (after len/cmd) in payload.
+ * If sink is set, the xml is handed to it as soon as it is contiguous. */
+typedef struct HDC15_FrameReader
+{
+    uint8_t header[HDC15_TCP_HEADER_LENGTH];
+    uint8_t header_got;
+    bool done;
+    uint16_t cmd;            //< 当前消息的命令值
+    uint16_t cmd_got;        //< 当前帧头中的命令值
+    uint32_t frame_len;
+    uint32_t frame_got;      //< 当前帧已读取的数据长度(不含帧头)
+    uint32_t index;          //< 当前分片在xml中的偏移
+    uint32_t total;          //< xml总长度
+    uint32_t received;       //< 已收到的xml长度
+    uint32_t fed;            //< 已交给sink的xml长度
+    hd_frame_sink sink;
+    void *sink_ctx;
+    HDC15_Buffer payload;
+} HDC15_FrameReader;
+
+int hd_buffer_reserve(HDC15_Buffer *buf, uint32_t cap);
+void hd_buffer_free(HDC15_Buffer *buf);
+
+void hd_frame_reset(HDC15_FrameReader *r);
+void hd_frame_free(HDC15_FrameReader *r);
+/* Returns 1 once a whole message is in r->cmd/r->payload, 0 if the socket
+ * would block (or timed out) first, or a negative nsapi error. */
+int hd_frame_read(HDC15_FrameReader *r, TCPSocket *sock);
+
+#endif /* MBED_HD_FRAME_H */
@@ -0,0 +1,120 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_md5.h"
+#include <cstdio>
+#include <cstring>
+
+static const uint32_t hd_md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const uint8_t hd_md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 5, 9,  14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+static void hd_md5_block(HDC15_Md5 *ctx, const uint8_t *p) {
+  uint32_t w[16];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)p[i * 4] | (uint32_t)p[i * 4 + 1] << 8 |
+           (uint32_t)p[i * 4 + 2] << 16 | (uint32_t)p[i * 4 + 3] << 24;
+  }
+  uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2],
+           d = ctx->state[3];
+  for (int i = 0; i < 64; i++) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t t = d;
+    d = c;
+    c = b;
+    uint32_t x = a + f + hd_md5_k[i] + w[g];
+    b += (x << hd_md5_r[i]) | (x >> (32 - hd_md5_r[i]));
+    a = t;
+  }
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+}
+
+void hd_md5_init(HDC15_Md5 *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->bytes = 0;
+}
+
+void hd_md5_update(HDC15_Md5 *ctx, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  size_t used = ctx->bytes % 64;
+  ctx->bytes += len;
+  if (used) {
+    size_t n = 64 - used < len ? 64 - used : len;
+    memcpy(&ctx->block[used], p, n);
+    p += n;
+    len -= n;
+    if (used + n < 64) {
+      return;
+    }
+    hd_md5_block(ctx, ctx->block);
+  }
+  for (; len >= 64; p += 64, len -= 64) {
+    hd_md5_block(ctx, p);
+  }
+  memcpy(ctx->block, p, len);
+}
+
+void hd_md5_hex(HDC15_Md5 *ctx, char hex[33]) {
+  static const uint8_t pad[64] = {0x80};
+  uint64_t bits = ctx->bytes * 8;
+  size_t used = ctx->bytes % 64;
+  hd_md5_update(ctx, pad, used < 56 ? 56 - used : 120 - used);
+  uint8_t len[8];
+  for (int i = 0; i < 8; i++) {
+    len[i] = (uint8_t)(bits >> (8 * i));
+  }
+  hd_md5_update(ctx, len, 8);
+  for (int i = 0; i < 16; i++) {
+    snprintf(&hex[i * 2], 3, "%02x",
+             (unsigned)(ctx->state[i / 4] >> (8 * (i % 4))) & 0xff);
+  }
+}
@@ -0,0 +1,38 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_MD5_H
+#define MBED_HD_MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental MD5 (RFC 1321) for file transfers. */
+typedef struct HDC15_Md5
+{
+    uint32_t state[4];
+    uint64_t bytes;          //< 已处理的字节数
+    uint8_t block[64];
+} HDC15_Md5;
+
+void hd_md5_init(HDC15_Md5 *ctx);
+void hd_md5_update(HDC15_Md5 *ctx, const void *data, size_t len);
+/* Finish and write the digest as 32 lower case hex digits plus NUL. */
+void hd_md5_hex(HDC15_Md5 *ctx, char hex[33]);
+
+#endif /* MBED_HD_MD5_H */
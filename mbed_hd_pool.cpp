@@ -0,0 +1,145 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_pool.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstdio>
+#include <new>
+#include <stdlib.h>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+#if HDC15_STATIC_POOLS
+typedef struct HDC15_Block {
+  char data[HDC15_POOL_BLOCK_SIZE];
+} HDC15_Block;
+
+static MemoryPool<TCPSocket, HDC15_POOL_SOCKETS> hd_socket_pool;
+static MemoryPool<HDC15_Block, HDC15_POOL_BLOCKS> hd_block_pool;
+static const uint16_t hd_pool_size[HDC15_POOL_NUM] = {HDC15_POOL_SOCKETS,
+                                                      HDC15_POOL_BLOCKS};
+#else
+static const uint16_t hd_pool_size[HDC15_POOL_NUM] = {0, 0};
+#endif
+
+static Mutex hd_pool_mutex;
+static HDC15_PoolStats hd_pool[HDC15_POOL_NUM];
+
+/* Count one allocation attempt of pool kind. */
+static void hd_pool_account(int kind, bool ok) {
+  ScopedLock<Mutex> lock(hd_pool_mutex);
+  HDC15_PoolStats *st = &hd_pool[kind];
+  if (!ok) {
+    st->failed++;
+    return;
+  }
+  st->used++;
+  if (st->used > st->peak) {
+    st->peak = st->used;
+  }
+}
+
+static void hd_pool_release(int kind) {
+  ScopedLock<Mutex> lock(hd_pool_mutex);
+  hd_pool[kind].used--;
+}
+
+TCPSocket *hd_pool_socket_new(void) {
+#if HDC15_STATIC_POOLS
+  void *mem = hd_socket_pool.try_alloc();
+  TCPSocket *sock = mem ? new (mem) TCPSocket : NULL;
+#else
+  TCPSocket *sock = new (std::nothrow) TCPSocket;
+#endif
+  hd_pool_account(HDC15_POOL_SOCKET, sock != NULL);
+  return sock;
+}
+
+void hd_pool_socket_delete(TCPSocket *sock) {
+  if (sock == NULL) {
+    return;
+  }
+#if HDC15_STATIC_POOLS
+  sock->~TCPSocket();
+  hd_socket_pool.free(sock);
+#else
+  delete sock;
+#endif
+  hd_pool_release(HDC15_POOL_SOCKET);
+}
+
+void *hd_pool_buffer_alloc(void *data, uint32_t *cap) {
+#if HDC15_STATIC_POOLS
+  /* a pooled buffer always owns a whole block, so it only gets here when
+   * new or when asked for more than a block */
+  void *mem = NULL;
+  if (data == NULL && *cap <= HDC15_POOL_BLOCK_SIZE) {
+    mem = hd_block_pool.try_alloc();
+  }
+  if (mem) {
+    *cap = HDC15_POOL_BLOCK_SIZE;
+  }
+#else
+  void *mem = realloc(data, *cap);
+#endif
+  if (data == NULL || mem == NULL) {
+    hd_pool_account(HDC15_POOL_BUFFER, mem != NULL);
+  }
+  return mem;
+}
+
+void hd_pool_buffer_free(void *data) {
+  if (data == NULL) {
+    return;
+  }
+#if HDC15_STATIC_POOLS
+  hd_block_pool.free((HDC15_Block *)data);
+#else
+  free(data);
+#endif
+  hd_pool_release(HDC15_POOL_BUFFER);
+}
+
+int hd_pool_stats(int pool, HDC15_PoolStats *stats) {
+  if (pool < 0 || pool >= HDC15_POOL_NUM) {
+    return -1;
+  }
+  ScopedLock<Mutex> lock(hd_pool_mutex);
+  *stats = hd_pool[pool];
+  stats->size = hd_pool_size[pool];
+  return 0;
+}
+
+#ifdef MBED_USER_ONEOS
+#include "oneos.h"
+
+#if MBED_CONF_ONEOS_OS_USING_SHELL
+
+static void hd_pool_cmd(int argc, char **argv) {
+  static const char *const names[HDC15_POOL_NUM] = {"socket", "buffer"};
+  for (int i = 0; i < HDC15_POOL_NUM; i++) {
+    HDC15_PoolStats st;
+    hd_pool_stats(i, &st);
+    printf("%-8s size %u used %u peak %u failed %u\n", names[i],
+           (unsigned)st.size, (unsigned)st.used, (unsigned)st.peak,
+           (unsigned)st.failed);
+  }
+}
+SH_CMD_EXPORT(hd_pool, hd_pool_cmd, "show socket/buffer pool use");
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_POOL_H
+#define MBED_HD_POOL_H
+
+#include "mbed_hd_client.h"
+
+/* With HDC15_STATIC_POOLS set (e.g. through "macros" in mbed_app.json) the
+ * TCP sockets and frame buffers come from fixed pools sized below instead of
+ * the heap, so a long running client cannot fragment it. A frame buffer is
+ * then one block, which also bounds the size of a reply. */
+#ifndef HDC15_STATIC_POOLS
+#define HDC15_STATIC_POOLS        0
+#endif
+#ifndef HDC15_POOL_SOCKETS
+#define HDC15_POOL_SOCKETS        4
+#endif
+#ifndef HDC15_POOL_BLOCK_SIZE
+#define HDC15_POOL_BLOCK_SIZE     4096
+#endif
+/* HDC15_Batch objects alive at once */
+#ifndef HDC15_POOL_BATCHES
+#define HDC15_POOL_BATCHES        1
+#endif
+/* every session needs a tx and an rx buffer, group commands one, every batch
+ * two (its texts and its document) and the simulated controller two while it
+ * serves a connection; hd_state_save()/hd_state_load() use the heap */
+#if defined(HDC15_SIM) && HDC15_SIM
+#define HD_POOL_SIM_BLOCKS        2
+#else
+#define HD_POOL_SIM_BLOCKS        0
+#endif
+#ifndef HDC15_POOL_BLOCKS
+#define HDC15_POOL_BLOCKS                                                      \
+  (2 * HDC15_POOL_SOCKETS + 1 + 2 * HDC15_POOL_BATCHES + HD_POOL_SIM_BLOCKS)
+#endif
+
+enum HDC15_PoolKind
+{
+    HDC15_POOL_SOCKET = 0,
+    HDC15_POOL_BUFFER,
+    HDC15_POOL_NUM,
+};
+
+typedef struct HDC15_PoolStats
+{
+    uint16_t size;           //< pool size, 0 when taken from the heap
+    uint16_t used;
+    uint16_t peak;           //< high-water mark of used
+    uint32_t failed;         //< allocations the pool could not serve
+} HDC15_PoolStats;
+
+TCPSocket *hd_pool_socket_new(void);
+void hd_pool_socket_delete(TCPSocket *sock);
+/* Grow data (NULL for a new buffer) to at least *cap bytes; *cap is set to
+ * what was reserved. Returns NULL on failure, data is left alone then. */
+void *hd_pool_buffer_alloc(void *data, uint32_t *cap);
+void hd_pool_buffer_free(void *data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hd_pool_stats(int pool, HDC15_PoolStats *stats);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_POOL_H */
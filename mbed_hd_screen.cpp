@@ -0,0 +1,273 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_screen.h"
+#include <cstdlib>
+#include <cstring>
+
+#define HD_SCREEN_PROGRAM_PATH  "sdk/out/screen/program"
+#define HD_SCREEN_AREA_PATH     HD_SCREEN_PROGRAM_PATH "/area"
+#define HD_SCREEN_RESOURCE_PATH HD_SCREEN_AREA_PATH "/resources/*"
+
+static const uint8_t hd_screen_cap[HDC15_SCREEN_KINDS] = {
+    HDC15_SCREEN_PROGRAMS, HDC15_SCREEN_AREAS, HDC15_SCREEN_RESOURCES};
+
+static uint32_t hd_screen_hash(const char *guid) {
+  uint32_t h = 2166136261u;
+  for (; *guid; guid++) {
+    h = (h ^ (uint8_t)*guid) * 16777619u;
+  }
+  return h;
+}
+
+const HDC15_Screen_Item *hd_screen_item(const HDC15_Screen *screen, int kind,
+                                        int index) {
+  if (kind < 0 || kind >= HDC15_SCREEN_KINDS || index < 0 ||
+      index >= screen->num[kind]) {
+    return NULL;
+  }
+  const HDC15_Screen_Item *items[HDC15_SCREEN_KINDS] = {
+      screen->program, screen->area, screen->resource};
+  return &items[kind][index];
+}
+
+static HDC15_Screen_Item *hd_screen_cur(HDC15_ScreenParse *p, int kind) {
+  if (p->cur[kind] < 0) {
+    return NULL;
+  }
+  return (HDC15_Screen_Item *)hd_screen_item(p->screen, kind, p->cur[kind]);
+}
+
+static void hd_screen_reset(void *ctx, const char *value) {
+  (void)value;
+  HDC15_ScreenParse *p = (HDC15_ScreenParse *)ctx;
+  memset(p->screen->num, 0, sizeof(p->screen->num));
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS; kind++) {
+    p->cur[kind] = -1;
+  }
+}
+
+/* A program, area or resource element opened; value is its name. */
+static void hd_screen_start(void *ctx, const char *value) {
+  HDC15_ScreenParse *p = ((HDC15_ScreenCtx *)ctx)->parse;
+  int kind = ((HDC15_ScreenCtx *)ctx)->kind;
+  HDC15_Screen *screen = p->screen;
+  p->cur[kind] = -1;
+  if (kind > HDC15_SCREEN_PROGRAM && p->cur[kind - 1] < 0) {
+    return;
+  }
+  if (screen->num[kind] >= hd_screen_cap[kind]) {
+    return;
+  }
+  p->cur[kind] = screen->num[kind]++;
+  HDC15_Screen_Item *item = hd_screen_cur(p, kind);
+  memset(item, 0, sizeof(*item));
+  if (kind > HDC15_SCREEN_PROGRAM) {
+    item->parent = p->cur[kind - 1];
+  }
+  strlcpy(item->type, value, sizeof(item->type));
+}
+
+static void hd_screen_guid(void *ctx, const char *value) {
+  HDC15_ScreenCtx *c = (HDC15_ScreenCtx *)ctx;
+  HDC15_Screen_Item *item = hd_screen_cur(c->parse, c->kind);
+  if (item) {
+    strlcpy(item->guid, value, sizeof(item->guid));
+    item->hash = hd_screen_hash(item->guid);
+  }
+}
+
+static void hd_screen_name(void *ctx, const char *value) {
+  HDC15_ScreenCtx *c = (HDC15_ScreenCtx *)ctx;
+  HDC15_Screen_Item *item = hd_screen_cur(c->parse, c->kind);
+  if (item) {
+    strlcpy(item->name, value, sizeof(item->name));
+  }
+}
+
+void hd_screen_parse_init(HDC15_ScreenParse *p, HDC15_Screen *screen) {
+  static const char *const path[HDC15_SCREEN_KINDS] = {
+      HD_SCREEN_PROGRAM_PATH, HD_SCREEN_AREA_PATH, HD_SCREEN_RESOURCE_PATH};
+  memset(p, 0, sizeof(*p));
+  p->screen = screen;
+  screen->valid = false;
+  hd_screen_reset(p, NULL);
+  p->watch[0] = {"sdk", NULL, hd_screen_reset, p};
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS; kind++) {
+    p->ctx[kind].parse = p;
+    p->ctx[kind].kind = kind;
+    HDC15_SaxWatch *w = &p->watch[1 + 3 * kind];
+    w[0] = {path[kind], NULL, hd_screen_start, &p->ctx[kind]};
+    w[1] = {path[kind], "guid", hd_screen_guid, &p->ctx[kind]};
+    w[2] = {path[kind], "name", hd_screen_name, &p->ctx[kind]};
+  }
+}
+
+static void hd_screen_fill(HDC15_Screen_Item *item, const char *type,
+                           const char *guid, int parent) {
+  memset(item, 0, sizeof(*item));
+  strlcpy(item->type, type, sizeof(item->type));
+  strlcpy(item->guid, guid, sizeof(item->guid));
+  item->hash = hd_screen_hash(item->guid);
+  item->parent = parent;
+}
+
+/* Move the kept items of list (map[i] >= 0) to map[i]. map increases over
+ * them, so those moving down are moved first in order and those moving up
+ * then in reverse order, none overwrites an item still to be moved. */
+static void hd_screen_move(HDC15_Screen_Item *list, const int8_t *map,
+                           int num) {
+  for (int i = 0; i < num; i++) {
+    if (map[i] >= 0 && map[i] < i) {
+      list[map[i]] = list[i];
+    }
+  }
+  for (int i = num - 1; i >= 0; i--) {
+    if (map[i] > i) {
+      list[map[i]] = list[i];
+    }
+  }
+}
+
+int hd_screen_program_set(HDC15_Screen *screen, int program,
+                          const char *area_guid, const char *res_guid,
+                          const char *type) {
+  if (program < 0 || program >= screen->num[HDC15_SCREEN_PROGRAM]) {
+    return -1;
+  }
+
+  /* the areas in document order, those of program replaced by the new one
+   * where they were */
+  int8_t map[HDC15_SCREEN_AREAS];
+  int area = -1;
+  int areas = 0;
+  int num = screen->num[HDC15_SCREEN_AREA];
+  for (int i = 0; i < num; i++) {
+    const HDC15_Screen_Item *a = &screen->area[i];
+    if (area < 0 && a->parent >= program) {
+      area = areas++;
+    }
+    map[i] = a->parent == program ? -1 : areas++;
+  }
+  if (area < 0) {
+    area = areas++;
+  }
+
+  /* the resources follow their areas, the new one goes before those of the
+   * areas after it */
+  int8_t res_map[HDC15_SCREEN_RESOURCES];
+  int res = -1;
+  int resources = 0;
+  int res_num = screen->num[HDC15_SCREEN_RESOURCE];
+  for (int i = 0; i < res_num; i++) {
+    int parent = map[screen->resource[i].parent];
+    if (res < 0 && parent > area) {
+      res = resources++;
+    }
+    res_map[i] = parent < 0 ? -1 : resources++;
+  }
+  if (res < 0) {
+    res = resources++;
+  }
+  if (areas > HDC15_SCREEN_AREAS || resources > HDC15_SCREEN_RESOURCES) {
+    return -1;
+  }
+
+  /* rebuilt in place, the model is only touched once it is known to fit */
+  hd_screen_move(screen->area, map, num);
+  hd_screen_fill(&screen->area[area], "area", area_guid, program);
+  screen->num[HDC15_SCREEN_AREA] = areas;
+  hd_screen_move(screen->resource, res_map, res_num);
+  for (int i = 0; i < res_num; i++) {
+    if (res_map[i] >= 0) {
+      HDC15_Screen_Item *item = &screen->resource[res_map[i]];
+      item->parent = map[item->parent];
+    }
+  }
+  hd_screen_fill(&screen->resource[res], type, res_guid, area);
+  screen->num[HDC15_SCREEN_RESOURCE] = resources;
+  return 0;
+}
+
+void hd_screen_encode(HDC15_Codec *k, const HDC15_Screen *screen) {
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS; kind++) {
+    hd_codec_put<uint8_t>(k, screen->num[kind]);
+  }
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS; kind++) {
+    for (int i = 0; i < screen->num[kind]; i++) {
+      const HDC15_Screen_Item *item = hd_screen_item(screen, kind, i);
+      hd_codec_put_bytes(k, item->guid, strlen(item->guid) + 1);
+      hd_codec_put_bytes(k, item->name, strlen(item->name) + 1);
+      hd_codec_put_bytes(k, item->type, strlen(item->type) + 1);
+      hd_codec_put<uint8_t>(k, item->parent);
+    }
+  }
+}
+
+/* A NUL terminated string of at most size bytes. */
+static void hd_screen_get_str(HDC15_Codec *k, char *dst, uint32_t size) {
+  const char *src = (const char *)k->data + k->pos;
+  uint32_t n = k->error ? 0 : strnlen(src, k->cap - k->pos) + 1;
+  if (n > size) {
+    k->error = true;
+  }
+  hd_codec_get_bytes(k, dst, n);
+}
+
+int hd_screen_decode(HDC15_Codec *k, HDC15_Screen *screen) {
+  memset(screen, 0, sizeof(*screen));
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS; kind++) {
+    screen->num[kind] = hd_codec_get<uint8_t>(k);
+    if (screen->num[kind] > hd_screen_cap[kind]) {
+      return -1;
+    }
+  }
+  for (int kind = 0; kind < HDC15_SCREEN_KINDS && !k->error; kind++) {
+    for (int i = 0; i < screen->num[kind]; i++) {
+      HDC15_Screen_Item *item =
+          (HDC15_Screen_Item *)hd_screen_item(screen, kind, i);
+      hd_screen_get_str(k, item->guid, sizeof(item->guid));
+      hd_screen_get_str(k, item->name, sizeof(item->name));
+      hd_screen_get_str(k, item->type, sizeof(item->type));
+      item->parent = hd_codec_get<uint8_t>(k);
+      if (k->error || (kind > HDC15_SCREEN_PROGRAM &&
+                       item->parent >= screen->num[kind - 1])) {
+        return -1;
+      }
+      item->hash = hd_screen_hash(item->guid);
+    }
+  }
+  return k->error ? -1 : 0;
+}
+
+int hd_screen_lookup(const HDC15_Screen *screen, int kind, const char *key) {
+  uint32_t hash = hd_screen_hash(key);
+  int by_name = -1;
+  for (int i = 0;; i++) {
+    const HDC15_Screen_Item *item = hd_screen_item(screen, kind, i);
+    if (item == NULL) {
+      break;
+    }
+    if (item->hash == hash && strcmp(item->guid, key) == 0) {
+      return i;
+    }
+    if (by_name < 0 && item->name[0] && strcmp(item->name, key) == 0) {
+      by_name = i;
+    }
+  }
+  return by_name;
+}
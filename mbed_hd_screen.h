@@ -0,0 +1,67 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_SCREEN_H
+#define MBED_HD_SCREEN_H
+
+#include "mbed_hd_client.h"
+#include "mbed_hd_codec.h"
+#include "mbed_hd_xml.h"
+
+#define HDC15_SCREEN_WATCH  10
+/* layout hd_screen_encode() writes, bumped whenever it changes */
+#define HDC15_SCREEN_CODEC  1
+
+struct HDC15_ScreenParse;
+
+/* SAX callback context: which kind of item a watch fills in. */
+typedef struct HDC15_ScreenCtx
+{
+    struct HDC15_ScreenParse *parse;
+    uint8_t kind;
+} HDC15_ScreenCtx;
+
+/* Builds an HDC15_Screen from a GetProgram answer while it streams through
+ * the SAX parser set up with watch. Items beyond the capacity of the model
+ * are dropped together with everything below them. */
+typedef struct HDC15_ScreenParse
+{
+    HDC15_Screen *screen;
+    int8_t cur[HDC15_SCREEN_KINDS];      //< item being filled, -1: dropped
+    HDC15_ScreenCtx ctx[HDC15_SCREEN_KINDS];
+    HDC15_SaxWatch watch[HDC15_SCREEN_WATCH];
+} HDC15_ScreenParse;
+
+void hd_screen_parse_init(HDC15_ScreenParse *p, HDC15_Screen *screen);
+/* Make program the way an AddProgram of it leaves it, one area holding one
+ * resource of type, without fetching the model again. Returns -1 if the
+ * model has no room for them. */
+int hd_screen_program_set(HDC15_Screen *screen, int program,
+                          const char *area_guid, const char *res_guid,
+                          const char *type);
+/* The model item by item: count(1) per kind, then per item guid, name and
+ * type (NUL terminated) and parent(1). Errors are left in k. */
+void hd_screen_encode(HDC15_Codec *k, const HDC15_Screen *screen);
+/* Returns -1 if what k holds is not a model that fits HDC15_Screen. */
+int hd_screen_decode(HDC15_Codec *k, HDC15_Screen *screen);
+/* Index of the item of kind whose guid or name is key, or -1. */
+int hd_screen_lookup(const HDC15_Screen *screen, int kind, const char *key);
+const HDC15_Screen_Item *hd_screen_item(const HDC15_Screen *screen, int kind,
+                                        int index);
+
+#endif /* MBED_HD_SCREEN_H */
@@ -0,0 +1,469 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_sim.h"
+
+#if HDC15_SIM
+
+#include "mbed_hd_codec.h"
+#include "mbed_hd_frame.h"
+#include "mbed_hd_xml.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdlib.h>
+
+#define TRACE_GROUP "mbed_hd_sim"
+
+/* xml bytes per SDKCmdAnswer frame when no fragment size is configured */
+#define HD_SIM_FRAME  1024
+/* how often(ms) the server threads look at hd_sim.running */
+#define HD_SIM_POLL_MS 200
+
+/* uploads up to this size are kept so that ReadFileAsk can return them */
+#define HD_SIM_STORE   16384
+
+/* Transfer state of one connection; a FileStartAsk for the file that was
+ * left unfinished resumes it. */
+typedef struct HDC15_SimFile {
+  char md5[HDC15_MD5_LENGHT + 1];
+  char name[64];
+  uint64_t size;
+  uint64_t got;
+  char *data;              //< content, NULL if larger than HD_SIM_STORE
+} HDC15_SimFile;
+
+static struct {
+  HDC15_SimConfig cfg;
+  uint8_t id[HDC15_MAX_DEVICE_ID_LENGHT];
+  volatile bool running;
+  Thread *udp_thread;
+  Thread *tcp_thread;
+  HDC15_SimStats stats;
+  HDC15_SimFile file;
+  HDC15_SimFile stored;    //< last file completed
+} hd_sim;
+
+static void hd_sim_delay(void) {
+  if (hd_sim.cfg.latency_ms) {
+    ThisThread::sleep_for(std::chrono::milliseconds(hd_sim.cfg.latency_ms));
+  }
+}
+
+static void hd_sim_udp_run(void) {
+  UDPSocket sock;
+  sock.open(NetworkInterface::get_default_instance());
+  if (sock.bind(HDC15_UDP_PORT) != NSAPI_ERROR_OK) {
+    tr_err("sim udp bind failed.");
+    return;
+  }
+  sock.set_timeout(HD_SIM_POLL_MS);
+  while (hd_sim.running) {
+    uint8_t packet[HDC15_UDP_ANSWER_LENGTH];
+    HDC15_UdpHeader ask;
+    SocketAddress from;
+    int n = sock.recvfrom(&from, (char *)packet, sizeof(packet));
+    if (n != HDC15_UDP_ASK_LENGTH ||
+        hd_codec_udp_ask_decode(packet, n, &ask) != 0 ||
+        ask.cmd != SearchDeviceAsk) {
+      continue;
+    }
+    hd_sim_delay();
+    HDC15_UdpResponse ans;
+    memset(&ans, 0, sizeof(ans));
+    ans.version = HDC15_LOCAL_UDP_VERSION;
+    ans.cmd = SearchDeviceAnswer;
+    memcpy(ans.devID, hd_sim.id, HDC15_MAX_DEVICE_ID_LENGHT);
+    n = hd_codec_udp_answer(packet, sizeof(packet), &ans);
+    sock.sendto(from, (char *)packet, n);
+    hd_sim.stats.searches++;
+  }
+  sock.close();
+}
+
+static int hd_sim_send(TCPSocket *sock, uint16_t cmd, const void *body,
+                       uint16_t len) {
+  char frame[HDC15_FRAME_HEADER + 16];
+  int n = hd_codec_frame_body(frame, sizeof(frame), cmd, body, len);
+  if (n < 0) {
+    return -1;
+  }
+  hd_sim_delay();
+  return sock->send(frame, n) == n ? 0 : -1;
+}
+
+/* Answer with just a status word. */
+static int hd_sim_status(TCPSocket *sock, uint16_t cmd, uint16_t status) {
+  uint8_t body[2];
+  hd_le_put<uint16_t>(body, status);
+  return hd_sim_send(sock, cmd, body, sizeof(body));
+}
+
+/* Send xml as SDKCmdAnswer, cut into frames of cfg.fragment bytes. */
+static int hd_sim_send_xml(TCPSocket *sock, const char *xml, uint32_t total) {
+  uint32_t frag = hd_sim.cfg.fragment ? hd_sim.cfg.fragment : HD_SIM_FRAME;
+  if (frag > HD_SIM_FRAME) {
+    frag = HD_SIM_FRAME;
+  }
+  char frame[HDC15_TCP_HEADER_LENGTH + HD_SIM_FRAME];
+  hd_sim_delay();
+  for (uint32_t index = 0; index < total;) {
+    uint32_t n = total - index < frag ? total - index : frag;
+    int len = hd_codec_xml_frame(frame, sizeof(frame), SDKCmdAnswer, n, total,
+                                 index);
+    if (len < 0) {
+      return -1;
+    }
+    memcpy(&frame[HDC15_TCP_HEADER_LENGTH], &xml[index], n);
+    if (sock->send(frame, len) != len) {
+      return -1;
+    }
+    index += n;
+  }
+  return 0;
+}
+
+static void hd_sim_method(void *ctx, const char *value) {
+  strlcpy((char *)ctx, value, HDC15_SAX_MAX_NAME);
+}
+
+/* Append printf output to buf, growing it. */
+static int hd_sim_printf(HDC15_Buffer *buf, const char *fmt, ...) {
+  for (int round = 0; round < 2; round++) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+      return -1;
+    }
+    if (buf->len + n < buf->cap) {
+      buf->len += n;
+      return 0;
+    }
+    if (hd_buffer_reserve(buf, buf->cap * 2 + n + 1) != 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static int hd_sim_command(TCPSocket *sock, HDC15_FrameReader *rx,
+                          const char *guid, HDC15_Buffer *out) {
+  char method[HDC15_SAX_MAX_NAME] = "";
+  HDC15_SaxWatch watch = {"sdk/in", "method", hd_sim_method, method};
+  HDC15_SaxParser sax;
+  hd_sax_init(&sax, &watch, 1);
+  hd_sax_feed(&sax, rx->payload.data, rx->payload.len);
+  if (hd_sim.cfg.xml_cb) {
+    hd_sim.cfg.xml_cb(hd_sim.cfg.xml_ctx, rx->payload.data, rx->payload.len);
+  }
+
+  out->len = 0;
+  if (hd_buffer_reserve(out, 512) != 0) {
+    return -1;
+  }
+  int ret = hd_sim_printf(out,
+                          "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                          "<sdk guid=\"%s\">\n"
+                          "    <out method=\"%s\" result=\"kSuccess\">\n",
+                          guid, method);
+  if (strcmp(method, "GetIFVersion") == 0) {
+    ret |= hd_sim_printf(out, "        <version value=\"1000000\"/>\n");
+  } else if (strcmp(method, "GetProgram") == 0) {
+    ret |= hd_sim_printf(out, "        <screen>\n");
+    for (int i = 0; i < hd_sim.cfg.programs; i++) {
+      ret |= hd_sim_printf(out,
+                           "            <program guid=\"%08x-0000-4000-8000-"
+                           "%012x\" type=\"normal\"/>\n",
+                           i, i);
+    }
+    ret |= hd_sim_printf(out, "        </screen>\n");
+  }
+  ret |= hd_sim_printf(out, "    </out>\n</sdk>\n");
+  if (ret != 0) {
+    return -1;
+  }
+  hd_sim.stats.commands++;
+  return hd_sim_send_xml(sock, out->data, out->len);
+}
+
+/* FileStartAsk: md5(33) size(8) type(2) name. */
+static int hd_sim_file_start(TCPSocket *sock, HDC15_FrameReader *rx) {
+  HDC15_SimFile *f = &hd_sim.file;
+  char frame[HDC15_FRAME_HEADER + 10];
+  char md5[HDC15_MD5_LENGHT + 1];
+  uint64_t size;
+  uint16_t type;
+  const char *name;
+  if (hd_codec_file_start_decode(rx->payload.data, rx->payload.len, md5,
+                                 &size, &type, &name) != 0) {
+    int n = hd_codec_file_start_answer(frame, sizeof(frame), kInvalidParam, 0);
+    hd_sim_delay();
+    return sock->send(frame, n) == n ? 0 : -1;
+  }
+  if (strcmp(f->md5, md5) != 0 || f->size != size || f->got >= size) {
+    memcpy(f->md5, md5, sizeof(f->md5));
+    strlcpy(f->name, name, sizeof(f->name));
+    f->size = size;
+    f->got = 0;
+    free(f->data);
+    f->data = size <= HD_SIM_STORE ? (char *)malloc(size + 1) : NULL;
+  }
+  int n = hd_codec_file_start_answer(frame, sizeof(frame), kSuccess, f->got);
+  hd_sim_delay();
+  return sock->send(frame, n) == n ? 0 : -1;
+}
+
+static void hd_sim_file_content(HDC15_FrameReader *rx) {
+  HDC15_SimFile *f = &hd_sim.file;
+  if (f->data && f->got + rx->payload.len <= f->size) {
+    memcpy(&f->data[f->got], rx->payload.data, rx->payload.len);
+  }
+  f->got += rx->payload.len;
+  hd_sim.stats.file_bytes += rx->payload.len;
+}
+
+static uint16_t hd_sim_file_end(void) {
+  HDC15_SimFile *f = &hd_sim.file;
+  uint16_t status = kSuccess;
+  if (f->got != f->size) {
+    status = kFileNotFinish;
+  } else {
+    hd_sim.stats.files++;
+    free(hd_sim.stored.data);
+    hd_sim.stored = *f;
+    f->data = NULL;
+  }
+  f->md5[0] = '\0';
+  return status;
+}
+
+/* ReadFileAsk: offset(8) size(4) type(2) name. */
+static int hd_sim_file_read(TCPSocket *sock, HDC15_FrameReader *rx,
+                            HDC15_Buffer *out) {
+  HDC15_SimFile *f = &hd_sim.stored;
+  uint16_t status = kSuccess;
+  uint64_t offset = 0;
+  uint32_t size = 0;
+  uint16_t type;
+  const char *name;
+  if (hd_codec_read_ask_decode(rx->payload.data, rx->payload.len, &offset,
+                               &size, &type, &name) != 0) {
+    status = kInvalidParam;
+  } else {
+    if (f->md5[0] == '\0' || strcmp(name, f->name) != 0) {
+      status = kFileNotFound;
+    } else if (f->data == NULL) {
+      status = kReadFileFailed;
+    } else if (offset > f->size) {
+      status = kInvalidParam;
+    }
+  }
+  uint32_t n = 0;
+  if (status == kSuccess) {
+    n = f->size - offset < size ? f->size - offset : size;
+    if (n > HDC15_FILE_CHUNK_SIZE) {
+      n = HDC15_FILE_CHUNK_SIZE;
+    }
+  }
+  if (hd_buffer_reserve(out, HDC15_FRAME_HEADER + HDC15_READ_ANSWER_HEADER +
+                                n) != 0) {
+    return -1;
+  }
+  char *frame = out->data;
+  bool ok = status == kSuccess;
+  int len = hd_codec_read_answer(frame, out->cap, status, ok ? f->size : 0,
+                                 ok ? f->md5 : NULL, n);
+  if (len < 0) {
+    return -1;
+  }
+  if (ok) {
+    memcpy(&frame[HDC15_FRAME_HEADER + HDC15_READ_ANSWER_HEADER],
+           &f->data[offset], n);
+  }
+  hd_sim_delay();
+  hd_sim.stats.read_bytes += n;
+  return sock->send(frame, len) == len ? 0 : -1;
+}
+
+/* Answer the requests of one connection until it closes. */
+static void hd_sim_serve(TCPSocket *sock) {
+  HDC15_FrameReader rx = {};
+  HDC15_Buffer out = {};
+  char guid[HDC15_GUID_SIZE];
+  snprintf(guid, sizeof(guid), "sim%08x", (unsigned)hd_sim.stats.sessions);
+  sock->set_timeout(HD_SIM_POLL_MS);
+  while (hd_sim.running) {
+    int ret = hd_frame_read(&rx, sock);
+    if (ret == 0) {
+      continue;
+    }
+    if (ret < 0) {
+      break;
+    }
+    uint16_t status = kSuccess;
+    uint32_t version = HDC15_LOCAL_TCP_VERSION;
+    uint8_t body[4];
+    switch (rx.cmd) {
+    case TcpHeartbeatAsk:
+      ret = hd_sim_send(sock, TcpHeartbeatAnswer, NULL, 0);
+      break;
+    case SDKServiceAsk:
+      hd_le_put<uint32_t>(body, version);
+      ret = hd_sim_send(sock, SDKServiceAnswer, body, sizeof(version));
+      break;
+    case SDKCmdAsk:
+      ret = hd_sim_command(sock, &rx, guid, &out);
+      break;
+    case FileStartAsk:
+      ret = hd_sim_file_start(sock, &rx);
+      break;
+    case FileContentAsk:
+      hd_sim_file_content(&rx);
+      ret = hd_sim_status(sock, FileContentAnswer, status);
+      break;
+    case FileEndAsk:
+      status = hd_sim_file_end();
+      ret = hd_sim_status(sock, FileEndAnswer, status);
+      break;
+    case ReadFileAsk:
+      ret = hd_sim_file_read(sock, &rx, &out);
+      break;
+    default:
+      status = kInvalidMethod;
+      ret = hd_sim_status(sock, ErrorAnswer, status);
+      break;
+    }
+    if (ret != 0) {
+      break;
+    }
+  }
+  hd_frame_free(&rx);
+  hd_buffer_free(&out);
+}
+
+static void hd_sim_tcp_run(void) {
+  TCPSocket server;
+  server.open(NetworkInterface::get_default_instance());
+  if (server.bind(HDC15_TCP_PORT) != NSAPI_ERROR_OK ||
+      server.listen(1) != NSAPI_ERROR_OK) {
+    tr_err("sim tcp listen failed.");
+    return;
+  }
+  server.set_timeout(HD_SIM_POLL_MS);
+  while (hd_sim.running) {
+    nsapi_error_t err;
+    TCPSocket *sock = server.accept(&err);
+    if (sock == NULL) {
+      continue;
+    }
+    hd_sim.stats.sessions++;
+    hd_sim_serve(sock);
+    sock->close();
+  }
+  server.close();
+}
+
+int hd_sim_start(const HDC15_SimConfig *cfg) {
+  if (hd_sim.running) {
+    return -1;
+  }
+  memset(&hd_sim.cfg, 0, sizeof(hd_sim.cfg));
+  hd_sim.cfg.programs = 2;
+  if (cfg) {
+    hd_sim.cfg = *cfg;
+  }
+  const char *id = hd_sim.cfg.dev_id ? hd_sim.cfg.dev_id : "SIM-0000000000";
+  memset(hd_sim.id, 0, sizeof(hd_sim.id));
+  memcpy(hd_sim.id, id, strnlen(id, HDC15_MAX_DEVICE_ID_LENGHT));
+  memset(&hd_sim.stats, 0, sizeof(hd_sim.stats));
+  free(hd_sim.file.data);
+  free(hd_sim.stored.data);
+  memset(&hd_sim.file, 0, sizeof(hd_sim.file));
+  memset(&hd_sim.stored, 0, sizeof(hd_sim.stored));
+
+  hd_sim.running = true;
+  hd_sim.udp_thread = new (std::nothrow) Thread(
+      osPriorityNormal, HDC15_SIM_STACK_SIZE, NULL, "hd_sim_udp");
+  hd_sim.tcp_thread = new (std::nothrow) Thread(
+      osPriorityNormal, HDC15_SIM_STACK_SIZE, NULL, "hd_sim_tcp");
+  if (hd_sim.udp_thread == NULL || hd_sim.tcp_thread == NULL ||
+      hd_sim.udp_thread->start(callback(hd_sim_udp_run)) != osOK ||
+      hd_sim.tcp_thread->start(callback(hd_sim_tcp_run)) != osOK) {
+    tr_err("sim threads failed.");
+    hd_sim_stop();
+    return -1;
+  }
+  tr_info("sim %s up", id);
+  return 0;
+}
+
+void hd_sim_stop(void) {
+  hd_sim.running = false;
+  if (hd_sim.udp_thread) {
+    hd_sim.udp_thread->join();
+    delete hd_sim.udp_thread;
+    hd_sim.udp_thread = NULL;
+  }
+  if (hd_sim.tcp_thread) {
+    hd_sim.tcp_thread->join();
+    delete hd_sim.tcp_thread;
+    hd_sim.tcp_thread = NULL;
+  }
+}
+
+void hd_sim_stats(HDC15_SimStats *stats) {
+  *stats = hd_sim.stats;
+}
+
+#ifdef MBED_USER_ONEOS
+#include "oneos.h"
+
+#if MBED_CONF_ONEOS_OS_USING_SHELL
+
+static void hd_sim_cmd(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Please input: hd_sim <start|stop|stats> [latency] [fragment] "
+           "[programs]\n");
+    return;
+  }
+  if (strcmp(argv[1], "start") == 0) {
+    HDC15_SimConfig cfg = {};
+    cfg.latency_ms = argc > 2 ? atoi(argv[2]) : 0;
+    cfg.fragment = argc > 3 ? atoi(argv[3]) : 0;
+    cfg.programs = argc > 4 ? atoi(argv[4]) : 2;
+    printf("sim %s\n", hd_sim_start(&cfg) == 0 ? "started" : "failed");
+  } else if (strcmp(argv[1], "stop") == 0) {
+    hd_sim_stop();
+  } else {
+    HDC15_SimStats st;
+    hd_sim_stats(&st);
+    printf("searches %u sessions %u commands %u files %u bytes %u read %u\n",
+           (unsigned)st.searches, (unsigned)st.sessions,
+           (unsigned)st.commands, (unsigned)st.files,
+           (unsigned)st.file_bytes, (unsigned)st.read_bytes);
+  }
+}
+SH_CMD_EXPORT(hd_sim, hd_sim_cmd, "hd_sim <start|stop|stats>");
+#endif
+
+#endif
+
+#endif /* HDC15_SIM */
@@ -0,0 +1,75 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_SIM_H
+#define MBED_HD_SIM_H
+
+#include "mbed_hd_client.h"
+
+/* The simulated controller is only built with HDC15_SIM set, e.g. through
+ * "macros" in mbed_app.json. */
+#ifndef HDC15_SIM
+#define HDC15_SIM 0
+#endif
+#ifndef HDC15_SIM_STACK_SIZE
+#define HDC15_SIM_STACK_SIZE  4096
+#endif
+
+/* An SDKCmdAsk document as the controller received it. */
+typedef void (*hd_sim_xml_callback)(void *ctx, const char *xml, size_t len);
+
+typedef struct HDC15_SimConfig
+{
+    const char *dev_id;      //< 设备ID, NULL: "SIM-0000000000"
+    uint32_t latency_ms;     //< delay before every answer
+    uint16_t fragment;       //< xml bytes per SDKCmdAnswer frame, 0: one frame
+    uint8_t programs;        //< programs GetProgram reports
+    hd_sim_xml_callback xml_cb;  //< sees every command, NULL: none
+    void *xml_ctx;
+} HDC15_SimConfig;
+
+typedef struct HDC15_SimStats
+{
+    uint32_t searches;       //< SearchDeviceAsk answered
+    uint32_t sessions;       //< TCP connections accepted
+    uint32_t commands;       //< SDKCmdAsk answered
+    uint32_t file_bytes;     //< FileContentAsk bytes received
+    uint32_t files;          //< files completed
+    uint32_t read_bytes;     //< ReadFileAnswer bytes sent
+} HDC15_SimStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Run a controller on this host: it answers SearchDeviceAsk on UDP and
+ * SDKServiceAsk, SDKCmdAsk, heartbeats, file transfers and readback of the
+ * last file uploaded (up to 16KB) on TCP, both on
+ * HDC15_UDP_PORT/HDC15_TCP_PORT. With HDC15_UDP_SCAN_ADDR set to the local
+ * address (e.g. "127.0.0.1") the client finds it like a real device. cfg NULL
+ * uses no latency, no fragmentation and two programs. host/CMakeLists.txt
+ * builds it with the client and hd_bench_run() for a POSIX host. */
+int hd_sim_start(const HDC15_SimConfig *cfg);
+void hd_sim_stop(void);
+void hd_sim_stats(HDC15_SimStats *stats);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_SIM_H */
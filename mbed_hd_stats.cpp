@@ -0,0 +1,183 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_stats.h"
+#include <cstdio>
+#include <cstring>
+
+#if HDC15_STATS
+
+/* Updated with atomic adds from any thread; max_us is a plain compare and
+ * store, so a concurrent update may lose a close maximum. */
+static HDC15_Stats hd_stats;
+
+uint32_t hd_stats_now(void) {
+  return us_ticker_read();
+}
+
+void hd_stats_since(int stage, uint32_t start) {
+  uint32_t us = us_ticker_read() - start;
+  HDC15_StageStats *st = &hd_stats.stage[stage];
+  int b = 0;
+  if (us >= HDC15_STATS_BUCKET0_US) {
+    b = 32 - __builtin_clz(us) - 7;
+    if (b >= HDC15_STATS_BUCKETS) {
+      b = HDC15_STATS_BUCKETS - 1;
+    }
+  }
+  core_util_atomic_incr_u32(&st->bucket[b], 1);
+  core_util_atomic_incr_u32(&st->count, 1);
+  core_util_atomic_fetch_add_u64(&st->sum_us, us);
+  if (us > st->max_us) {
+    st->max_us = us;
+  }
+}
+
+void hd_stats_tx(uint32_t bytes) {
+  core_util_atomic_incr_u32(&hd_stats.frames_tx, 1);
+  core_util_atomic_incr_u32(&hd_stats.bytes_tx, bytes);
+}
+
+void hd_stats_rx(uint32_t bytes) {
+  core_util_atomic_incr_u32(&hd_stats.frames_rx, 1);
+  core_util_atomic_incr_u32(&hd_stats.bytes_rx, bytes);
+}
+
+void hd_stats_timeout(void) {
+  core_util_atomic_incr_u32(&hd_stats.timeouts, 1);
+}
+
+void hd_stats_error(int code) {
+  if (code < kUnknown || code >= kCount) {
+    code = kUnknown;
+  }
+  core_util_atomic_incr_u32(&hd_stats.error[code + 1], 1);
+}
+
+void hd_stats_depth(int prio, uint32_t depth) {
+  if (depth > hd_stats.depth_max[prio]) {
+    hd_stats.depth_max[prio] = depth;
+  }
+}
+
+void hd_stats_dropped(int prio) {
+  core_util_atomic_incr_u32(&hd_stats.dropped[prio], 1);
+}
+
+void hd_stats_preempted(void) {
+  core_util_atomic_incr_u32(&hd_stats.preempted, 1);
+}
+
+int hd_stats_get(HDC15_Stats *stats) {
+  memcpy(stats, &hd_stats, sizeof(*stats));
+  return 0;
+}
+
+void hd_stats_reset(void) {
+  memset(&hd_stats, 0, sizeof(hd_stats));
+}
+
+#else
+
+int hd_stats_get(HDC15_Stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  return -1;
+}
+
+void hd_stats_reset(void) {}
+
+#endif
+
+uint32_t hd_stats_percentile(const HDC15_StageStats *st, int pct) {
+  uint32_t want = ((uint64_t)st->count * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (int b = 0; b < HDC15_STATS_BUCKETS - 1; b++) {
+    seen += st->bucket[b];
+    if (seen >= want) {
+      return HDC15_STATS_BUCKET0_US << b;
+    }
+  }
+  return st->max_us;
+}
+
+#ifdef MBED_USER_ONEOS
+#include "oneos.h"
+
+#if MBED_CONF_ONEOS_OS_USING_SHELL
+
+static void hd_stats_cmd(int argc, char **argv) {
+  static const char *const names[HDC15_STAT_NUM] = {
+      "scan",   "connect", "service", "guid", "xml",
+      "answer", "program", "w_urgent", "w_normal", "w_bulk"};
+  static const char *const prios[HDC15_PRIOS] = {"urgent", "normal", "bulk"};
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    hd_stats_reset();
+    return;
+  }
+  HDC15_Stats *st = new HDC15_Stats;
+  if (hd_stats_get(st) != 0) {
+    printf("stats compiled out (HDC15_STATS 0)\n");
+    delete st;
+    return;
+  }
+  printf("%-8s %8s %8s %8s %8s %8s\n", "stage", "count", "avg_us", "p50_us",
+         "p99_us", "max_us");
+  for (int i = 0; i < HDC15_STAT_NUM; i++) {
+    HDC15_StageStats *s = &st->stage[i];
+    if (s->count == 0) {
+      continue;
+    }
+    printf("%-8s %8u %8u %8u %8u %8u\n", names[i], (unsigned)s->count,
+           (unsigned)(s->sum_us / s->count),
+           (unsigned)hd_stats_percentile(s, 50),
+           (unsigned)hd_stats_percentile(s, 99), (unsigned)s->max_us);
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+      for (int b = 0; b < HDC15_STATS_BUCKETS; b++) {
+        bool last = b == HDC15_STATS_BUCKETS - 1;
+        if (s->bucket[b]) {
+          printf("  %s %8u %8u\n", last ? ">=" : "< ",
+                 (unsigned)(HDC15_STATS_BUCKET0_US << (last ? b - 1 : b)),
+                 (unsigned)s->bucket[b]);
+        }
+      }
+    }
+  }
+  printf("tx %u frames %u bytes, rx %u frames %u bytes, %u timeouts\n",
+         (unsigned)st->frames_tx, (unsigned)st->bytes_tx,
+         (unsigned)st->frames_rx, (unsigned)st->bytes_rx,
+         (unsigned)st->timeouts);
+  for (int code = kUnknown; code < kCount; code++) {
+    if (st->error[code + 1]) {
+      printf("error %d: %u\n", code, (unsigned)st->error[code + 1]);
+    }
+  }
+  for (int p = 0; p < HDC15_PRIOS; p++) {
+    if (st->depth_max[p] || st->dropped[p]) {
+      printf("%s: max %u waiting, %u dropped\n", prios[p],
+             (unsigned)st->depth_max[p], (unsigned)st->dropped[p]);
+    }
+  }
+  if (st->preempted) {
+    printf("%u transfers preempted\n", (unsigned)st->preempted);
+  }
+  delete st;
+}
+SH_CMD_EXPORT(hd_stats, hd_stats_cmd,
+              "show client timings and counters: hd_stats [-v|reset]");
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_STATS_H
+#define MBED_HD_STATS_H
+
+#include "mbed_hd_client.h"
+
+/* Timing histograms and traffic/error counters. Set HDC15_STATS to 0 (e.g.
+ * through "macros" in mbed_app.json) to compile the recording out; the
+ * hooks below are then empty inline functions. */
+#ifndef HDC15_STATS
+#define HDC15_STATS               1
+#endif
+/* bucket 0 counts times below 128us, each further bucket doubles the bound,
+ * the last one takes everything longer */
+#define HDC15_STATS_BUCKETS       16
+#define HDC15_STATS_BUCKET0_US    128
+
+enum HDC15_StatStage
+{
+    HDC15_STAT_SCAN = 0,     //< hd_scan/hd_discover, whole search window
+    HDC15_STAT_CONNECT,      //< TCP connect
+    HDC15_STAT_SERVICE,      //< SDKServiceAsk到SDKServiceAnswer
+    HDC15_STAT_GUID,         //< GetIFVersion取guid
+    HDC15_STAT_XML,          //< xml命令生成
+    HDC15_STAT_ANSWER,       //< SDKCmdAsk发送到SDKCmdAnswer
+    HDC15_STAT_PROGRAM,      //< hd_get_guid, whole GetProgram
+    HDC15_STAT_WAIT,         //< 等待设备调度, one per HDC15_Priority
+    HDC15_STAT_NUM = HDC15_STAT_WAIT + HDC15_PRIOS,
+};
+
+typedef struct HDC15_StageStats
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t bucket[HDC15_STATS_BUCKETS];
+} HDC15_StageStats;
+
+typedef struct HDC15_Stats
+{
+    HDC15_StageStats stage[HDC15_STAT_NUM];
+    uint32_t frames_tx;
+    uint32_t frames_rx;
+    uint32_t bytes_tx;
+    uint32_t bytes_rx;
+    uint32_t timeouts;                  //< receives that ran out of time
+    uint32_t error[kCount + 1];         //< by HDC15_ErrorCode + 1
+    uint32_t depth_max[HDC15_PRIOS];    //< most calls waiting for one device
+    uint32_t dropped[HDC15_PRIOS];      //< calls past their deadline
+    uint32_t preempted;                 //< transfers that gave way
+} HDC15_Stats;
+
+#if HDC15_STATS
+uint32_t hd_stats_now(void);
+/* Record the time since start (from hd_stats_now()) for stage. */
+void hd_stats_since(int stage, uint32_t start);
+void hd_stats_tx(uint32_t bytes);
+void hd_stats_rx(uint32_t bytes);
+void hd_stats_timeout(void);
+void hd_stats_error(int code);
+/* depth calls of class prio now wait for one device. */
+void hd_stats_depth(int prio, uint32_t depth);
+void hd_stats_dropped(int prio);
+void hd_stats_preempted(void);
+#else
+static inline uint32_t hd_stats_now(void) { return 0; }
+static inline void hd_stats_since(int, uint32_t) {}
+static inline void hd_stats_tx(uint32_t) {}
+static inline void hd_stats_rx(uint32_t) {}
+static inline void hd_stats_timeout(void) {}
+static inline void hd_stats_error(int) {}
+static inline void hd_stats_depth(int, uint32_t) {}
+static inline void hd_stats_dropped(int) {}
+static inline void hd_stats_preempted(void) {}
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Copy the counters, collected since boot or the last hd_stats_reset().
+ * Returns -1 when they are compiled out. */
+int hd_stats_get(HDC15_Stats *stats);
+void hd_stats_reset(void);
+/* Upper bound(us) of a stage's pct percentile, taken from its histogram. */
+uint32_t hd_stats_percentile(const HDC15_StageStats *st, int pct);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_STATS_H */
@@ -0,0 +1,273 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_update.h"
+#include "mbed_hd_error.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstring>
+#include <new>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+enum {
+  HD_UPDATE_TEXT = 0x1,    //< text changed since the last send
+  HD_UPDATE_PLAY = 0x2,    //< playControl changed since the last send
+};
+
+/* Latest state of one program of one device. */
+typedef struct HDC15_UpdateSlot {
+  int id;                  //< -1: unused
+  int guid;
+  uint8_t dirty;
+  bool en;
+  bool busy;               //< an UpdateProgram of it is on the way
+  int event;               //< scheduled send, 0: none
+  uint32_t next_ms;        //< earliest time of the next send
+  char text[HDC15_UPDATE_TEXT_MAX];
+} HDC15_UpdateSlot;
+
+/* mutex guards the slots; send_mutex is held while a command is sent, it
+ * also guards text, the copy being sent. The scheduled sends run on queue,
+ * dispatched by thread, so waiting for the controller holds up nobody
+ * else. */
+struct HDC15_Updater {
+  HDC15_Client *client;
+  uint32_t interval_ms;
+  Thread *thread;
+  EventQueue queue{(HDC15_UPDATE_SLOTS + 1) * EVENTS_EVENT_SIZE};
+  Mutex mutex;
+  Mutex send_mutex;
+  HDC15_UpdateStats stats;
+  char text[HDC15_UPDATE_TEXT_MAX];
+  HDC15_UpdateSlot slot[HDC15_UPDATE_SLOTS];
+};
+
+static uint32_t hd_update_now_ms(void) {
+  return (uint32_t)Kernel::Clock::now().time_since_epoch().count();
+}
+
+/* True if sl has nothing to send and nothing on the way. u->mutex is
+ * held. */
+static bool hd_update_idle(HDC15_UpdateSlot *sl) {
+  return sl->dirty == 0 && !sl->busy && sl->event == 0;
+}
+
+/* Slot of program guid of device id, taken if new: an unused one, or else
+ * the idle one sent longest ago. u->mutex is held. */
+static HDC15_UpdateSlot *hd_update_slot(HDC15_Updater *u, int id, int guid,
+                                        bool create) {
+  HDC15_UpdateSlot *free_slot = NULL;
+  for (int i = 0; i < HDC15_UPDATE_SLOTS; i++) {
+    HDC15_UpdateSlot *sl = &u->slot[i];
+    if (sl->id == id && sl->guid == guid) {
+      return sl;
+    }
+    if (sl->id < 0) {
+      if (free_slot == NULL || free_slot->id >= 0) {
+        free_slot = sl;
+      }
+    } else if (hd_update_idle(sl) &&
+               (free_slot == NULL ||
+                (free_slot->id >= 0 &&
+                 (int32_t)(sl->next_ms - free_slot->next_ms) < 0))) {
+      free_slot = sl;
+    }
+  }
+  if (!create || free_slot == NULL) {
+    if (create) {
+      tr_err("%d: no update slot for program %d.", id, guid);
+    }
+    return NULL;
+  }
+  free_slot->id = id;
+  free_slot->guid = guid;
+  /* the interval is kept per program, a new one may go out at once */
+  free_slot->next_ms = hd_update_now_ms();
+  return free_slot;
+}
+
+static void hd_update_run(HDC15_Updater *u, HDC15_UpdateSlot *sl);
+
+/* Have sl sent once it is due. u->mutex is held. */
+static void hd_update_schedule(HDC15_Updater *u, HDC15_UpdateSlot *sl) {
+  if (sl->event || sl->busy || sl->dirty == 0) {
+    return;
+  }
+  int32_t delay = (int32_t)(sl->next_ms - hd_update_now_ms());
+  if (delay < 0) {
+    delay = 0;
+  }
+  sl->event = u->queue.call_in(std::chrono::milliseconds(delay),
+                               hd_update_run, u, sl);
+  if (sl->event == 0) {
+    tr_err("%d: update event failed.", sl->id);
+  }
+}
+
+/* Send everything pending for sl as one UpdateProgram and wait for it. */
+static int hd_update_send(HDC15_Updater *u, HDC15_UpdateSlot *sl) {
+  ScopedLock<Mutex> send_lock(u->send_mutex);
+  u->mutex.lock();
+  uint8_t dirty = sl->dirty;
+  int id = sl->id;
+  int guid = sl->guid;
+  int play = sl->en;
+  if (dirty & HD_UPDATE_TEXT) {
+    strlcpy(u->text, sl->text, sizeof(u->text));
+  }
+  sl->dirty = 0;
+  sl->busy = dirty != 0;
+  u->mutex.unlock();
+  if (dirty == 0) {
+    return 0;
+  }
+
+  int ret = hdc_program_update(u->client, id, guid,
+                               (dirty & HD_UPDATE_PLAY) ? play : -1,
+                               (dirty & HD_UPDATE_TEXT) ? u->text : NULL);
+
+  ScopedLock<Mutex> lock(u->mutex);
+  sl->busy = false;
+  uint32_t wait = u->interval_ms;
+  if (ret == kSuccess) {
+    u->stats.sent++;
+  } else if (ret > kSuccess && hd_error_policy(ret) == HDC15_RETRY_NEVER) {
+    /* the controller refused it, sending it again would not help */
+    u->stats.failed++;
+    tr_err("%d: update %s dropped.", id, hd_error_name(ret));
+  } else {
+    /* keep what has not been superseded meanwhile and try again later */
+    u->stats.failed++;
+    sl->dirty |= dirty;
+    if (wait < HDC15_UPDATE_RETRY_MS) {
+      wait = HDC15_UPDATE_RETRY_MS;
+    }
+  }
+  sl->next_ms = hd_update_now_ms() + wait;
+  hd_update_schedule(u, sl);
+  return ret;
+}
+
+static void hd_update_run(HDC15_Updater *u, HDC15_UpdateSlot *sl) {
+  u->mutex.lock();
+  sl->event = 0;
+  u->mutex.unlock();
+  hd_update_send(u, sl);
+}
+
+HDC15_Updater *hd_update_new(HDC15_Client *c, uint32_t min_interval_ms) {
+  HDC15_Updater *u = new (std::nothrow) HDC15_Updater();
+  if (u == NULL) {
+    return NULL;
+  }
+  u->client = c ? c : hdc_default();
+  u->interval_ms = min_interval_ms;
+  for (int i = 0; i < HDC15_UPDATE_SLOTS; i++) {
+    u->slot[i].id = -1;
+  }
+  u->thread = new (std::nothrow) Thread(osPriorityBelowNormal,
+                                        HDC15_UPDATE_STACK_SIZE, NULL,
+                                        "hd_update");
+  if (u->thread == NULL ||
+      u->thread->start([u]() { u->queue.dispatch_forever(); }) != osOK) {
+    tr_err("Update thread failed.");
+    delete u->thread;
+    delete u;
+    return NULL;
+  }
+  return u;
+}
+
+/* Must not be called from a callback of the client, which may run on the
+ * updater's thread. */
+void hd_update_free(HDC15_Updater *u) {
+  if (u == NULL) {
+    return;
+  }
+  u->mutex.lock();
+  for (int i = 0; i < HDC15_UPDATE_SLOTS; i++) {
+    HDC15_UpdateSlot *sl = &u->slot[i];
+    if (sl->event) {
+      u->queue.cancel(sl->event);
+      sl->event = 0;
+    }
+    sl->dirty = 0;
+  }
+  u->mutex.unlock();
+  /* a send that was already dispatched finishes first */
+  u->queue.break_dispatch();
+  u->thread->join();
+  delete u->thread;
+  u->send_mutex.lock();
+  u->send_mutex.unlock();
+  delete u;
+}
+
+int hd_update_text(HDC15_Updater *u, int id, int guid,
+                   const char *text_string) {
+  if (strlen(text_string) >= HDC15_UPDATE_TEXT_MAX) {
+    tr_err("update text too long.");
+    return -1;
+  }
+  ScopedLock<Mutex> lock(u->mutex);
+  HDC15_UpdateSlot *sl = hd_update_slot(u, id, guid, true);
+  if (sl == NULL) {
+    return -1;
+  }
+  u->stats.requests++;
+  strlcpy(sl->text, text_string, sizeof(sl->text));
+  sl->dirty |= HD_UPDATE_TEXT;
+  hd_update_schedule(u, sl);
+  return 0;
+}
+
+int hd_update_play(HDC15_Updater *u, int id, int guid, bool en) {
+  ScopedLock<Mutex> lock(u->mutex);
+  HDC15_UpdateSlot *sl = hd_update_slot(u, id, guid, true);
+  if (sl == NULL) {
+    return -1;
+  }
+  u->stats.requests++;
+  sl->en = en;
+  sl->dirty |= HD_UPDATE_PLAY;
+  hd_update_schedule(u, sl);
+  return 0;
+}
+
+int hd_update_flush(HDC15_Updater *u, int id) {
+  int ret = 0;
+  for (int i = 0; i < HDC15_UPDATE_SLOTS; i++) {
+    HDC15_UpdateSlot *sl = &u->slot[i];
+    u->mutex.lock();
+    bool mine = sl->id == id && sl->dirty;
+    if (mine && sl->event) {
+      /* if it is running already it finds nothing left to send */
+      u->queue.cancel(sl->event);
+      sl->event = 0;
+    }
+    u->mutex.unlock();
+    if (mine && hd_update_send(u, sl) != 0) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+void hd_update_stats(HDC15_Updater *u, HDC15_UpdateStats *stats) {
+  ScopedLock<Mutex> lock(u->mutex);
+  *stats = u->stats;
+}
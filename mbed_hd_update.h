@@ -0,0 +1,73 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_UPDATE_H
+#define MBED_HD_UPDATE_H
+
+#include "mbed_hd_client.h"
+
+/* programs an updater tracks at once; past that the idle one sent longest
+ * ago is reused */
+#ifndef HDC15_UPDATE_SLOTS
+#define HDC15_UPDATE_SLOTS        16
+#endif
+/* longest text kept for a pending update, including the NUL */
+#ifndef HDC15_UPDATE_TEXT_MAX
+#define HDC15_UPDATE_TEXT_MAX     512
+#endif
+#ifndef HDC15_UPDATE_STACK_SIZE
+#define HDC15_UPDATE_STACK_SIZE   4096
+#endif
+/* delay(ms) before a failed update is tried again */
+#ifndef HDC15_UPDATE_RETRY_MS
+#define HDC15_UPDATE_RETRY_MS     1000
+#endif
+
+typedef struct HDC15_Updater HDC15_Updater;
+
+typedef struct HDC15_UpdateStats
+{
+    uint32_t requests;       //< hd_update_text/hd_update_play calls
+    uint32_t sent;           //< UpdateProgram commands sent
+    uint32_t failed;
+} HDC15_UpdateStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Coalescing front end for text and playControl changes of client c (NULL:
+ * the default client). Only the latest value per device and program is
+ * kept; text and playControl changes of one program go out together as one
+ * UpdateProgram, no sooner than min_interval_ms after the previous one and
+ * never before the controller acknowledged it. The commands are sent from
+ * a thread of the updater's own. */
+HDC15_Updater *hd_update_new(HDC15_Client *c, uint32_t min_interval_ms);
+void hd_update_free(HDC15_Updater *u);
+int hd_update_text(HDC15_Updater *u, int id, int guid, const char *text_string);
+int hd_update_play(HDC15_Updater *u, int id, int guid, bool en);
+/* Send whatever is pending for device id now, regardless of the rate, and
+ * wait for it. */
+int hd_update_flush(HDC15_Updater *u, int id);
+void hd_update_stats(HDC15_Updater *u, HDC15_UpdateStats *stats);
+
+#ifdef __cplusplus
+} // closing brace for extern "C"
+#endif
+
+#endif /* MBED_HD_UPDATE_H */
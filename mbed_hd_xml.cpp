@@ -0,0 +1,741 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+#include "mbed_hd_xml.h"
+#include "mbed-trace/mbed_trace.h" // Required for mbed_trace_*
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+
+#define TRACE_GROUP "mbed_hd_client"
+
+static const struct {
+  const char *name;
+  uint8_t kind;
+} hd_xml_slot_names[] = {
+    {"GUID", HDC15_SLOT_GUID}, {"guid", HDC15_SLOT_PROGRAM},
+    {"en", HDC15_SLOT_EN},     {"str", HDC15_SLOT_STR},
+    {"CMD", HDC15_SLOT_CMD},   {"area", HDC15_SLOT_AREA},
+    {"res", HDC15_SLOT_RES},
+};
+
+int hd_xml_compile(HDC15_XmlTemplate *t) {
+  const char *xml = t->xml;
+  size_t len = strlen(xml);
+  t->num = 0;
+  for (const char *p = strstr(xml, "##"); p; p = strstr(p, "##")) {
+    size_t off = p - xml;
+    size_t name_len = 0;
+    uint8_t kind = HDC15_SLOT_NUM;
+    for (size_t i = 0; i < sizeof(hd_xml_slot_names) / sizeof(hd_xml_slot_names[0]); i++) {
+      size_t n = strlen(hd_xml_slot_names[i].name);
+      if (strncmp(p + 2, hd_xml_slot_names[i].name, n) == 0 && n > name_len) {
+        name_len = n;
+        kind = hd_xml_slot_names[i].kind;
+      }
+    }
+    if (kind == HDC15_SLOT_NUM || t->num >= HDC15_XML_MAX_SLOTS || off == 0) {
+      tr_err("template slot at %u failed.", (unsigned)off);
+      return -1;
+    }
+    HDC15_XmlSlot *slot = &t->slot[t->num];
+    const char *next = p + 2 + name_len;
+    slot->offset = off;
+    slot->len = 2 + name_len;
+    slot->kind = kind;
+    if (p[-1] == '"' && *next == '"') {
+      slot->text = 0;
+      slot->close = 0;
+    } else if (p[-1] == '>' && strncmp(next, "</", 2) == 0 &&
+               strchr(next, '>')) {
+      slot->text = 1;
+      slot->close = strchr(next, '>') + 1 - xml;
+    } else {
+      tr_err("template slot at %u is not an attribute or text.", (unsigned)off);
+      return -1;
+    }
+    t->num++;
+    p = next;
+  }
+  t->len = len;
+  t->ready = true;
+  return 0;
+}
+
+static hd_xml_decode_callback hd_xml_decoder;
+
+void hd_xml_set_decoder(hd_xml_decode_callback dec) {
+  hd_xml_decoder = dec;
+}
+
+size_t hd_utf8_valid(const char *s, size_t len) {
+  const unsigned char *p = (const unsigned char *)s;
+  size_t i = 0;
+  while (i < len) {
+    /* plain ASCII a word at a time, it is most of any text */
+    while (len - i >= 4) {
+      uint32_t w;
+      memcpy(&w, &p[i], 4);
+      if (w & 0x80808080u) {
+        break;
+      }
+      i += 4;
+    }
+    if (i == len) {
+      break;
+    }
+    unsigned char c = p[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    size_t n;
+    uint32_t ucs;
+    uint32_t min;
+    if (c >= 0xc2 && c <= 0xdf) {
+      n = 2;
+      ucs = c & 0x1f;
+      min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+      n = 3;
+      ucs = c & 0x0f;
+      min = 0x800;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      n = 4;
+      ucs = c & 0x07;
+      min = 0x10000;
+    } else {
+      return i;
+    }
+    if (len - i < n) {
+      return i;
+    }
+    for (size_t k = 1; k < n; k++) {
+      if ((p[i + k] & 0xc0) != 0x80) {
+        return i;
+      }
+      ucs = (ucs << 6) | (p[i + k] & 0x3f);
+    }
+    /* overlong forms, UTF-16 surrogates and past U+10FFFF */
+    if (ucs < min || ucs > 0x10ffff || (ucs >= 0xd800 && ucs <= 0xdfff)) {
+      return i;
+    }
+    i += n;
+  }
+  return len;
+}
+
+static bool hd_xml_space(unsigned char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+/* "&#x41;" at value[i]: decode it, return its length or 0 if malformed. */
+static size_t hd_xml_charref(const char *value, uint32_t *ucs) {
+  if (value[0] != '&' || value[1] != '#' || value[2] != 'x') {
+    return 0;
+  }
+  uint32_t v = 0;
+  size_t i = 3;
+  for (; value[i] && value[i] != ';'; i++) {
+    char c = value[i];
+    if (i >= 3 + 8) {
+      return 0;
+    }
+    if (c >= '0' && c <= '9') {
+      v = v * 16 + (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      v = v * 16 + (c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      v = v * 16 + (c - 'A' + 10);
+    } else {
+      return 0;
+    }
+  }
+  if (value[i] != ';' || i == 3 || v == 0) {
+    return 0;
+  }
+  *ucs = v;
+  return i + 1;
+}
+
+static size_t hd_xml_utf8(uint32_t ucs, char *out) {
+  if (ucs < 0x80) {
+    out[0] = (char)ucs;
+    return 1;
+  } else if (ucs < 0x800) {
+    out[0] = (char)(0xc0 | (ucs >> 6));
+    out[1] = (char)(0x80 | (ucs & 0x3f));
+    return 2;
+  } else if (ucs < 0x10000) {
+    out[0] = (char)(0xe0 | (ucs >> 12));
+    out[1] = (char)(0x80 | ((ucs >> 6) & 0x3f));
+    out[2] = (char)(0x80 | (ucs & 0x3f));
+    return 3;
+  } else if (ucs < 0x200000) {
+    out[0] = (char)(0xf0 | (ucs >> 18));
+    out[1] = (char)(0x80 | ((ucs >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((ucs >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (ucs & 0x3f));
+    return 4;
+  }
+  return 0;
+}
+
+/* Bytes hd_xml_encode() prints unchanged. */
+static bool hd_xml_plain(unsigned char c) {
+  return c >= 32 && c != '&' && c != '<' && c != '>' && c != '"' &&
+         c != '\'';
+}
+
+/* TiXmlBase::EncodeString of the character at src[0]: returns the bytes to
+ * print in *out and their length; "&#x" references pass through unchanged. */
+static size_t hd_xml_encode(const char *src, size_t len, const char **out,
+                            char *hex, size_t *used) {
+  unsigned char c = (unsigned char)src[0];
+  *used = 1;
+  *out = src;
+  if (c == '&' && len > 2 && src[1] == '#' && src[2] == 'x') {
+    size_t n = 1;
+    while (n < len - 1 && src[n] != ';') {
+      n++;
+    }
+    *used = n;
+    return n;
+  }
+  switch (c) {
+  case '&':
+    *out = "&amp;";
+    return 5;
+  case '<':
+    *out = "&lt;";
+    return 4;
+  case '>':
+    *out = "&gt;";
+    return 4;
+  case '"':
+    *out = "&quot;";
+    return 6;
+  case '\'':
+    *out = "&apos;";
+    return 6;
+  default:
+    if (c < 32) {
+      *out = hex;
+      return snprintf(hex, 8, "&#x%02X;", c);
+    }
+    return 1;
+  }
+}
+
+int hd_xml_escape(char *buf, size_t size, const char *value, bool text,
+                  uint8_t *flags) {
+  *flags = 0;
+  if (value == NULL) {
+    value = "";
+  }
+  size_t vlen = strlen(value);
+  /* text that is not UTF-8 as a whole is taken to be in the legacy charset
+   * of hd_xml_set_decoder(), where ASCII stands for itself */
+  bool legacy = false;
+  if (hd_utf8_valid(value, vlen) != vlen) {
+    if (hd_xml_decoder == NULL) {
+      return -2;
+    }
+    legacy = true;
+  }
+
+  /* Pass 1: the value TinyXML reads back from its own printed output. Only
+   * raw spaces take part in condensing; characters that were printed as
+   * references come back verbatim. */
+  size_t plen = 0;
+  bool pending_space = false;
+  bool leading = true;
+  bool blank = true;
+  for (size_t i = 0; i < vlen;) {
+    unsigned char c = (unsigned char)value[i];
+    char dec[4];
+    size_t dec_len = 1;
+    uint32_t ucs;
+    size_t ref = hd_xml_charref(&value[i], &ucs);
+    if (ref) {
+      dec_len = hd_xml_utf8(ucs, dec);
+      i += ref;
+    } else if (legacy && c >= 0x80) {
+      size_t n = hd_xml_decoder(&value[i], vlen - i, &ucs);
+      if (n == 0 || ucs < 0x80 || ucs > 0x10ffff ||
+          (ucs >= 0xd800 && ucs <= 0xdfff)) {
+        return -2;
+      }
+      dec_len = hd_xml_utf8(ucs, dec);
+      i += n;
+    } else {
+      if (text && c == ' ') {
+        pending_space = !leading;
+        i++;
+        continue;
+      }
+      /* SkipWhiteSpace also drops UTF-8 byte order marks up front */
+      if (text && leading && !legacy && c == 0xef && i + 2 < vlen &&
+          (((unsigned char)value[i + 1] == 0xbb &&
+            (unsigned char)value[i + 2] == 0xbf) ||
+           ((unsigned char)value[i + 1] == 0xbf &&
+            ((unsigned char)value[i + 2] == 0xbe ||
+             (unsigned char)value[i + 2] == 0xbf)))) {
+        i += 3;
+        continue;
+      }
+      dec[0] = (char)c;
+      i++;
+    }
+    if (plen + pending_space + dec_len > size) {
+      return -1;
+    }
+    if (pending_space) {
+      buf[plen++] = ' ';
+      pending_space = false;
+    }
+    for (size_t k = 0; k < dec_len; k++) {
+      if (!hd_xml_space((unsigned char)dec[k])) {
+        blank = false;
+      }
+      if (dec[k] == '"') {
+        *flags |= HDC15_XML_QUOT;
+      }
+    }
+    memcpy(&buf[plen], dec, dec_len);
+    plen += dec_len;
+    leading = false;
+  }
+  if (text && blank) {
+    *flags |= HDC15_XML_BLANK;
+    return 0;
+  }
+
+  /* Pass 2: print it again. Move the decoded value to the end of buf and
+   * encode forwards; the write position can only run into unread input when
+   * the result does not fit. */
+  size_t rd = size - plen;
+  memmove(&buf[rd], buf, plen);
+  size_t wr = 0;
+  while (rd < size) {
+    /* a run that prints as it is moves in one go, mostly all of the text */
+    size_t run = rd;
+    while (run < size && hd_xml_plain((unsigned char)buf[run])) {
+      run++;
+    }
+    if (run > rd) {
+      memmove(&buf[wr], &buf[rd], run - rd);
+      wr += run - rd;
+      rd = run;
+      continue;
+    }
+    const char *out;
+    char hex[8];
+    size_t used;
+    size_t n = hd_xml_encode(&buf[rd], size - rd, &out, hex, &used);
+    if (wr + n > rd + used) {
+      return -1;
+    }
+    memmove(&buf[wr], out, n);
+    wr += n;
+    rd += used;
+  }
+  return wr;
+}
+
+/* Render t into buf. Slots whose kind is set in keep are copied as
+ * placeholders and recorded in bound. */
+static int hd_xml_emit(HDC15_XmlTemplate *t, const char *const *values,
+                       uint32_t keep, HDC15_XmlTemplate *bound, char *buf,
+                       size_t size) {
+  if (!t->ready && hd_xml_compile(t) != 0) {
+    return -1;
+  }
+  size_t out = 0;
+  size_t pos = 0;
+  for (int i = 0; i <= t->num; i++) {
+    size_t lit_end = i < t->num ? t->slot[i].offset : t->len;
+    size_t n = lit_end - pos;
+    if (out + n + 1 > size) {
+      return -1;
+    }
+    memcpy(&buf[out], &t->xml[pos], n);
+    out += n;
+    if (i == t->num) {
+      break;
+    }
+    const HDC15_XmlSlot *slot = &t->slot[i];
+    if (keep & (1u << slot->kind)) {
+      if (out + slot->len + 1 > size) {
+        return -1;
+      }
+      HDC15_XmlSlot *b = &bound->slot[bound->num++];
+      *b = *slot;
+      b->offset = out;
+      if (slot->text) {
+        b->close = out + (slot->close - slot->offset);
+      }
+      memcpy(&buf[out], &t->xml[slot->offset], slot->len);
+      out += slot->len;
+      pos = slot->offset + slot->len;
+      continue;
+    }
+    uint8_t flags;
+    int len = hd_xml_escape(&buf[out], size - out - 1,
+                            values[slot->kind], slot->text, &flags);
+    if (len < 0) {
+      return len;
+    }
+    if (slot->text && (flags & HDC15_XML_BLANK)) {
+      /* no text node is left, so "<string>" prints as "<string />" */
+      if (out - 1 + 3 + 1 > size) {
+        return -1;
+      }
+      memcpy(&buf[out - 1], " />", 3);
+      out += 2;
+      pos = slot->close;
+      continue;
+    }
+    if (!slot->text && (flags & HDC15_XML_QUOT)) {
+      if (out + len + 1 + 1 > size) {
+        return -1;
+      }
+      buf[out - 1] = '\'';
+      out += len;
+      buf[out++] = '\'';
+      pos = slot->offset + slot->len + 1;
+      continue;
+    }
+    out += len;
+    pos = slot->offset + slot->len;
+  }
+  buf[out] = '\0';
+  return out;
+}
+
+int hd_xml_render(HDC15_XmlTemplate *t, const char *const *values, char *buf,
+                  size_t size) {
+  return hd_xml_emit(t, values, 0, NULL, buf, size);
+}
+
+int hd_xml_bind(HDC15_XmlTemplate *t, const char *const *values, uint32_t keep,
+                HDC15_XmlTemplate *bound, char *buf, size_t size) {
+  bound->num = 0;
+  int len = hd_xml_emit(t, values, keep, bound, buf, size);
+  if (len < 0) {
+    return len;
+  }
+  bound->xml = buf;
+  bound->len = len;
+  bound->ready = true;
+  return len;
+}
+
+enum {
+  HD_SAX_TEXT = 0,
+  HD_SAX_LT,
+  HD_SAX_NAME,
+  HD_SAX_TAG,
+  HD_SAX_ATTR_NAME,
+  HD_SAX_ATTR_EQ,
+  HD_SAX_ATTR_QUOTE,
+  HD_SAX_ATTR_VALUE,
+  HD_SAX_ENTITY,
+  HD_SAX_EMPTY,
+  HD_SAX_END_NAME,
+  HD_SAX_DECL,
+  HD_SAX_COMMENT,
+  HD_SAX_ERROR,
+};
+
+void hd_sax_init(HDC15_SaxParser *p, const HDC15_SaxWatch *watch, int num) {
+  memset(p, 0, sizeof(*p));
+  p->watch = watch;
+  p->watch_num = num > HDC15_SAX_MAX_WATCH ? HDC15_SAX_MAX_WATCH : num;
+}
+
+static bool hd_sax_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void hd_sax_put(HDC15_SaxParser *p, const char *data, size_t len) {
+  if (len > (size_t)(HDC15_SAX_MAX_VALUE - 1 - p->value_len)) {
+    len = HDC15_SAX_MAX_VALUE - 1 - p->value_len;
+  }
+  memcpy(&p->value[p->value_len], data, len);
+  p->value_len += len;
+}
+
+/* Call the active watches for attr (NULL: element start) with value. */
+static void hd_sax_emit(HDC15_SaxParser *p, const char *attr,
+                        const char *value) {
+  for (int i = 0; i < p->watch_num; i++) {
+    const HDC15_SaxWatch *w = &p->watch[i];
+    if (!(p->active & (1u << i))) {
+      continue;
+    }
+    if ((attr == NULL && w->attr == NULL) ||
+        (attr && w->attr && strcmp(attr, w->attr) == 0)) {
+      w->cb(w->ctx, value);
+    }
+  }
+}
+
+/* path matches watch, where a last element "*" stands for any element. */
+static bool hd_sax_path_match(const char *path, const char *watch) {
+  size_t n = strlen(watch);
+  if (n >= 2 && strcmp(&watch[n - 2], "/*") == 0) {
+    return strncmp(path, watch, n - 1) == 0 && path[n - 1] != '\0' &&
+           strchr(&path[n - 1], '/') == NULL;
+  }
+  return strcmp(path, watch) == 0;
+}
+
+static void hd_sax_match(HDC15_SaxParser *p) {
+  p->active = 0;
+  if (p->skip) {
+    return;
+  }
+  for (int i = 0; i < p->watch_num; i++) {
+    if (hd_sax_path_match(p->path, p->watch[i].path)) {
+      p->active |= 1u << i;
+    }
+  }
+}
+
+static bool hd_sax_text_wanted(HDC15_SaxParser *p) {
+  for (int i = 0; i < p->watch_num; i++) {
+    if ((p->active & (1u << i)) && p->watch[i].attr &&
+        strcmp(p->watch[i].attr, "#text") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void hd_sax_push(HDC15_SaxParser *p) {
+  p->name[p->name_len] = '\0';
+  size_t need = p->path_len + (p->path_len ? 1 : 0) + p->name_len;
+  if (p->skip || p->depth >= HDC15_SAX_MAX_DEPTH ||
+      need >= HDC15_SAX_MAX_PATH) {
+    p->skip++;
+    p->active = 0;
+    return;
+  }
+  p->mark[p->depth++] = p->path_len;
+  if (p->path_len) {
+    p->path[p->path_len++] = '/';
+  }
+  memcpy(&p->path[p->path_len], p->name, p->name_len);
+  p->path_len += p->name_len;
+  p->path[p->path_len] = '\0';
+  hd_sax_match(p);
+  hd_sax_emit(p, NULL, p->name);
+}
+
+static int hd_sax_pop(HDC15_SaxParser *p) {
+  if (p->skip) {
+    p->skip--;
+  } else if (p->depth == 0) {
+    return -1;
+  } else {
+    p->path_len = p->mark[--p->depth];
+    p->path[p->path_len] = '\0';
+  }
+  hd_sax_match(p);
+  p->value_len = 0;
+  return 0;
+}
+
+static void hd_sax_entity(HDC15_SaxParser *p) {
+  static const struct {
+    const char *name;
+    char c;
+  } named[] = {{"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'},
+               {"apos", '\''}};
+  const char *e = p->entity;
+  p->entity[p->entity_len] = '\0';
+  if (e[0] == '#') {
+    uint32_t ucs = (uint32_t)strtoul(e[1] == 'x' ? e + 2 : e + 1, NULL,
+                                     e[1] == 'x' ? 16 : 10);
+    char utf8[4];
+    hd_sax_put(p, utf8, hd_xml_utf8(ucs, utf8));
+    return;
+  }
+  for (size_t i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+    if (strcmp(e, named[i].name) == 0) {
+      hd_sax_put(p, &named[i].c, 1);
+      return;
+    }
+  }
+  hd_sax_put(p, "&", 1);
+  hd_sax_put(p, e, p->entity_len);
+  hd_sax_put(p, ";", 1);
+}
+
+int hd_sax_feed(HDC15_SaxParser *p, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (p->state) {
+    case HD_SAX_TEXT:
+      if (c == '<') {
+        if (p->value_len) {
+          p->value[p->value_len] = '\0';
+          hd_sax_emit(p, "#text", p->value);
+          p->value_len = 0;
+        }
+        p->state = HD_SAX_LT;
+      } else if (hd_sax_text_wanted(p)) {
+        if (c == '&') {
+          p->entity_len = 0;
+          p->quote = 0;
+          p->state = HD_SAX_ENTITY;
+        } else {
+          hd_sax_put(p, &c, 1);
+        }
+      }
+      break;
+    case HD_SAX_LT:
+      p->name_len = 0;
+      if (c == '?') {
+        p->state = HD_SAX_DECL;
+      } else if (c == '!') {
+        p->entity_len = 0;
+        p->state = HD_SAX_COMMENT;
+      } else if (c == '/') {
+        p->state = HD_SAX_END_NAME;
+      } else if (hd_sax_space(c) || c == '>') {
+        p->state = HD_SAX_ERROR;
+      } else {
+        p->name[p->name_len++] = c;
+        p->state = HD_SAX_NAME;
+      }
+      break;
+    case HD_SAX_NAME:
+      if (hd_sax_space(c) || c == '/' || c == '>') {
+        hd_sax_push(p);
+        p->state = c == '/' ? HD_SAX_EMPTY
+                            : (c == '>' ? HD_SAX_TEXT : HD_SAX_TAG);
+        p->value_len = 0;
+      } else if (p->name_len < HDC15_SAX_MAX_NAME - 1) {
+        p->name[p->name_len++] = c;
+      }
+      break;
+    case HD_SAX_TAG:
+      if (c == '/') {
+        p->state = HD_SAX_EMPTY;
+      } else if (c == '>') {
+        p->value_len = 0;
+        p->state = HD_SAX_TEXT;
+      } else if (!hd_sax_space(c)) {
+        p->name_len = 0;
+        p->name[p->name_len++] = c;
+        p->state = HD_SAX_ATTR_NAME;
+      }
+      break;
+    case HD_SAX_ATTR_NAME:
+      if (c == '=' || hd_sax_space(c)) {
+        p->name[p->name_len] = '\0';
+        p->state = c == '=' ? HD_SAX_ATTR_QUOTE : HD_SAX_ATTR_EQ;
+      } else if (p->name_len < HDC15_SAX_MAX_NAME - 1) {
+        p->name[p->name_len++] = c;
+      }
+      break;
+    case HD_SAX_ATTR_EQ:
+      if (c == '=') {
+        p->state = HD_SAX_ATTR_QUOTE;
+      } else if (!hd_sax_space(c)) {
+        p->state = HD_SAX_ERROR;
+      }
+      break;
+    case HD_SAX_ATTR_QUOTE:
+      if (c == '"' || c == '\'') {
+        p->quote = c;
+        p->value_len = 0;
+        p->state = HD_SAX_ATTR_VALUE;
+      } else if (!hd_sax_space(c)) {
+        p->state = HD_SAX_ERROR;
+      }
+      break;
+    case HD_SAX_ATTR_VALUE:
+      if (c == p->quote) {
+        p->value[p->value_len] = '\0';
+        if (p->active) {
+          hd_sax_emit(p, p->name, p->value);
+        }
+        p->quote = 0;
+        p->value_len = 0;
+        p->state = HD_SAX_TAG;
+      } else if (c == '&') {
+        p->entity_len = 0;
+        p->state = HD_SAX_ENTITY;
+      } else if (p->active) {
+        hd_sax_put(p, &c, 1);
+      }
+      break;
+    case HD_SAX_ENTITY:
+      if (c == ';') {
+        hd_sax_entity(p);
+        p->state = p->quote ? HD_SAX_ATTR_VALUE : HD_SAX_TEXT;
+      } else if (p->entity_len < sizeof(p->entity) - 1) {
+        p->entity[p->entity_len++] = c;
+      } else {
+        p->state = HD_SAX_ERROR;
+      }
+      break;
+    case HD_SAX_EMPTY:
+      if (c != '>' || hd_sax_pop(p) != 0) {
+        p->state = HD_SAX_ERROR;
+      } else {
+        p->state = HD_SAX_TEXT;
+      }
+      break;
+    case HD_SAX_END_NAME:
+      if (c == '>') {
+        p->state = hd_sax_pop(p) == 0 ? HD_SAX_TEXT : HD_SAX_ERROR;
+      }
+      break;
+    case HD_SAX_DECL:
+      if (c == '>') {
+        p->state = HD_SAX_TEXT;
+      }
+      break;
+    case HD_SAX_COMMENT:
+      /* "<!-- ... -->" and "<!DOCTYPE ...>": name_len counts dashes,
+       * entity_len is 1 in a comment and 2 in a declaration */
+      if (c == '>' && (p->entity_len != 1 || p->name_len >= 2)) {
+        p->state = HD_SAX_TEXT;
+      } else if (c == '-') {
+        p->name_len++;
+        if (p->name_len == 2 && p->entity_len == 0) {
+          p->entity_len = 1; /* inside a comment from here on */
+          p->name_len = 0;
+        }
+      } else {
+        if (p->entity_len == 0 && p->name_len == 0) {
+          p->entity_len = 2; /* declaration, ends at the next '>' */
+        }
+        p->name_len = 0;
+      }
+      break;
+    default:
+      return -1;
+    }
+  }
+  return p->state == HD_SAX_ERROR ? -1 : 0;
+}
@@ -0,0 +1,154 @@
+// ----------------------------------------------------------------------------
+// Copyright 2016-2020 ARM Ltd.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ----------------------------------------------------------------------------
+
+#ifndef MBED_HD_XML_H
+#define MBED_HD_XML_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HDC15_XML_MAX_SLOTS  8
+
+/* ##NAME placeholders a template may contain */
+enum HDC15_XmlSlotKind
+{
+    HDC15_SLOT_GUID = 0,     //< ##GUID 会话guid
+    HDC15_SLOT_PROGRAM,      //< ##guid 节目guid
+    HDC15_SLOT_EN,           //< ##en   playControl disabled
+    HDC15_SLOT_STR,          //< ##str  文本内容
+    HDC15_SLOT_CMD,          //< ##CMD  方法名
+    HDC15_SLOT_AREA,         //< ##area 区域guid
+    HDC15_SLOT_RES,          //< ##res  资源guid
+    HDC15_SLOT_NUM,
+};
+
+typedef struct HDC15_XmlSlot
+{
+    uint16_t offset;         //< placeholder offset in xml
+    uint16_t close;          //< text slots: offset past the closing tag
+    uint8_t len;             //< placeholder length
+    uint8_t kind;
+    uint8_t text;            //< element text rather than a quoted attribute
+} HDC15_XmlSlot;
+
+/* A command template kept in the layout TiXmlPrinter produces, compiled once
+ * into slot offsets and rendered without building a DOM. */
+typedef struct HDC15_XmlTemplate
+{
+    const char *xml;
+    uint16_t len;
+    uint8_t num;
+    bool ready;
+    HDC15_XmlSlot slot[HDC15_XML_MAX_SLOTS];
+} HDC15_XmlTemplate;
+
+#define HDC15_XML_TEMPLATE(xml) {xml, 0, 0, false, {}}
+
+/* hd_xml_escape() flags */
+#define HDC15_XML_QUOT    0x01   //< value contains '"', printed in '' quotes
+#define HDC15_XML_BLANK   0x02   //< text value is dropped, element prints empty
+
+/* Decodes the character of a legacy charset such as GBK at src (len bytes
+ * left) into ucs, returns the bytes it took or 0 if it is not valid there. */
+typedef size_t (*hd_xml_decode_callback)(const char *src, size_t len,
+                                         uint32_t *ucs);
+
+/* Length of the longest valid UTF-8 prefix of s, len if all of it is. */
+size_t hd_utf8_valid(const char *s, size_t len);
+/* Values that are not valid UTF-8 are decoded with dec, NULL (the default)
+ * refuses them. Applies to every template. */
+void hd_xml_set_decoder(hd_xml_decode_callback dec);
+
+int hd_xml_compile(HDC15_XmlTemplate *t);
+/* values[] is indexed by HDC15_XmlSlotKind, NULL renders as "". Returns the
+ * length written to buf (NUL terminated), -1 if it does not fit or -2 if a
+ * value is neither UTF-8 nor decodable. */
+int hd_xml_render(HDC15_XmlTemplate *t, const char *const *values, char *buf,
+                  size_t size);
+/* Render every slot of t except the kinds in keep (bit 1 << kind) into buf,
+ * and set up bound as the template for the rest. A command that goes to many
+ * devices is rendered once this way and only the per device slots are filled
+ * in for each one. bound->xml points into buf. */
+int hd_xml_bind(HDC15_XmlTemplate *t, const char *const *values, uint32_t keep,
+                HDC15_XmlTemplate *bound, char *buf, size_t size);
+/* Write value the way TinyXML prints it after the parse/print round trip the
+ * old DOM path made: entities and control characters encoded, numeric
+ * references resolved, and for element text runs of spaces condensed.
+ * Returns the length, -1 if it does not fit or -2 for text that is not
+ * UTF-8 (see hd_xml_set_decoder()). */
+int hd_xml_escape(char *buf, size_t size, const char *value, bool text,
+                  uint8_t *flags);
+
+#ifndef HDC15_SAX_MAX_PATH
+#define HDC15_SAX_MAX_PATH   96
+#endif
+#ifndef HDC15_SAX_MAX_DEPTH
+#define HDC15_SAX_MAX_DEPTH  12
+#endif
+#ifndef HDC15_SAX_MAX_NAME
+#define HDC15_SAX_MAX_NAME   32
+#endif
+#ifndef HDC15_SAX_MAX_VALUE
+#define HDC15_SAX_MAX_VALUE  128
+#endif
+#define HDC15_SAX_MAX_WATCH  16
+
+/* Attribute value, element text or element name (see HDC15_SaxWatch). */
+typedef void (*hd_sax_callback)(void *ctx, const char *value);
+
+/* Reports attr of every element at path, e.g. "sdk/out/screen/program" and
+ * "guid"; a last path element "*" matches any element there. attr NULL
+ * reports the element (its name) when its start tag opens, before its
+ * attributes; attr "#text" reports its text content. */
+typedef struct HDC15_SaxWatch
+{
+    const char *path;
+    const char *attr;
+    hd_sax_callback cb;
+    void *ctx;
+} HDC15_SaxWatch;
+
+/* Incremental pull parser for SDKCmdAnswer documents. Input can be fed in
+ * arbitrary pieces as it arrives; only the registered elements and
+ * attributes are reported, and nothing is allocated. Values longer than
+ * HDC15_SAX_MAX_VALUE are truncated. */
+typedef struct HDC15_SaxParser
+{
+    const HDC15_SaxWatch *watch;
+    uint8_t watch_num;
+    uint8_t state;
+    uint8_t depth;
+    uint8_t skip;            //< nesting of the element the path overflowed at
+    char quote;
+    uint8_t name_len;
+    uint8_t entity_len;
+    uint8_t path_len;
+    uint16_t value_len;
+    uint32_t active;         //< watches matching the current element
+    uint8_t mark[HDC15_SAX_MAX_DEPTH];
+    char path[HDC15_SAX_MAX_PATH];
+    char name[HDC15_SAX_MAX_NAME];
+    char entity[12];
+    char value[HDC15_SAX_MAX_VALUE];
+} HDC15_SaxParser;
+
+void hd_sax_init(HDC15_SaxParser *p, const HDC15_SaxWatch *watch, int num);
+/* Returns 0, or -1 once the input is not well formed. */
+int hd_sax_feed(HDC15_SaxParser *p, const char *data, size_t len);
+
+#endif /* MBED_HD_XML_H */